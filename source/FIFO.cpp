@@ -205,11 +205,9 @@ static bool IsMatrixStackCommand(u8 cmd)
 	return cmd == 0x11 || cmd == 0x12;
 }
 
-void GFX_FIFOsend(u8 cmd, u32 param)
+//stores the command without raising any of the fifo events
+static FORCEINLINE void GFX_FIFOpush(u8 cmd, u32 param)
 {
-	//INFO("gxFIFO: send 0x%02X = 0x%08X (size %03i/0x%02X) gxstat 0x%08X\n", cmd, param, gxFIFO.size, gxFIFO.size, gxstat);
-	//printf("fifo recv: %02X: %08X upto:%d\n",cmd,param,gxFIFO.size+1);
-
 	//TODO - WOAH ! NOT HANDLING A TOO-BIG FIFO RIGHT NOW!
 	//if (gxFIFO.size > 255)
 	//{
@@ -242,7 +240,15 @@ void GFX_FIFOsend(u8 cmd, u32 param)
 		printf("--FIFO FULL-- : %d\n",gxFIFO.size);
 	}
 	*/
-	
+}
+
+void GFX_FIFOsend(u8 cmd, u32 param)
+{
+	//INFO("gxFIFO: send 0x%02X = 0x%08X (size %03i/0x%02X) gxstat 0x%08X\n", cmd, param, gxFIFO.size, gxFIFO.size, gxstat);
+	//printf("fifo recv: %02X: %08X upto:%d\n",cmd,param,gxFIFO.size+1);
+
+	GFX_FIFOpush(cmd, param);
+
 	//gxstat |= 0x08000000;		// set busy flag
 
 	GXF_FIFO_handleEvents();
@@ -250,6 +256,20 @@ void GFX_FIFOsend(u8 cmd, u32 param)
 	NDS_RescheduleGXFIFO(1);
 }
 
+void GFX_FIFOsendQueued(u8 cmd, u32 param)
+{
+	GFX_FIFOpush(cmd, param);
+}
+
+void GFX_FIFOsendDone(u32 count)
+{
+	//nothing can look at gxstat between the queued sends, so raising the events once for the end result
+	//is the same as raising them after each one. the pipeline cost still adds up per command.
+	GXF_FIFO_handleEvents();
+
+	if(count) NDS_RescheduleGXFIFO(count);
+}
+
 // this function used ONLY in gxFIFO
 BOOL GFX_PIPErecv(u8 *cmd, u32 *param)
 {
@@ -72,6 +72,10 @@ extern GFX_FIFO gxFIFO;
 extern void GFX_PIPEclear();
 extern void GFX_FIFOclear();
 extern void GFX_FIFOsend(u8 cmd, u32 param);
+//for a run of commands, as from a gxfifo dma: queue each one with GFX_FIFOsendQueued,
+//then call GFX_FIFOsendDone with how many that was
+extern void GFX_FIFOsendQueued(u8 cmd, u32 param);
+extern void GFX_FIFOsendDone(u32 count);
 extern BOOL GFX_PIPErecv(u8 *cmd, u32 *param);
 extern void GFX_FIFOcnt(u32 val);
 
@@ -2191,6 +2191,9 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 		if(!skip)
 		if (l < gpu->dispCapCnt.capy)
 		{
+			//captures are a common way of rendering to a texture, so let the texture cache know
+			MMU_vramMarkDirtyRange(cap_dst_adr, ofsmul);
+
 			switch (gpu->dispCapCnt.capSrc)
 			{
 				case 0:		// Capture source is SourceA
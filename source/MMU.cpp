@@ -47,6 +47,7 @@
 #include "encrypt.h"
 #include "GPU.h"
 #include "SPU.h"
+#include "headless.h"
 
 #include <pspsuspend.h>
 #include "PSP/pspvfpu.h"
@@ -328,6 +329,14 @@ u8 vram_lcdc_map[VRAM_LCDC_PAGES];
 //this maps to 16KB pages in the LCDC buffer which is what will actually contain the data
 u8 vram_arm9_map[VRAM_ARM9_PAGES];
 
+//one flag per 4KB page of the LCDC buffer, set whenever the cpu, dma or display capture writes to it.
+//the texture cache consumes these (see TexCache_Invalidate) so it only needs to revalidate textures on written pages,
+//and so does the rewind buffer so it only needs to look at written pages
+u8 vram_dirty_map[VRAM_DIRTY_PAGES];
+
+//one flag per 4KB page of main memory, for the rewind buffer
+u8 mainmem_dirty_map[MAINMEM_DIRTY_PAGES];
+
 //this chooses which banks are mapped in the 128K banks starting at 0x06000000 in ARM7
 u8 vram_arm7_map[2];
 
@@ -505,6 +514,31 @@ static FORCEINLINE u32 MMU_LCDmap(u32 addr, bool& unmapped, bool& restricted)
 }
 
 
+u8* MMU_ARM7_linearPointer(u32 addr, u32 len)
+{
+	if(len == 0) return NULL;
+	const u32 last = addr + len - 1;
+
+	//main memory is linear up to where it mirrors
+	if((addr>>24) == 0x02)
+	{
+		if((addr & ~_MMU_MAIN_MEM_MASK) != (last & ~_MMU_MAIN_MEM_MASK)) return NULL;
+		return MMU.MAIN_MEM + (addr & _MMU_MAIN_MEM_MASK);
+	}
+
+	//wram and vram are mapped in 16KB pages, so dont bother unless the range sits within one of them
+	if((addr>>24) == 0x03 || (addr>>24) == 0x06)
+	{
+		if((addr>>14) != (last>>14)) return NULL;
+		bool unmapped, restricted;
+		const u32 adr = MMU_LCDmap<ARMCPU_ARM7>(addr, unmapped, restricted);
+		if(unmapped) return NULL;
+		return MMU.MMU_MEM[ARMCPU_ARM7][(adr>>20)&0xFF] + (adr & MMU.MMU_MASK[ARMCPU_ARM7][(adr>>20)&0xFF]);
+	}
+
+	return NULL;
+}
+
 #define LOG_VRAM_ERROR() LOG("No data for block %i MST %i\n", block, VRAMBankCnt & 0x07);
 
 VramConfiguration vramConfiguration;
@@ -844,6 +878,7 @@ static inline void MMU_VRAMmapControl(u8 block, u8 VRAMBankCnt)
 	if(block == 7)
 	{
 		MMU.WRAMCNT = VRAMBankCnt & 3;
+		SPU_RefreshSourcePointers();
 		return;
 	}
 
@@ -950,6 +985,9 @@ static inline void MMU_VRAMmapControl(u8 block, u8 VRAMBankCnt)
 	}
 
 	//-------------------------------
+
+	//the arm7 may have gained or lost banks C and D, which the spu could be playing from
+	SPU_RefreshSourcePointers();
 }
 
 //////////////////////////////////////////////////////////////
@@ -1019,6 +1057,7 @@ void MMU_DeInit(void) {
 	if (MMU.fw.fp)
 		fclose(MMU.fw.fp);
 	mc_free(&MMU.fw);      
+	backup_stopWriter();
 
 	slot1_Shutdown();
 	slot2_Shutdown();
@@ -1055,6 +1094,8 @@ void MMU_Reset()
 	memset(MMU.ARM9_DTCM, 0, sizeof(MMU.ARM9_DTCM));
 	memset(MMU.ARM9_ITCM, 0, sizeof(MMU.ARM9_ITCM));
 	memset(MMU.ARM9_LCD,  0, sizeof(MMU.ARM9_LCD));
+	memset(vram_dirty_map, VRAM_DIRTY_ALL, sizeof(vram_dirty_map));
+	memset(mainmem_dirty_map, MAINMEM_DIRTY_ALL, sizeof(mainmem_dirty_map));
 	memset(MMU.ARM9_OAM,  0, 0x800);
 	memset(MMU.ARM9_REG,  0, sizeof(MMU.ARM9_REG));
 	memset(MMU.ARM9_VMEM, 0, 0x800);
@@ -1565,6 +1606,21 @@ u32 MMU_readFromGC()
 	return val;
 }
 
+//a card dma's whole transfer at once. count is what is left of it
+template<int PROCNUM>
+static void MMU_readFromGCBlock(u32 *dst, u32 count)
+{
+	GCBUS_Controller& card = MMU.dscard[PROCNUM];
+
+	slot1_device->read_GCDATAIN_block(PROCNUM, dst, count);
+
+	card.transfer_count -= count * 4;
+	if(card.transfer_count <= 0)
+	{
+		MMU_GC_endTransfer(PROCNUM);
+	}
+}
+
 template<int PROCNUM>
 void MMU_writeToGC(u32 val)
 {
@@ -2552,7 +2608,44 @@ void DmaController::doCopy()
 	//we might make another function to do just the raw copy op which can use them with checks
 	//outside the loop
 	int time_elapsed = 0;
-	if(sz==4) {
+	if(PROCNUM == ARMCPU_ARM9 && startmode == EDMAMode_GXFifo && sz == 4 && srcinc == 4 && todo > 0
+		&& (src & 0xFF000003) == 0x02000000 && ((src & _MMU_MAIN_MEM_MASK32) + todo*4) <= (_MMU_MAIN_MEM_MASK32+1)
+		&& (dst & ~0x3C) == 0x04000400 && (dst + (todo-1)*dstinc - 0x04000400) < 0x40) {
+
+		//the usual gxfifo dma: a run of packed commands out of main memory into the gxfifo port.
+		//hand the whole run to the geometry engine at once instead of one register write per word.
+		//the timing is charged the same as the loop below would
+		for(s32 i=(s32)todo; i>0; i--)
+		{
+			time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_READ,TRUE>(src,true);
+			time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_WRITE,TRUE>(dst,true);
+			src += srcinc;
+			dst += dstinc;
+		}
+
+		const u32 *words = (const u32*)(MMU.MAIN_MEM + (saddr & _MMU_MAIN_MEM_MASK32));
+		//the port register keeps the last word written to it
+		((u32 *)(MMU.MMU_MEM[ARMCPU_ARM9][0x40]))[((dst - dstinc) & 0xFFF) >> 2] = words[todo-1];
+		//the commands may run right away (GFX3D_DirectGXFifo), which is 3d time rather than dma time
+		HEADLESS_TIMED(HEADLESS_TIMER_3D, gfx3d_sendCommandsToFIFO(words, todo));
+	}
+	else if(startmode == EDMAMode_Card && sz == 4 && srcinc == 0 && src == REG_GCDATAIN
+		&& todo > 0 && todo <= (0x4000 / 4)) {
+
+		//a card transfer: the block comes from the card in one call instead of one GCDATAIN read per word.
+		//the timing is charged the same as the loop below would
+		static u32 block[0x4000 / 4];
+		MMU_readFromGCBlock<PROCNUM>(block, todo);
+
+		for(u32 i=0;i<todo;i++)
+		{
+			time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_READ,TRUE>(src,true);
+			time_elapsed += _MMU_accesstime<PROCNUM,MMU_AT_DMA,32,MMU_AD_WRITE,TRUE>(dst,true);
+			_MMU_write32(procnum,MMU_AT_DMA,dst, block[i]);
+			dst += dstinc;
+		}
+	}
+	else if(sz==4) {
 
 		//time_elapsed = (_MMU_accesstime<PROCNUM, MMU_AT_DMA, 32, MMU_AD_READ, TRUE>(src, true) + _MMU_accesstime<PROCNUM, MMU_AT_DMA, 32, MMU_AD_WRITE, TRUE>(dst, true)) * todo;
 
@@ -3708,6 +3801,7 @@ void FASTCALL _MMU_ARM9_write08(u32 adr, u8 val)
 	adr = MMU_LCDmap<ARMCPU_ARM9>(adr, unmapped, restricted);
 	if(unmapped) return;
 	if(restricted) return; //block 8bit vram writes
+	MMU_vramMarkDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM9))
@@ -4161,6 +4255,7 @@ void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val)
 	bool unmapped, restricted;
 	adr = MMU_LCDmap<ARMCPU_ARM9>(adr, unmapped, restricted);
 	if(unmapped) return;
+	MMU_vramMarkDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM9))
@@ -4592,6 +4687,7 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
 	bool unmapped, restricted;
 	adr = MMU_LCDmap<ARMCPU_ARM9>(adr, unmapped, restricted);
 	if(unmapped) return;
+	MMU_vramMarkDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM9))
@@ -5080,6 +5176,7 @@ void FASTCALL _MMU_ARM7_write08(u32 adr, u8 val)
 	bool unmapped, restricted;
 	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
 	if(unmapped) return;
+	MMU_vramMarkDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM7))
@@ -5271,6 +5368,7 @@ void FASTCALL _MMU_ARM7_write16(u32 adr, u16 val)
 	bool unmapped, restricted;
 	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
 	if(unmapped) return;
+	MMU_vramMarkDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM7))
@@ -5390,6 +5488,7 @@ void FASTCALL _MMU_ARM7_write32(u32 adr, u32 val)
 	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
 	
 	if(unmapped) return;
+	MMU_vramMarkDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM7))
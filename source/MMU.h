@@ -593,6 +593,44 @@ extern VramConfiguration vramConfiguration;
 
 #define VRAM_ARM9_PAGES 512
 extern u8 vram_arm9_map[VRAM_ARM9_PAGES];
+
+#define VRAM_DIRTY_PAGE_SHIFT 12
+#define VRAM_DIRTY_PAGES (0xA4000>>VRAM_DIRTY_PAGE_SHIFT)
+extern u8 vram_dirty_map[VRAM_DIRTY_PAGES];
+
+//a write sets every bit of a vram_dirty_map entry; each consumer clears only its own
+#define VRAM_DIRTY_TEXCACHE 1
+#define VRAM_DIRTY_REWIND 2
+#define VRAM_DIRTY_STATEHASH 4
+#define VRAM_DIRTY_ALL 0xFF
+
+//adr is an address as returned by MMU_LCDmap; only the ones which landed in the LCDC buffer are of interest
+FORCEINLINE void MMU_vramMarkDirty(u32 adr)
+{
+	if((adr>>24) == 0x06)
+		vram_dirty_map[(adr&0xFFFFF)>>VRAM_DIRTY_PAGE_SHIFT] = VRAM_DIRTY_ALL;
+}
+
+//ofs and len are relative to MMU.ARM9_LCD
+FORCEINLINE void MMU_vramMarkDirtyRange(u32 ofs, u32 len)
+{
+	for(u32 page = ofs>>VRAM_DIRTY_PAGE_SHIFT; page <= (ofs+len-1)>>VRAM_DIRTY_PAGE_SHIFT; page++)
+		vram_dirty_map[page] = VRAM_DIRTY_ALL;
+}
+
+//the same for main memory
+#define MAINMEM_DIRTY_PAGE_SHIFT 12
+#define MAINMEM_DIRTY_PAGES ((4*1024*1024)>>MAINMEM_DIRTY_PAGE_SHIFT)
+extern u8 mainmem_dirty_map[MAINMEM_DIRTY_PAGES];
+
+#define MAINMEM_DIRTY_REWIND 1
+#define MAINMEM_DIRTY_STATEHASH 2
+#define MAINMEM_DIRTY_ALL 0xFF
+
+FORCEINLINE void MMU_mainMemMarkDirty(u32 adr)
+{
+	mainmem_dirty_map[(adr>>MAINMEM_DIRTY_PAGE_SHIFT) & (MAINMEM_DIRTY_PAGES-1)] = MAINMEM_DIRTY_ALL;
+}
 FORCEINLINE void* MMU_gpu_map(u32 vram_addr)
 {
 	//this is supposed to map a single gpu vram address to emulator host memory
@@ -615,6 +653,11 @@ FORCEINLINE void* MMU_gpu_map(u32 vram_addr)
 }
 
 
+//returns a host pointer through which [addr, addr+len) can be read as the arm7 sees it,
+//or NULL if that range isnt backed by one linear piece of host memory.
+//the result is only good until the next wram or vram remapping
+u8* MMU_ARM7_linearPointer(u32 addr, u32 len);
+
 template<int PROCNUM, MMU_ACCESS_TYPE AT> u8 _MMU_read08(u32 addr);
 template<int PROCNUM, MMU_ACCESS_TYPE AT> u16 _MMU_read16(u32 addr);
 template<int PROCNUM, MMU_ACCESS_TYPE AT> u32 _MMU_read32(u32 addr);
@@ -849,6 +892,7 @@ FORCEINLINE void _MMU_write08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK, 0) = 0;
 #endif
 		T1WriteByte( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK, val);
+		MMU_mainMemMarkDirty(addr);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 1, val, LUAMEMHOOK_WRITE);
 #endif
@@ -888,6 +932,7 @@ FORCEINLINE void _MMU_write16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK16, 0) = 0;
 #endif
 		T1WriteWord( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK16, val);
+		MMU_mainMemMarkDirty(addr);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 2, val, LUAMEMHOOK_WRITE);
 #endif
@@ -928,6 +973,7 @@ FORCEINLINE void _MMU_write32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 1) = 0;
 #endif
 		T1WriteLong( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK32, val);
+		MMU_mainMemMarkDirty(addr);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 4, val, LUAMEMHOOK_WRITE);
 #endif
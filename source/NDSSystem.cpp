@@ -54,6 +54,9 @@
 #include "slot2.h"
 #include "SPU.h"
 #include "wifi.h"
+#include "avdump.h"
+#include "headless.h"
+#include "saves.h"
 
 #include "PSP/FrontEnd.h"
 
@@ -313,6 +316,8 @@ int NDS_Init()
 
 void NDS_DeInit(void)
 {
+	AVDUMP_End();
+	rewind_clear();
 	gameInfo.closeROM();
 	SPU_DeInit();
 	Screen_DeInit();
@@ -503,15 +508,19 @@ bool GameInfo::loadROM(std::string fname, u32 type)
 
 	closeROM();
 
-	fROM = fopen(fname.c_str(), "rb");
+	//the reader is picked by the extension, which it strips off the name it is given
+	char *noext = strdup(fname.c_str());
+	reader = ROMReaderInit(&noext);
+	free(noext);
+
+	fROM = reader->Init(fname.c_str());
 	if (!fROM) return false;
 
 	headerOffset = (type == ROM_DSGBA)?DSGBA_LOADER_SIZE:0;
-	fseek(fROM, 0, SEEK_END);
-	romsize = ftell(fROM) - headerOffset;
-	fseek(fROM, headerOffset, SEEK_SET);
+	romsize = reader->Size(fROM) - headerOffset;
+	reader->Seek(fROM, headerOffset, SEEK_SET);
 
-	bool res = (fread(&header, 1, sizeof(header), fROM) == sizeof(header));
+	bool res = (reader->Read(fROM, &header, sizeof(header)) == sizeof(header));
 
 	if (res)
 	{
@@ -602,16 +611,16 @@ bool GameInfo::loadROM(std::string fname, u32 type)
 
 		if (type == ROM_NDS)
 		{
-			fseek(fROM, 0x4000 + headerOffset, SEEK_SET);
-			fread(&secureArea[0], 1, 0x4000, fROM);
+			reader->Seek(fROM, 0x4000 + headerOffset, SEEK_SET);
+			reader->Read(fROM, &secureArea[0], 0x4000);
 		}
 
 		if (CommonSettings.loadToMemory)
 		{
-			fseek(fROM, headerOffset, SEEK_SET);
+			reader->Seek(fROM, headerOffset, SEEK_SET);
 			
 			romdata = new u8[romsize + 4];
-			if (fread(romdata, 1, romsize, fROM) != romsize)
+			if (reader->Read(fROM, romdata, romsize) != romsize)
 			{
 				delete [] romdata; romdata = NULL;
 				romsize = 0;
@@ -633,14 +642,27 @@ bool GameInfo::loadROM(std::string fname, u32 type)
 			}
 
 			_isDSiEnhanced = (LE_TO_LOCAL_32(*(u32*)(romdata + 0x180) == 0x8D898581U) && LE_TO_LOCAL_32(*(u32*)(romdata + 0x184) == 0x8C888480U));
-			fclose(fROM); fROM = NULL;
+			reader->DeInit(fROM); fROM = NULL;
 			return true;
 		}
+
+		romPageCount = (romsize + ROM_PAGE_MASK) >> ROM_PAGE_SHIFT;
+		romCache = new u8[ROM_CACHE_SLOTS << ROM_PAGE_SHIFT];
+		romPageSlot = new u8[romPageCount];
+		memset(romPageSlot, ROM_CACHE_NONE, romPageCount);
+		for (int i = 0; i < ROM_CACHE_SLOTS; i++)
+		{
+			romCacheSlotPage[i] = 0xFFFFFFFF;
+			romCacheSlotUsed[i] = 0;
+		}
+		romCacheClock = 0;
+		romCacheLastMiss = 0xFFFFFFFF;
+
 		_isDSiEnhanced = ((readROM(0x180) == 0x8D898581U) && (readROM(0x184) == 0x8C888480U));
 		if (hasRomBanner())
 		{
-			fseek(fROM, header.IconOff + headerOffset, SEEK_SET);
-			fread(&banner, 1, sizeof(RomBanner), fROM);
+			reader->Seek(fROM, header.IconOff + headerOffset, SEEK_SET);
+			reader->Read(fROM, &banner, sizeof(RomBanner));
 			
 			banner.version = LE_TO_LOCAL_16(banner.version);
 			banner.crc16 = LE_TO_LOCAL_16(banner.crc16);
@@ -650,28 +672,79 @@ bool GameInfo::loadROM(std::string fname, u32 type)
 				banner.palette[i] = LE_TO_LOCAL_16(banner.palette[i]);
 			}
 		}
-		fseek(fROM, headerOffset, SEEK_SET);
-		lastReadPos = 0;
+		reader->Seek(fROM, headerOffset, SEEK_SET);
 		return true;
 	}
 
 	romsize = 0;
-	fclose(fROM); fROM = NULL;
+	reader->DeInit(fROM); fROM = NULL;
 	return false;
 }
 
 void GameInfo::closeROM()
 {
 	if (fROM)
-		fclose(fROM);
+		reader->DeInit(fROM);
 
 	if (romdata)
 		delete [] romdata;
 
+	delete [] romCache;
+	delete [] romPageSlot;
+
 	fROM = NULL;
 	romdata = NULL;
 	romsize = 0;
-	lastReadPos = 0xFFFFFFFF;
+	romCache = NULL;
+	romPageSlot = NULL;
+	romPageCount = 0;
+}
+
+//reads the page into the least recently used slot. a miss on the page after the last one missed
+//is most likely a stream through the rom, so the pages after it are read along with it
+u8 GameInfo::romCacheFill(u32 page)
+{
+	const u32 count = (page == romCacheLastMiss + 1) ? 1 + ROM_READAHEAD_PAGES : 1;
+	romCacheLastMiss = page + count - 1;
+
+	reader->Seek(fROM, (page << ROM_PAGE_SHIFT) + headerOffset, SEEK_SET);
+
+	u8 first = ROM_CACHE_NONE;
+	for (u32 i = 0; i < count && page + i < romPageCount; i++)
+	{
+		//already there, and the file position would be off for the ones after it anyway
+		if (romPageSlot[page + i] != ROM_CACHE_NONE) break;
+
+		u8 slot = 0;
+		for (u8 s = 1; s < ROM_CACHE_SLOTS; s++)
+			if (romCacheSlotUsed[s] < romCacheSlotUsed[slot])
+				slot = s;
+
+		if (romCacheSlotPage[slot] != 0xFFFFFFFF)
+			romPageSlot[romCacheSlotPage[slot]] = ROM_CACHE_NONE;
+
+		u8 *dst = romCache + (slot << ROM_PAGE_SHIFT);
+		const int read = reader->Read(fROM, dst, ROM_PAGE_SIZE);
+		const u32 got = (read > 0) ? read : 0;
+		if (got < ROM_PAGE_SIZE)
+			memset(dst + got, 0xFF, ROM_PAGE_SIZE - got);
+
+		romCacheSlotPage[slot] = page + i;
+		romCacheSlotUsed[slot] = ++romCacheClock;
+		romPageSlot[page + i] = slot;
+		if (i == 0) first = slot;
+	}
+
+	return first;
+}
+
+u8* GameInfo::romCachePage(u32 page)
+{
+	u8 slot = romPageSlot[page];
+	if (slot == ROM_CACHE_NONE)
+		slot = romCacheFill(page);
+	romCacheSlotUsed[slot] = ++romCacheClock;
+	return romCache + (slot << ROM_PAGE_SHIFT);
 }
 
 u32 GameInfo::readROM(u32 pos)
@@ -680,10 +753,26 @@ u32 num;
 	u32 data;
 	if (!romdata)
 	{
-		if (lastReadPos != pos)
-			fseek(fROM, pos + headerOffset, SEEK_SET);
-		num = fread(&data, 1, 4, fROM);
-		lastReadPos = (pos + num);
+		const u32 ofs = pos & ROM_PAGE_MASK;
+		if (pos + 4 <= romsize && (pos & 3) == 0)
+		{
+			//fast path. an aligned word never crosses a page
+			data = *(u32*)(romCachePage(pos >> ROM_PAGE_SHIFT) + ofs);
+			num = 4;
+		}
+		else
+		{
+			data = 0;
+			num = 0;
+			for(int i=0;i<4;i++)
+			{
+				if(pos >= romsize)
+					break;
+				data |= (romCachePage(pos >> ROM_PAGE_SHIFT)[pos & ROM_PAGE_MASK]<<(i*8));
+				pos++;
+				num++;
+			}
+		}
 	}
 	else
 	{
@@ -743,6 +832,27 @@ u32 num;
 	**/
 }
 
+//the bytes as readROM would give them, with 0xFF past the end of the rom
+void GameInfo::readROMBlock(u32 pos, u8 *dst, u32 len)
+{
+	const u32 avail = (pos < romsize) ? std::min(len, romsize - pos) : 0;
+
+	if (romdata)
+		memcpy(dst, romdata + pos, avail);
+	else
+	{
+		for (u32 done = 0; done < avail; )
+		{
+			const u32 ofs = (pos + done) & ROM_PAGE_MASK;
+			const u32 run = std::min(avail - done, (u32)ROM_PAGE_SIZE - ofs);
+			memcpy(dst + done, romCachePage((pos + done) >> ROM_PAGE_SHIFT) + ofs, run);
+			done += run;
+		}
+	}
+
+	memset(dst + avail, 0xFF, len - avail);
+}
+
 bool GameInfo::isDSiEnhanced()
 {
 	return _isDSiEnhanced;
@@ -1019,7 +1129,7 @@ struct TSequenceItem_GXFIFO : public TSequenceItem
 			enabled = false;
 			//HCF 3D
 			//if(emula3D)
-				gfx3d_execute3D();
+				HEADLESS_TIMED(HEADLESS_TIMER_3D, gfx3d_execute3D());
 		}
 	}
 
@@ -1132,7 +1242,7 @@ template<int procnum, int chan> struct TSequenceItem_DMA : public TSequenceItem
 			pf.outputStats("dma.txt");
 		}
 		else*/
-			controller->exec();
+			HEADLESS_TIMED(HEADLESS_TIMER_DMA, controller->exec());
 
 //		//give gxfifo dmas a chance to re-trigger
 //		if(MMU.DMAStartTime[procnum][chan] == EDMAMode_GXFifo) {
@@ -1466,8 +1576,8 @@ static void execHardware_hblank()
 
 	//emulation housekeeping. for some reason we always do this at hblank,
 	//even though it sounds more reasonable to do it at hstart
-	if (my_config.enable_sound)
-		SPU_Emulate_core();
+	if (my_config.enable_sound && !CommonSettings.spu_lazyMixing)
+		HEADLESS_TIMED(HEADLESS_TIMER_SPU, SPU_Emulate_core());
 	//driver->AVI_SoundUpdate(SPU_core->outbuf,spu_core_samples);
 	//WAV_WavSoundUpdate(SPU_core->outbuf,spu_core_samples);
 }
@@ -1497,6 +1607,16 @@ static void execHardware_hstart_vblankStart()
 			NDS_makeIrq(i,IRQ_BIT_LCD_VBLANK);
 		}
 
+	//with lazy spu mixing, this is where the bulk of each frame's audio gets mixed
+	if (my_config.enable_sound && CommonSettings.spu_lazyMixing)
+		HEADLESS_TIMED(HEADLESS_TIMER_SPU, SPU_CatchUp());
+
+	//the picture is complete by now. frameskipped frames go in too, so the frame count matches the audio
+	AVDUMP_PushVideo();
+
+	//save memory written since the last frame goes to the file in one go
+	MMU_new.backupDevice.flushIfIdle();
+
 	//trigger vblank dmas
 	if (ME_JobDone() && my_config.PerFectVTiming)
 		triggerDma(EDMAMode_VBlank);
@@ -1601,7 +1721,7 @@ static void execHardware_hstart()
 	{
 
 		//if(my_config.Render3D)
-			gfx3d_VBlankEndSignal(frameSkipper.ShouldSkip3D());
+			HEADLESS_TIMED(HEADLESS_TIMER_3D, gfx3d_VBlankEndSignal(frameSkipper.ShouldSkip3D()));
 		
 	}
 
@@ -1643,14 +1763,14 @@ static void execHardware_hstart()
 		//devil survivor 2 will have screens get stuck if this is on any other scanline.
 		//obviously 192 is the right choice.
 
-		gfx3d_VBlankSignal();
+		HEADLESS_TIMED(HEADLESS_TIMER_3D, gfx3d_VBlankSignal());
 		//this isnt important for any known game, but it would be nice to prove it.
 		//It seems not to be important --  XIRO 
 		//NDS_RescheduleGXFIFO(392 * 2);
 
 		//Render 3D here
 		if (!frameSkipper.ShouldSkip3D() && my_config.Render3D && ME_JobDone()) {
-			gfx3d_VBlankEndSignal(false);
+			HEADLESS_TIMED(HEADLESS_TIMER_3D, gfx3d_VBlankEndSignal(false));
 		}
 	}
 
@@ -2272,9 +2392,11 @@ void NDS_exec(s32 nb)
 
 	sceKernelDcacheWritebackInvalidateAll();
 
-	if (IsEmu() || my_config.ARM_ME) {
-		EMU_SCREEN();
-		renderScreenFull();
+	//the headless runner draws here too, so that the 2d is timed and doesnt depend on the me.
+	//it has no screen to show it on
+	if (IsEmu() || my_config.ARM_ME || headless_active) {
+		if (!headless_active) EMU_SCREEN();
+		HEADLESS_TIMED(HEADLESS_TIMER_2D, renderScreenFull());
 	}else
 	if (ME_JobDone()) {
 		EMU_SCREEN();
@@ -2778,6 +2900,9 @@ void NDS_Reset()
 
 	resetUserInput();
 
+	//the rewind snapshots are of the game that was running
+	rewind_clear();
+
 	//gpu_Thread = sceKernelCreateThread("dmatimer_Thread", &ExecDMA_TIMER, 0x5, 0x10000, 0, NULL);
 
 	//vdDejaLog("asignaciones ");
@@ -23,6 +23,7 @@
 #include <string>
 
 #include "types.h"
+#include "ROMReader.h"
 
 //HCF
 extern int iUsarDynarec;
@@ -314,16 +315,30 @@ struct RomBanner
   //840h  -    End of Icon/Title structure (next 1C0h bytes usually FFh-filled)
 };
 
+//a rom which isnt loaded to memory is read through a cache of pages of the file, ROM_CACHE_SLOTS of them at most
+#define ROM_PAGE_SHIFT 15
+#define ROM_PAGE_SIZE (1 << ROM_PAGE_SHIFT)
+#define ROM_PAGE_MASK (ROM_PAGE_SIZE - 1)
+#ifdef LOWRAM
+#define ROM_CACHE_SLOTS 16
+#else
+#define ROM_CACHE_SLOTS 64
+#endif
+#define ROM_CACHE_NONE 0xFF
+//pages read ahead of a miss which follows on from the one before
+#define ROM_READAHEAD_PAGES 2
+
 struct GameInfo
 {
-	FILE *fROM;
+	//a streamed rom is read through whichever reader suits its file
+	ROMReader_struct *reader;
+	void *fROM;
 	u8	*romdata;
 	u32 romsize;
 	u32 cardSize;
 	u32 mask;
 	u32 crc;
 	u32 chipID;
-	u32 lastReadPos;
 	u32	romType;
 	u32 headerOffset;
 	char ROMserial[20];
@@ -335,17 +350,29 @@ struct GameInfo
 	RomBanner	banner;
 	const RomBanner& getRomBanner();
 
-	GameInfo() :	fROM(NULL),
+	//the page cache of a streamed rom. romPageSlot has the slot each page of the rom is in, or ROM_CACHE_NONE
+	u8	*romCache;
+	u8	*romPageSlot;
+	u32 romPageCount;
+	u32 romCacheSlotPage[ROM_CACHE_SLOTS];
+	u32 romCacheSlotUsed[ROM_CACHE_SLOTS];	//when each slot was last read from, for evicting the least recently used
+	u32 romCacheClock;
+	u32 romCacheLastMiss;
+
+	GameInfo() :	reader(NULL),
+					fROM(NULL),
 					romdata(NULL),
 					crc(0),
 					chipID(0x00000FC2),
 					romsize(0),
 					cardSize(0),
 					mask(0),
-					lastReadPos(0xFFFFFFFF),
 					romType(ROM_NDS),
 					headerOffset(0),
-					_isDSiEnhanced(false)
+					_isDSiEnhanced(false),
+					romCache(NULL),
+					romPageSlot(NULL),
+					romPageCount(0)
 	{
 		memset(&header, 0, sizeof(header));
 		memset(&ROMserial[0], 0, sizeof(ROMserial));
@@ -357,6 +384,9 @@ struct GameInfo
 	bool loadROM(std::string fname, u32 type = ROM_NDS);
 	void closeROM();
 	u32 readROM(u32 pos);
+	void readROMBlock(u32 pos, u8 *dst, u32 len);
+	u8* romCachePage(u32 page);
+	u8 romCacheFill(u32 page);
 	void populate();
 	bool isDSiEnhanced();
 	bool isHomebrew();
@@ -503,6 +533,8 @@ extern struct TCommonSettings {
 		, GFX3D_Zelda_Shadow_Depth_Hack(0)
 		, GFX3D_Renderer_Multisample(false)
 		, GFX3D_TXTHack(false)
+		, GFX3D_FixedPointGeometry(false)
+		, GFX3D_DirectGXFifo(false)
 		, jit_max_block_size(100)
 		, loadToMemory(false)
 		, UseExtBIOS(false)
@@ -537,6 +569,12 @@ extern struct TCommonSettings {
 		, autodetectBackupMethod(0)
 		, spu_captureMuted(false)
 		, spu_advanced(false)
+		, spu_fixedPointMixer(false)
+		, spu_lazyMixing(false)
+		, spu_threaded(false)
+		, rewindBufferKB(0)
+		, rewindInterval(4)
+		, backupFlushFrames(60)
 		, StylusPressure(50)
 		, ConsoleType(NDS_CONSOLE_TYPE_FAT)
 		, StylusJitter(false)
@@ -582,6 +620,8 @@ extern struct TCommonSettings {
 	int  GFX3D_Zelda_Shadow_Depth_Hack;
 	bool GFX3D_Renderer_Multisample;
 	bool GFX3D_TXTHack;
+	bool GFX3D_FixedPointGeometry;
+	bool GFX3D_DirectGXFifo;
 
 	bool loadToMemory;
 
@@ -647,6 +687,17 @@ extern struct TCommonSettings {
 	bool spu_muteChannels[16];
 	bool spu_captureMuted;
 	bool spu_advanced;
+	bool spu_fixedPointMixer;
+	bool spu_lazyMixing;
+	bool spu_threaded;
+
+	//memory for the rewind buffer's snapshots, on top of its copy of main memory and vram. 0 turns rewinding off
+	u32 rewindBufferKB;
+	//frames between rewind snapshots
+	u32 rewindInterval;
+
+	//frames without a write to the save memory after which it is written to the file, even if the card wasnt deselected
+	u32 backupFlushFrames;
 
 	struct _ShowGpu {
 		_ShowGpu() : main(true), sub(true) {}
@@ -19,7 +19,7 @@
 #include "PSPDisplay.h"
 //#include "Version.h"
 
-configP configparms[30];
+configP configparms[40];
 int totalconfig=0;
 int totalconfigDebug=0;
 
@@ -59,6 +59,29 @@ void InitConfigParms(configured_features * params){
 	strcpy(configparms[c].name, "Perfect VBlank IRQ");
 	params->PerFectVTiming = configparms[c].var;
 	c++;
+#ifndef LOWRAM
+	strcpy(configparms[c].name, "Rewind (L + Select)");
+	params->rewind = configparms[c].var;
+	c++;
+	strcpy(configparms[c].name, "Lock-free Audio Buffer");
+	params->audio_ring = configparms[c].var;
+	c++;
+	strcpy(configparms[c].name, "Threaded Audio");
+	params->spu_thread = configparms[c].var;
+	c++;
+	strcpy(configparms[c].name, "Lazy Audio Mixing");
+	params->spu_lazy = configparms[c].var;
+	c++;
+	strcpy(configparms[c].name, "Fixed-point Audio Mixer");
+	params->spu_fixed = configparms[c].var;
+	c++;
+#endif
+	strcpy(configparms[c].name, "Fixed-point Geometry");
+	params->fixed_geometry = configparms[c].var;
+	c++;
+	strcpy(configparms[c].name, "Direct GX FIFO");
+	params->direct_gxfifo = configparms[c].var;
+	c++;
 	
 	totalconfig = c;
 	
@@ -418,7 +441,8 @@ enum {
 	EXT_NDS = 1,
 	EXT_GZ = 2,
 	EXT_ZIP = 4,
-	EXT_UNKNOWN = 8,
+	EXT_NDSC = 8,
+	EXT_UNKNOWN = 16,
 };
 
 const struct {
@@ -426,6 +450,7 @@ const struct {
 	int nExtId;
 } stExtentions[] = {
 	{"nds",EXT_NDS},
+	{"ndsc",EXT_NDSC},
 //	{"gz",EXT_GZ},
 //	{"zip",EXT_ZIP},
 	{NULL, EXT_UNKNOWN}
@@ -30,6 +30,13 @@ public:
 	int firmware_language;
 	bool PerFectVTiming;
 	bool ARM_ME;
+	bool rewind;
+	bool audio_ring;
+	bool spu_thread;
+	bool spu_lazy;
+	bool spu_fixed;
+	bool fixed_geometry;
+	bool direct_gxfifo;
 };
 
 typedef struct configparm {
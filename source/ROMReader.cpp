@@ -21,6 +21,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#ifdef PSP
+#include <pspthreadman.h>
+#endif
 #ifdef HAVE_LIBZZIP
 #include <zzip/zzip.h>
 #endif
@@ -34,6 +40,11 @@
 ROMReader_struct * ROMReaderInit(char ** filename)
 {
 #ifdef HAVE_LIBZ
+	if(strlen(*filename) > 5 && !strcasecmp(".ndsc", *filename + (strlen(*filename) - 5)))
+	{
+		(*filename)[strlen(*filename) - 5] = '\0';
+		return &CHUNKEDROMReader;
+	}
 	if(!strcasecmp(".gz", *filename + (strlen(*filename) - 3)))
 	{
 		(*filename)[strlen(*filename) - 3] = '\0';
@@ -168,6 +179,402 @@ int GZIPROMReaderRead(void * file, void * buffer, u32 size)
 }
 #endif
 
+#ifdef HAVE_LIBZ
+//--------------chunked rom reader
+
+#ifdef LOWRAM
+#define CHUNKED_CACHE_BLOCKS 4
+#else
+#define CHUNKED_CACHE_BLOCKS 8
+#endif
+
+//the biggest block size a container may have, so that a broken header cant ask for all the memory
+#define CHUNKED_MAX_BLOCK_SIZE 0x100000
+
+void * CHUNKEDROMReaderInit(const char * filename);
+void CHUNKEDROMReaderDeInit(void *);
+u32 CHUNKEDROMReaderSize(void *);
+int CHUNKEDROMReaderSeek(void *, int, int);
+int CHUNKEDROMReaderRead(void *, void *, u32);
+
+ROMReader_struct CHUNKEDROMReader =
+{
+	ROMREADER_CHUNKED,
+	"Chunked ROM Reader",
+	CHUNKEDROMReaderInit,
+	CHUNKEDROMReaderDeInit,
+	CHUNKEDROMReaderSize,
+	CHUNKEDROMReaderSeek,
+	CHUNKEDROMReaderRead
+};
+
+struct ChunkedROM
+{
+	FILE *fp;
+	u32 size;
+	u32 blockSize;
+	u32 blockCount;
+	u32 *index;
+	u32 pos;
+
+	//the decompressed blocks, least recently used goes first
+	u8 *compressed;
+	u8 *cache[CHUNKED_CACHE_BLOCKS];
+	u32 cacheBlock[CHUNKED_CACHE_BLOCKS];
+	u32 cacheUsed[CHUNKED_CACHE_BLOCKS];
+	u32 clock;
+
+#ifdef PSP
+	//after a miss, the block after it is decompressed by a thread of its own into prefetchBuf,
+	//through a file handle of its own. every prefetch started is waited for exactly once
+	SceUID thread, wake, done;
+	FILE *prefetchFp;
+	u8 *prefetchCompressed;
+	u8 *prefetchBuf;
+	u32 prefetchBlock;
+	bool prefetchOk;
+	bool prefetchStarted;
+	volatile bool prefetchStop;
+#endif
+};
+
+static bool CHUNKED_Read32(u32 *val, FILE *fp)
+{
+	u8 b[4];
+	if (fread(b, 1, 4, fp) != 4) return false;
+	*val = b[0] | (b[1] << 8) | (b[2] << 16) | (b[3] << 24);
+	return true;
+}
+
+static bool CHUNKED_Write32(u32 val, FILE *fp)
+{
+	const u8 b[4] = { (u8)val, (u8)(val >> 8), (u8)(val >> 16), (u8)(val >> 24) };
+	return fwrite(b, 1, 4, fp) == 4;
+}
+
+static u32 CHUNKED_BlockLength(const ChunkedROM *rom, u32 block)
+{
+	return std::min(rom->blockSize, rom->size - block * rom->blockSize);
+}
+
+static bool CHUNKED_Decode(const ChunkedROM *rom, FILE *fp, u8 *compressed, u32 block, u8 *dst)
+{
+	const u32 len = CHUNKED_BlockLength(rom, block);
+	const u32 compressedLen = rom->index[block + 1] - rom->index[block];
+
+	if (fseek(fp, rom->index[block], SEEK_SET) == 0)
+	{
+		//a block which didnt get any smaller is stored as it is
+		if (compressedLen == len)
+		{
+			if (fread(dst, 1, len, fp) == len)
+				return true;
+		}
+		else if (fread(compressed, 1, compressedLen, fp) == compressedLen)
+		{
+			uLongf outLen = len;
+			if (uncompress(dst, &outLen, compressed, compressedLen) == Z_OK && outLen == len)
+				return true;
+		}
+	}
+
+	memset(dst, 0xFF, len);
+	return false;
+}
+
+#ifdef PSP
+static int CHUNKED_ThreadMain(SceSize args, void *argp)
+{
+	ChunkedROM *rom = *(ChunkedROM**)argp;
+
+	for (;;)
+	{
+		sceKernelWaitSema(rom->wake, 1, NULL);
+		if (rom->prefetchStop) break;
+
+		rom->prefetchOk = CHUNKED_Decode(rom, rom->prefetchFp, rom->prefetchCompressed, rom->prefetchBlock, rom->prefetchBuf);
+		sceKernelSignalSema(rom->done, 1);
+	}
+
+	sceKernelExitThread(0);
+	return 0;
+}
+
+static void CHUNKED_StartPrefetchThread(ChunkedROM *rom, const char *filename)
+{
+	rom->prefetchFp = fopen(filename, "rb");
+	rom->prefetchCompressed = (u8*)malloc(rom->blockSize);
+	rom->prefetchBuf = (u8*)malloc(rom->blockSize);
+	if (!rom->prefetchFp || !rom->prefetchCompressed || !rom->prefetchBuf) return;
+
+	rom->wake = sceKernelCreateSema("chunkedrom_wake", 0, 0, 1, NULL);
+	rom->done = sceKernelCreateSema("chunkedrom_done", 0, 0, 1, NULL);
+	//below the emulation thread, so it decompresses while that one waits
+	rom->thread = sceKernelCreateThread("chunkedrom_Thread", CHUNKED_ThreadMain, 0x30, 0x4000, PSP_THREAD_ATTR_USER, NULL);
+
+	if (rom->wake < 0 || rom->done < 0 || rom->thread < 0 || sceKernelStartThread(rom->thread, sizeof(rom), &rom) < 0)
+	{
+		if (rom->thread >= 0) sceKernelDeleteThread(rom->thread);
+		if (rom->wake >= 0) sceKernelDeleteSema(rom->wake);
+		if (rom->done >= 0) sceKernelDeleteSema(rom->done);
+		rom->thread = rom->wake = rom->done = -1;
+	}
+}
+
+static void CHUNKED_StopPrefetchThread(ChunkedROM *rom)
+{
+	if (rom->thread >= 0)
+	{
+		if (rom->prefetchStarted)
+			sceKernelWaitSema(rom->done, 1, NULL);
+
+		rom->prefetchStop = true;
+		sceKernelSignalSema(rom->wake, 1);
+		sceKernelWaitThreadEnd(rom->thread, NULL);
+		sceKernelDeleteThread(rom->thread);
+		sceKernelDeleteSema(rom->wake);
+		sceKernelDeleteSema(rom->done);
+	}
+
+	if (rom->prefetchFp) fclose(rom->prefetchFp);
+	free(rom->prefetchCompressed);
+	free(rom->prefetchBuf);
+}
+#endif
+
+static const u8 * CHUNKED_Block(ChunkedROM *rom, u32 block)
+{
+	int slot = 0;
+	for (int i = 0; i < CHUNKED_CACHE_BLOCKS; i++)
+	{
+		if (rom->cacheBlock[i] == block)
+		{
+			rom->cacheUsed[i] = ++rom->clock;
+			return rom->cache[i];
+		}
+		if (rom->cacheUsed[i] < rom->cacheUsed[slot])
+			slot = i;
+	}
+
+	bool loaded = false;
+
+#ifdef PSP
+	if (rom->thread >= 0)
+	{
+		if (rom->prefetchStarted)
+		{
+			sceKernelWaitSema(rom->done, 1, NULL);
+			rom->prefetchStarted = false;
+
+			if (rom->prefetchBlock == block && rom->prefetchOk)
+			{
+				std::swap(rom->cache[slot], rom->prefetchBuf);
+				loaded = true;
+			}
+		}
+	}
+#endif
+
+	if (!loaded)
+		CHUNKED_Decode(rom, rom->fp, rom->compressed, block, rom->cache[slot]);
+
+	rom->cacheBlock[slot] = block;
+	rom->cacheUsed[slot] = ++rom->clock;
+
+#ifdef PSP
+	//the next block is most likely the next one wanted
+	const u32 next = block + 1;
+	if (rom->thread >= 0 && next < rom->blockCount)
+	{
+		bool cached = false;
+		for (int i = 0; i < CHUNKED_CACHE_BLOCKS; i++)
+			cached |= (rom->cacheBlock[i] == next);
+
+		if (!cached)
+		{
+			rom->prefetchBlock = next;
+			rom->prefetchStarted = true;
+			sceKernelSignalSema(rom->wake, 1);
+		}
+	}
+#endif
+
+	return rom->cache[slot];
+}
+
+void * CHUNKEDROMReaderInit(const char * filename)
+{
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) return NULL;
+
+	ChunkedROM *rom = (ChunkedROM*)calloc(1, sizeof(ChunkedROM));
+	rom->fp = fp;
+#ifdef PSP
+	rom->thread = rom->wake = rom->done = -1;
+#endif
+
+	char magic[4];
+	u32 version;
+	bool ok = fread(magic, 1, 4, fp) == 4 && !memcmp(magic, CHUNKED_MAGIC, 4)
+		&& CHUNKED_Read32(&version, fp) && version == CHUNKED_VERSION
+		&& CHUNKED_Read32(&rom->size, fp) && CHUNKED_Read32(&rom->blockSize, fp) && CHUNKED_Read32(&rom->blockCount, fp)
+		&& rom->blockSize > 0 && rom->blockSize <= CHUNKED_MAX_BLOCK_SIZE
+		&& rom->blockCount == (rom->size + rom->blockSize - 1) / rom->blockSize;
+
+	if (ok)
+	{
+		rom->index = (u32*)malloc((rom->blockCount + 1) * 4);
+		for (u32 i = 0; ok && i <= rom->blockCount; i++)
+			ok = CHUNKED_Read32(&rom->index[i], fp) && (i == 0 || rom->index[i] >= rom->index[i - 1]);
+		for (u32 i = 0; ok && i < rom->blockCount; i++)
+			ok = (rom->index[i + 1] - rom->index[i]) <= CHUNKED_BlockLength(rom, i);
+	}
+
+	if (ok)
+	{
+		rom->compressed = (u8*)malloc(rom->blockSize);
+		ok = rom->compressed != NULL;
+		for (int i = 0; i < CHUNKED_CACHE_BLOCKS; i++)
+		{
+			rom->cache[i] = (u8*)malloc(rom->blockSize);
+			rom->cacheBlock[i] = 0xFFFFFFFF;
+			ok &= rom->cache[i] != NULL;
+		}
+	}
+
+	if (!ok)
+	{
+		CHUNKEDROMReaderDeInit(rom);
+		return NULL;
+	}
+
+#ifdef PSP
+	CHUNKED_StartPrefetchThread(rom, filename);
+#endif
+
+	return rom;
+}
+
+void CHUNKEDROMReaderDeInit(void * file)
+{
+	ChunkedROM *rom = (ChunkedROM*)file;
+	if (!rom) return;
+
+#ifdef PSP
+	CHUNKED_StopPrefetchThread(rom);
+#endif
+
+	for (int i = 0; i < CHUNKED_CACHE_BLOCKS; i++)
+		free(rom->cache[i]);
+	free(rom->compressed);
+	free(rom->index);
+	fclose(rom->fp);
+	free(rom);
+}
+
+u32 CHUNKEDROMReaderSize(void * file)
+{
+	if (!file) return 0;
+	return ((ChunkedROM*)file)->size;
+}
+
+int CHUNKEDROMReaderSeek(void * file, int offset, int whence)
+{
+	ChunkedROM *rom = (ChunkedROM*)file;
+	if (!rom) return 0;
+
+	switch (whence)
+	{
+		case SEEK_SET: rom->pos = offset; break;
+		case SEEK_CUR: rom->pos += offset; break;
+		case SEEK_END: rom->pos = rom->size + offset; break;
+		default: return -1;
+	}
+	return 0;
+}
+
+int CHUNKEDROMReaderRead(void * file, void * buffer, u32 size)
+{
+	ChunkedROM *rom = (ChunkedROM*)file;
+	if (!rom) return 0;
+
+	u8 *dst = (u8*)buffer;
+	u32 done = 0;
+	while (done < size && rom->pos < rom->size)
+	{
+		const u32 block = rom->pos / rom->blockSize;
+		const u32 ofs = rom->pos % rom->blockSize;
+		const u32 len = std::min(size - done, CHUNKED_BlockLength(rom, block) - ofs);
+
+		memcpy(dst + done, CHUNKED_Block(rom, block) + ofs, len);
+		done += len;
+		rom->pos += len;
+	}
+
+	return done;
+}
+
+bool CHUNKEDROM_Create(const char * src, const char * dst, u32 blockSize)
+{
+	if (blockSize == 0 || blockSize > CHUNKED_MAX_BLOCK_SIZE) return false;
+
+	FILE *in = fopen(src, "rb");
+	if (!in) return false;
+	fseek(in, 0, SEEK_END);
+	const u32 size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+
+	FILE *out = fopen(dst, "wb");
+	if (!out)
+	{
+		fclose(in);
+		return false;
+	}
+
+	const u32 blockCount = (size + blockSize - 1) / blockSize;
+	std::vector<u32> index(blockCount + 1);
+	std::vector<u8> raw(blockSize);
+	std::vector<u8> compressed(compressBound(blockSize));
+
+	//the index gets written again once the offsets are known
+	fwrite(CHUNKED_MAGIC, 1, 4, out);
+	CHUNKED_Write32(CHUNKED_VERSION, out);
+	CHUNKED_Write32(size, out);
+	CHUNKED_Write32(blockSize, out);
+	CHUNKED_Write32(blockCount, out);
+	for (u32 i = 0; i <= blockCount; i++)
+		CHUNKED_Write32(0, out);
+
+	bool ok = true;
+	index[0] = 20 + (blockCount + 1) * 4;
+	for (u32 i = 0; ok && i < blockCount; i++)
+	{
+		const u32 len = std::min(blockSize, size - i * blockSize);
+		ok = fread(&raw[0], 1, len, in) == len;
+
+		uLongf compressedLen = compressed.size();
+		if (ok && compress2(&compressed[0], &compressedLen, &raw[0], len, Z_BEST_COMPRESSION) == Z_OK && compressedLen < len)
+			ok = fwrite(&compressed[0], 1, compressedLen, out) == compressedLen;
+		else if (ok)
+		{
+			compressedLen = len;
+			ok = fwrite(&raw[0], 1, len, out) == len;
+		}
+
+		index[i + 1] = index[i] + compressedLen;
+	}
+
+	fseek(out, 20, SEEK_SET);
+	for (u32 i = 0; ok && i <= blockCount; i++)
+		ok = CHUNKED_Write32(index[i], out);
+
+	fclose(in);
+	fclose(out);
+	if (!ok) remove(dst);
+	return ok;
+}
+#endif
+
 #ifdef HAVE_LIBZZIP
 void * ZIPROMReaderInit(const char * filename);
 void ZIPROMReaderDeInit(void *);
@@ -16,6 +16,9 @@
 	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef _ROMREADER_H_
+#define _ROMREADER_H_
+
 #ifdef HAVE_LIBZ
 #include <zlib.h>
 #endif
@@ -27,6 +30,16 @@
 #define ROMREADER_STD	0
 #define ROMREADER_GZIP	1
 #define ROMREADER_ZIP	2
+#define ROMREADER_CHUNKED	3
+
+//.ndsc: a rom in independently deflated blocks, so that any part of it can be read without the rest.
+//all little endian:
+//  "DSCR", version, rom size, block size, block count
+//  block count + 1 file offsets: where each block starts, and where the last one ends
+//  the blocks. one which didnt get any smaller is stored as it is
+#define CHUNKED_MAGIC	"DSCR"
+#define CHUNKED_VERSION	1
+#define CHUNKED_DEFAULT_BLOCK_SIZE	0x10000
 
 typedef struct
 {
@@ -42,9 +55,15 @@ typedef struct
 extern ROMReader_struct STDROMReader;
 #ifdef HAVE_LIBZ
 extern ROMReader_struct GZIPROMReader;
+extern ROMReader_struct CHUNKEDROMReader;
+
+//writes src as a .ndsc container
+bool CHUNKEDROM_Create(const char * src, const char * dst, u32 blockSize = CHUNKED_DEFAULT_BLOCK_SIZE);
 #endif
 #ifdef HAVE_LIBZZIP
 extern ROMReader_struct ZIPROMReader;
 #endif
 
 ROMReader_struct * ROMReaderInit(char ** filename);
+
+#endif
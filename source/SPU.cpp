@@ -43,6 +43,12 @@
 #include "types.h"
 
 #include "PSP/pspvfpu.h"
+#include "utils/ringbuffer.h"
+#include "avdump.h"
+
+#ifdef PSP
+#include <pspthreadman.h>
+#endif
 
 //HCF Sound quality (channels playing)
 int iSoundQuality = 1;
@@ -54,6 +60,11 @@ static inline s16 read16(u32 addr) { return (s16)_MMU_read16<ARMCPU_ARM7,MMU_AT_
 static inline u8 read08(u32 addr) { return _MMU_read08<ARMCPU_ARM7,MMU_AT_DEBUG>(addr); }
 static inline s8 read_s8(u32 addr) { return (s8)_MMU_read08<ARMCPU_ARM7,MMU_AT_DEBUG>(addr); }
 
+//sample data reads, straight from host memory when the channel source could be resolved to it
+static FORCEINLINE s16 chan_read16(const channel_struct * const chan, u32 ofs) { return chan->hostaddr ? (s16)T1ReadWord_guaranteedAligned(chan->hostaddr, ofs) : read16(chan->addr + ofs); }
+static FORCEINLINE u8 chan_read08(const channel_struct * const chan, u32 ofs) { return chan->hostaddr ? chan->hostaddr[ofs] : read08(chan->addr + ofs); }
+static FORCEINLINE s8 chan_read_s8(const channel_struct * const chan, u32 ofs) { return chan->hostaddr ? (s8)chan->hostaddr[ofs] : read_s8(chan->addr + ofs); }
+
 #define K_ADPCM_LOOPING_RECOVERY_INDEX 99999
 #define COSINE_INTERPOLATION_RESOLUTION 8192
 
@@ -116,6 +127,7 @@ static const s16 wavedutytbl[8][8] = {
 static s32 precalcdifftbl[89][16];
 static u8 precalcindextbl[89][8];
 static double cos_lut[COSINE_INTERPOLATION_RESOLUTION];
+static s32 cos_lut_fx[COSINE_INTERPOLATION_RESOLUTION];
 
 static const double ARM7_CLOCK = 33513982;
 
@@ -123,6 +135,14 @@ static const double samples_per_hline = (DESMUME_SAMPLE_RATE / 59.8261f) / 263.0
 
 static double samples = 0;
 
+//lazy mixing (CommonSettings.spu_lazyMixing): rather than mixing a couple of samples every hblank,
+//the core spu is only brought up to date with nds_timer when a register is touched, at vblank,
+//and when the frontend wants audio. the remainder is kept in units of 1/DESMUME_SAMPLE_RATE cycles
+static const u64 SPU_CYCLE_CLOCK = 33513982ULL * 2; //nds_timer runs at the arm9 clock
+static u64 spu_mixedUntil = 0;
+static u64 spu_cycleRemainder = 0;
+static bool spu_clockValid = false;
+
 template<typename T>
 static FORCEINLINE T MinMax(T val, T min, T max)
 {
@@ -156,6 +176,158 @@ static int MinMax(int long, int min, int max)
 }
 */
 
+//------------------------------------------
+//threaded user spu (CommonSettings.spu_threaded, dual synch/asynch mode only)
+//SPU_core stays on the emulation thread, since it is what the game sees (status bits, capture) and it
+//doesnt need to mix in this mode. SPU_user gets a thread of its own: register writes are logged with
+//their nds_timer, and the thread replays them, mixing whatever falls between two writes into the synchronizer.
+//while the thread runs, the emulation thread may only touch SPU_user or the synchronizer under SPU_LockUser
+
+struct SPURegWrite
+{
+	u64 timestamp;
+	u32 addr;
+	u32 val;
+	u32 size; //1, 2 or 4. 0 only moves the clock forward
+};
+
+static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length);
+
+bool SPU_threadActive = false;
+static SPSCRing<SPURegWrite,4096> spu_regLog;
+static u64 spu_threadClock = 0;
+static u64 spu_threadRemainder = 0;
+static bool spu_threadClockValid = false;
+
+#ifdef PSP
+static SceUID spu_thread = -1;
+static SceUID spu_threadWake = -1;
+static SceUID spu_threadLock = -1;
+static volatile bool spu_threadStop = false;
+
+static void SPU_LockUser() { if(SPU_threadActive) sceKernelWaitSema(spu_threadLock, 1, NULL); }
+static void SPU_UnlockUser() { if(SPU_threadActive) sceKernelSignalSema(spu_threadLock, 1); }
+static void SPU_WakeThread() { if(SPU_threadActive) sceKernelSignalSema(spu_threadWake, 1); }
+#else
+static void SPU_LockUser() {}
+static void SPU_UnlockUser() {}
+static void SPU_WakeThread() {}
+#endif
+
+//mixes SPU_user from where the thread clock is up to timestamp
+static void SPU_ThreadMixTo(u64 timestamp)
+{
+	if(!spu_threadClockValid || timestamp < spu_threadClock)
+	{
+		spu_threadClock = timestamp;
+		spu_threadRemainder = 0;
+		spu_threadClockValid = true;
+		return;
+	}
+
+	spu_threadRemainder += (timestamp - spu_threadClock) * DESMUME_SAMPLE_RATE;
+	spu_threadClock = timestamp;
+
+	u32 todo = (u32)(spu_threadRemainder / SPU_CYCLE_CLOCK);
+	spu_threadRemainder -= (u64)todo * SPU_CYCLE_CLOCK;
+
+	while(todo)
+	{
+		const u32 count = std::min(todo, SPU_user->bufsize);
+		SPU_MixAudio(true, SPU_user, count);
+		synchronizer->enqueue_samples(SPU_user->outbuf, count);
+		todo -= count;
+	}
+}
+
+//drops whatever is still logged; the caller is about to make SPU_user match SPU_core
+static void SPU_ThreadResync()
+{
+	spu_regLog.clear();
+	spu_threadClockValid = false;
+}
+
+void SPU_LogWrite(u32 addr, u32 val, u32 size)
+{
+	SPURegWrite w = { nds_timer, addr, val, size };
+	while(!spu_regLog.push(w))
+	{
+#ifdef PSP
+		//the spu thread has fallen behind, give it a chance to drain the log
+		SPU_WakeThread();
+		sceKernelDelayThread(100);
+#endif
+	}
+}
+
+#ifdef PSP
+static int SPU_ThreadMain(SceSize args, void *argp)
+{
+	while(!spu_threadStop)
+	{
+		sceKernelWaitSema(spu_threadWake, 1, NULL);
+		sceKernelWaitSema(spu_threadLock, 1, NULL);
+
+		SPURegWrite w;
+		while(spu_regLog.pop(w))
+		{
+			SPU_ThreadMixTo(w.timestamp);
+			switch(w.size)
+			{
+				case 1: SPU_user->WriteByte(w.addr, (u8)w.val); break;
+				case 2: SPU_user->WriteWord(w.addr, (u16)w.val); break;
+				case 4: SPU_user->WriteLong(w.addr, w.val); break;
+			}
+		}
+
+		sceKernelSignalSema(spu_threadLock, 1);
+	}
+
+	sceKernelExitThread(0);
+	return 0;
+}
+#endif
+
+static void SPU_StopThread()
+{
+#ifdef PSP
+	if(!SPU_threadActive) return;
+
+	spu_threadStop = true;
+	sceKernelSignalSema(spu_threadWake, 1);
+	sceKernelWaitThreadEnd(spu_thread, NULL);
+	sceKernelDeleteThread(spu_thread);
+	sceKernelDeleteSema(spu_threadWake);
+	sceKernelDeleteSema(spu_threadLock);
+	spu_thread = spu_threadWake = spu_threadLock = -1;
+	SPU_threadActive = false;
+#endif
+}
+
+static void SPU_StartThread()
+{
+#ifdef PSP
+	SPU_ThreadResync();
+	spu_threadStop = false;
+
+	spu_threadWake = sceKernelCreateSema("spu_wake", 0, 0, 1, NULL);
+	spu_threadLock = sceKernelCreateSema("spu_lock", 0, 1, 1, NULL);
+	//just below the main thread, so that it mixes while the emulation thread waits on the display or the GE
+	spu_thread = sceKernelCreateThread("spu_Thread", SPU_ThreadMain, 0x21, 0x10000, PSP_THREAD_ATTR_USER | PSP_THREAD_ATTR_VFPU, NULL);
+
+	if(spu_threadWake < 0 || spu_threadLock < 0 || spu_thread < 0 || sceKernelStartThread(spu_thread, 0, NULL) < 0)
+	{
+		if(spu_thread >= 0) sceKernelDeleteThread(spu_thread);
+		if(spu_threadWake >= 0) sceKernelDeleteSema(spu_threadWake);
+		if(spu_threadLock >= 0) sceKernelDeleteSema(spu_threadLock);
+		spu_thread = spu_threadWake = spu_threadLock = -1;
+		return;
+	}
+
+	SPU_threadActive = true;
+#endif
+}
+
 //--------------external spu interface---------------
 
 int SPU_ChangeSoundCore(int coreid, int buffersize)
@@ -164,6 +336,7 @@ int SPU_ChangeSoundCore(int coreid, int buffersize)
 
 	::buffersize = buffersize;
 
+	SPU_StopThread();
 	delete SPU_user; SPU_user = NULL;
 
 	// Make sure the old core is freed
@@ -231,9 +404,13 @@ int SPU_Init(int coreid, int buffersize)
 	
 	// Build the cosine interpolation LUT
 	for(unsigned int i = 0; i < COSINE_INTERPOLATION_RESOLUTION; i++)
+	{
 		cos_lut[i] = (1.0 - cos(((double)i/(double)COSINE_INTERPOLATION_RESOLUTION) * M_PI)) * 0.5;
+		cos_lut_fx[i] = (s32)(cos_lut[i] * 65536.0);
+	}
 
-	SPU_core = new SPU_struct((int)ceil(samples_per_hline));
+	//big enough for a whole frame, so that the lazy mode can usually mix in one go
+	SPU_core = new SPU_struct((int)ceil(samples_per_hline * 263));
 	SPU_Reset();
 
 	//create adpcm decode accelerator lookups
@@ -268,17 +445,30 @@ void SPU_Pause(int pause)
 		SNDCore->UnMuteAudio();
 }
 
+void SPU_RefreshSourcePointers()
+{
+	if(SPU_core) SPU_core->ResolveSources();
+	SPU_LockUser();
+	if(SPU_user) SPU_user->ResolveSources();
+	SPU_UnlockUser();
+}
+
 void SPU_CloneUser()
 {
+	SPU_LockUser();
 	if(SPU_user) {
 		fast_memcpy(SPU_user->channels,SPU_core->channels,sizeof(SPU_core->channels));
 		SPU_user->regs = SPU_core->regs;
+		SPU_ThreadResync();
 	}
+	SPU_UnlockUser();
 }
 
 
 void SPU_SetSynchMode(int mode, int method)
 {
+	SPU_StopThread();
+
 	synchmode = (ESynchMode)mode;
 	if(synchmethod != (ESynchMethod)method)
 	{
@@ -296,6 +486,8 @@ void SPU_SetSynchMode(int mode, int method)
 	{
 		SPU_user = new SPU_struct(buffersize);
 		SPU_CloneUser();
+		if(CommonSettings.spu_threaded)
+			SPU_StartThread();
 	}
 }
 
@@ -319,6 +511,7 @@ void SPU_Reset(void)
 
 	SPU_core->reset();
 
+	SPU_LockUser();
 	if(SPU_user) {
 		if(SNDCore)
 		{
@@ -327,7 +520,9 @@ void SPU_Reset(void)
 			SNDCore->SetVolume(volume);
 		}
 		SPU_user->reset();
+		SPU_ThreadResync();
 	}
+	SPU_UnlockUser();
 
 	//zero - 09-apr-2010: this concerns me, regarding savestate synch.
 	//After 0.9.6, lets experiment with removing it and just properly zapping the spu instead
@@ -336,6 +531,7 @@ void SPU_Reset(void)
 		T1WriteByte(MMU.ARM7_REG, i, 0);
 
 	samples = 0;
+	spu_clockValid = false;
 }
 
 //------------------------------------------
@@ -379,6 +575,7 @@ void SPU_DeInit(void)
 		SNDCore->DeInit();
 	SNDCore = 0;
 
+	SPU_StopThread();
 	delete SPU_core; SPU_core=0;
 	delete SPU_user; SPU_user=0;
 }
@@ -396,6 +593,19 @@ static FORCEINLINE void adjust_channel_timer(channel_struct *chan)
 	chan->sampinc = (((double)ARM7_CLOCK) / (DESMUME_SAMPLE_RATE * 2)) / (double)(0x10000 - chan->timer);
 }
 
+//looks up a host pointer for the whole sample range of the channel, so the fetchers can skip the MMU.
+//one extra word is included for the interpolation fetch one past the end
+static FORCEINLINE void resolve_channel_source(channel_struct *chan)
+{
+	chan->hostaddr = MMU_ARM7_linearPointer(chan->addr, (chan->totlength << 2) + 4);
+}
+
+void SPU_struct::ResolveSources()
+{
+	for(int i=0;i<16;i++)
+		resolve_channel_source(&channels[i]);
+}
+
 void SPU_struct::KeyProbe(int chan_num)
 {
 	channel_struct &thischan = channels[chan_num];
@@ -425,6 +635,7 @@ void SPU_struct::KeyOn(int channel)
 
 	thischan.totlength = thischan.length + thischan.loopstart;
 	adjust_channel_timer(&thischan);
+	resolve_channel_source(&thischan);
 
 	//printf("keyon %d totlength:%d\n",channel,thischan.totlength);
 
@@ -447,9 +658,9 @@ void SPU_struct::KeyOn(int channel)
 		break;
 	case 2: // ADPCM
 		{
-			thischan.pcm16b = (s16)read16(thischan.addr);
+			thischan.pcm16b = chan_read16(&thischan, 0);
 			thischan.pcm16b_last = thischan.pcm16b;
-			thischan.index = read08(thischan.addr + 2) & 0x7F;;
+			thischan.index = chan_read08(&thischan, 2) & 0x7F;
 			thischan.lastsampcnt = 7;
 			thischan.sampcnt = -3;
 			thischan.loop_index = K_ADPCM_LOOPING_RECOVERY_INDEX;
@@ -798,10 +1009,10 @@ void SPU_struct::WriteByte(u32 addr, u8 val)
 				thischan.keyon = (val >> 7) & 0x01;
 				KeyProbe(chan_num);
 				break;
-			case 0x4: *(u8*)(thischan.addr + 0) = (val & 0xFC); break;
-			case 0x5: *(u8*)(thischan.addr + 1) = val; break;
-			case 0x6: *(u8*)(thischan.addr + 2) = val; break;
-			case 0x7: *(u8*)(thischan.addr + 3) = (val & 0x07); break; //only 27 bits of this register are used
+			case 0x4: ((u8*)&thischan.addr)[0] = (val & 0xFC); resolve_channel_source(&thischan); break;
+			case 0x5: ((u8*)&thischan.addr)[1] = val; resolve_channel_source(&thischan); break;
+			case 0x6: ((u8*)&thischan.addr)[2] = val; resolve_channel_source(&thischan); break;
+			case 0x7: ((u8*)&thischan.addr)[3] = (val & 0x07); resolve_channel_source(&thischan); break; //only 27 bits of this register are used
 			case 0x8: *(u8*)(thischan.timer + 0) = val; adjust_channel_timer(&thischan); break;
 			case 0x9: *(u8*)(thischan.timer + 1) = val; adjust_channel_timer(&thischan); break;
 
@@ -894,8 +1105,8 @@ void SPU_struct::WriteWord(u32 addr, u16 val)
 				thischan.keyon = (val >> 15) & 0x1;
 				KeyProbe(chan_num);
 				break;
-			case 0x4: *(u16*)(thischan.addr + 0) = (val & 0xFFFC); break;
-			case 0x6: *(u16*)(thischan.addr + 1) = (val & 0x07FF); break;
+			case 0x4: ((u16*)&thischan.addr)[0] = (val & 0xFFFC); resolve_channel_source(&thischan); break;
+			case 0x6: ((u16*)&thischan.addr)[1] = (val & 0x07FF); resolve_channel_source(&thischan); break;
 			case 0x8: thischan.timer = val; adjust_channel_timer(&thischan); break;
 			case 0xA: thischan.loopstart = val; break;
 			case 0xC: *(u16*)(thischan.length + 0) = val; break;
@@ -980,7 +1191,7 @@ void SPU_struct::WriteLong(u32 addr, u32 val)
 				KeyProbe(chan_num);
 			break;
 
-			case 0x4: thischan.addr = (val & 0x07FFFFFC); break;
+			case 0x4: thischan.addr = (val & 0x07FFFFFC); resolve_channel_source(&thischan); break;
 			case 0x8: 
 				thischan.timer = (val & 0xFFFF);
 				thischan.loopstart = ((val >> 16) & 0xFFFF);
@@ -1081,15 +1292,15 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void Fetch8Bi
 	u32 loc = sputrunc(chan->sampcnt);
 	if(INTERPOLATE_MODE != SPUInterpolation_None)
 	{
-		s32 a = (s32)(read_s8(chan->addr + loc) << 8);
+		s32 a = (s32)(chan_read_s8(chan, loc) << 8);
 		if(loc < (chan->totlength << 2) - 1) {
-			s32 b = (s32)(read_s8(chan->addr + loc + 1) << 8);
+			s32 b = (s32)(chan_read_s8(chan, loc + 1) << 8);
 			a = Interpolate<INTERPOLATE_MODE>(a, b, chan->sampcnt);
 		}
 		*data = a;
 	}
 	else
-		*data = (s32)read_s8(chan->addr + loc)<< 8;
+		*data = (s32)chan_read_s8(chan, loc)<< 8;
 }
 
 template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void Fetch16BitData(const channel_struct * const chan, s32 *data)
@@ -1104,16 +1315,40 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void Fetch16B
 	{
 		u32 loc = sputrunc(chan->sampcnt);
 		
-		s32 a = (s32)read16(loc*2 + chan->addr), b;
+		s32 a = (s32)chan_read16(chan, loc*2), b;
 		if(loc < (chan->totlength << 1) - 1)
 		{
-			b = (s32)read16(loc*2 + chan->addr + 2);
+			b = (s32)chan_read16(chan, loc*2 + 2);
 			a = Interpolate<INTERPOLATE_MODE>(a, b, chan->sampcnt);
 		}
 		*data = a;
 	}
 	else
-		*data = read16(chan->addr + sputrunc(chan->sampcnt)*2);
+		*data = chan_read16(chan, sputrunc(chan->sampcnt)*2);
+}
+
+//decodes nibbles up to and including sample number 'loc'
+static FORCEINLINE void DecodeADPCMTo(channel_struct * const chan, const u32 loc)
+{
+	for (u32 i = chan->lastsampcnt+1; i <= loc; i++)
+	{
+		const u32 shift = (i&1)<<2;
+		const u32 data4bit = ((u32)chan_read08(chan, i>>1)) >> shift;
+
+		const s32 diff = precalcdifftbl[chan->index][data4bit & 0xF];
+		chan->index = precalcindextbl[chan->index][data4bit & 0x7];
+
+		chan->pcm16b_last = chan->pcm16b;
+		chan->pcm16b = MinMax(chan->pcm16b+diff, -0x8000, 0x7FFF);
+
+		if(i == (chan->loopstart<<3)) {
+			//if(chan->loop_index != K_ADPCM_LOOPING_RECOVERY_INDEX) printf("over-snagging\n");
+			chan->loop_pcm16b = chan->pcm16b;
+			chan->loop_index = chan->index;
+		}
+	}
+
+	chan->lastsampcnt = loc;
 }
 
 template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchADPCMData(channel_struct * const chan, s32 * const data)
@@ -1125,29 +1360,8 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchADP
 	}
 
 	// No sense decoding, just return the last sample
-	if (chan->lastsampcnt != sputrunc(chan->sampcnt)){
-
-		const u32 endExclusive = sputrunc(chan->sampcnt+1);
-		for (u32 i = chan->lastsampcnt+1; i < endExclusive; i++)
-		{
-			const u32 shift = (i&1)<<2;
-			const u32 data4bit = ((u32)read08(chan->addr + (i>>1))) >> shift;
-
-			const s32 diff = precalcdifftbl[chan->index][data4bit & 0xF];
-			chan->index = precalcindextbl[chan->index][data4bit & 0x7];
-
-			chan->pcm16b_last = chan->pcm16b;
-			chan->pcm16b = MinMax(chan->pcm16b+diff, -0x8000, 0x7FFF);
-
-			if(i == (chan->loopstart<<3)) {
-				//if(chan->loop_index != K_ADPCM_LOOPING_RECOVERY_INDEX) printf("over-snagging\n");
-				chan->loop_pcm16b = chan->pcm16b;
-				chan->loop_index = chan->index;
-			}
-		}
-
-		chan->lastsampcnt = sputrunc(chan->sampcnt);
-	}
+	if (chan->lastsampcnt != sputrunc(chan->sampcnt))
+		DecodeADPCMTo(chan, sputrunc(chan->sampcnt));
 
 	if(INTERPOLATE_MODE != SPUInterpolation_None)
 		*data = Interpolate<INTERPOLATE_MODE>((s32)chan->pcm16b_last,(s32)chan->pcm16b,chan->sampcnt);
@@ -1155,32 +1369,25 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchADP
 		*data = (s32)chan->pcm16b;
 }
 
-static FORCEINLINE void FetchPSGData(channel_struct *chan, s32 *data)
+static FORCEINLINE void FetchPSGDataAt(channel_struct *chan, const u32 loc, s32 *data)
 {
-	if (chan->sampcnt < 0)
-	{
-		*data = 0;
-		return;
-	}
-
 	if(chan->num < 8)
 	{
 		*data = 0;
 	}
 	else if(chan->num < 14)
 	{
-		*data = (s32)wavedutytbl[chan->waveduty][(sputrunc(chan->sampcnt)) & 0x7];
+		*data = (s32)wavedutytbl[chan->waveduty][loc & 0x7];
 	}
 	else
 	{
-		if(chan->lastsampcnt == sputrunc(chan->sampcnt))
+		if(chan->lastsampcnt == loc)
 		{
 			*data = (s32)chan->psgnoise_last;
 			return;
 		}
 
-		u32 max = sputrunc(chan->sampcnt);
-		for(u32 i = chan->lastsampcnt; i < max; i++)
+		for(u32 i = chan->lastsampcnt; i < loc; i++)
 		{
 			if(chan->x & 0x1)
 			{
@@ -1194,12 +1401,23 @@ static FORCEINLINE void FetchPSGData(channel_struct *chan, s32 *data)
 			}
 		}
 
-		chan->lastsampcnt = sputrunc(chan->sampcnt);
+		chan->lastsampcnt = loc;
 
 		*data = (s32)chan->psgnoise_last;
 	}
 }
 
+static FORCEINLINE void FetchPSGData(channel_struct *chan, s32 *data)
+{
+	if (chan->sampcnt < 0)
+	{
+		*data = 0;
+		return;
+	}
+
+	FetchPSGDataAt(chan, sputrunc(chan->sampcnt), data);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
 static FORCEINLINE void MixL(SPU_struct* SPU, channel_struct *chan, s32 data)
@@ -1246,6 +1464,22 @@ template<int FORMAT> static FORCEINLINE void TestForLoop(SPU_struct *SPU, channe
 	}
 }
 
+static FORCEINLINE void RestartADPCMLoop(channel_struct *chan)
+{
+	if(chan->loop_index == K_ADPCM_LOOPING_RECOVERY_INDEX)
+	{
+		chan->pcm16b = chan_read16(chan, 0);
+		chan->index = chan_read08(chan, 2) & 0x7F;
+		chan->lastsampcnt = 7;
+	}
+	else
+	{
+		chan->pcm16b = chan->loop_pcm16b;
+		chan->index = chan->loop_index;
+		chan->lastsampcnt = (chan->loopstart << 3);
+	}
+}
+
 static FORCEINLINE void TestForLoop2(SPU_struct *SPU, channel_struct *chan)
 {
 	// Minimum length (the sum of PNT+LEN) is 4 words (16 bytes), 
@@ -1265,18 +1499,7 @@ static FORCEINLINE void TestForLoop2(SPU_struct *SPU, channel_struct *chan)
 			
 			while (chan->sampcnt > chan->double_totlength_shifted) chan->sampcnt -= step;
 
-			if(chan->loop_index == K_ADPCM_LOOPING_RECOVERY_INDEX)
-			{
-				chan->pcm16b = (s16)read16(chan->addr);
-				chan->index = read08(chan->addr+2) & 0x7F;
-				chan->lastsampcnt = 7;
-			}
-			else
-			{
-				chan->pcm16b = chan->loop_pcm16b;
-				chan->index = chan->loop_index;
-				chan->lastsampcnt = (chan->loopstart << 3);
-			}
+			RestartADPCMLoop(chan);
 		}
 		else
 		{
@@ -1362,215 +1585,414 @@ FORCEINLINE static void _SPU_ChanUpdate(const bool actuallyMix, SPU_struct* cons
 	}
 }
 
-//ENTERNEW
-static void SPU_MixAudio_Advanced(bool actuallyMix, SPU_struct *SPU, int length)
-{
-	//the advanced spu function correctly handles all sound control mixing options, as well as capture
-	//this code is not entirely optimal, as it relies on sort of manhandling the core mixing functions
-	//in order to get the results it needs.
-
-	//THIS IS MAX HACKS!!!!
-	//AND NEEDS TO BE REWRITTEN ALONG WITH THE DEEPEST PARTS OF THE SPU
-	//ONCE WE KNOW THAT IT WORKS
-	
-	//BIAS gets ignored since our spu is still not bit perfect,
-	//and it doesnt matter for purposes of capture
-
-	//-----------DEBUG CODE
-	bool skipcap = false;
-	//-----------------
+//////////////////////////////////////////////////////////////////////////////
+//fixed point block mixer (CommonSettings.spu_fixedPointMixer)
+//while a channel is being mixed its position is carried as 32.32 fixed point instead of a double.
+//the channel is decoded a block at a time, then volume and pan are applied across the whole block.
+//the output is the same as the per-sample path above to within one LSB, except that cosine interpolation
+//can pick the neighbouring table entry when the two positions straddle one
 
-	s32 samp0[2];
-	
-	//believe it or not, we are going to do this one sample at a time.
-	//like i said, it is slower.
-	for(int samp=0;samp<length;samp++)
-	{
-		SPU->sndbuf[0] = 0;
-		SPU->sndbuf[1] = 0;
-		SPU->buflength = 1;
+#define SPU_MIXBLOCK_SIZE 64
 
-		s32 capmix[2] = {0,0};
-		s32 mix[2] = {0,0};
-		s32 chanout[16];
-		s32 submix[32];
+static FORCEINLINE s64 spu_tofx(double d) { return (s64)floor(d * 4294967296.0 + 0.5); }
+static FORCEINLINE double spu_fromfx(s64 fx) { return (double)fx * (1.0 / 4294967296.0); }
 
-		//generate each channel, and helpfully mix it at the same time
-		for(int i=0;i<16;i++)
-		{
-			channel_struct *chan = &SPU->channels[i];
+//spumuldiv7(val,m) == (val*spugain7(m))>>7, without the branch inside the loops
+static FORCEINLINE s32 spugain7(u8 multiplier) { return (multiplier == 127) ? 128 : multiplier; }
 
-			if (chan->status == CHANSTAT_PLAY)
-			{
-				SPU->bufpos = 0;
+template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE s32 InterpolateFx(s32 a, s32 b, u32 frac)
+{
+	switch (INTERPOLATE_MODE)
+	{
+		case SPUInterpolation_Cosine:
+			return a + (s32)(((s64)(b - a) * cos_lut_fx[frac / (u32)(0x100000000ULL / COSINE_INTERPOLATION_RESOLUTION)]) >> 16);
 
-				bool bypass = false;
-				if(i==1 && SPU->regs.ctl_ch1bypass) bypass=true;
-				if(i==3 && SPU->regs.ctl_ch3bypass) bypass=true;
+		case SPUInterpolation_Linear:
+			return a + (s32)(((s64)(b - a) * (s32)(frac >> 1)) >> 31);
 
+		default:
+			break;
+	}
 
-				//output to mixer unless we are bypassed.
-				//dont output to mixer if the user muted us
-				bool outputToMix = true;
-				if(CommonSettings.spu_muteChannels[i]) outputToMix = false;
-				if(bypass) outputToMix = false;
-				bool outputToCap = outputToMix;
-				if(CommonSettings.spu_captureMuted && !bypass) outputToCap = true;
+	return a;
+}
 
-				//channels 1 and 3 should probably always generate their audio
-				//internally at least, just in case they get used by the spu output
-				bool domix = outputToCap || outputToMix || i==1 || i==3;
+//decodes up to 'count' samples of the channel into 'out', advancing pos the way TestForLoop/TestForLoop2 advance sampcnt.
+//returns how many samples were produced, which is less than count if the channel stopped
+template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE>
+	static FORCEINLINE int SPU_DecodeBlock(SPU_struct* const SPU, channel_struct* const chan, s64 &pos, const s64 inc, s32* const out, const int count)
+{
+	const s64 end = spu_tofx(chan->double_totlength_shifted);
+	const s64 step = end - ((s64)chan->loopstart << (32 + format_shift[FORMAT]));
 
-				//clear the output buffer since this is where _SPU_ChanUpdate wants to accumulate things
-				SPU->sndbuf[0] = SPU->sndbuf[1] = 0;
+	//see TestForLoop2
+	const bool stalled = (FORMAT == 2 && chan->totlength < 4);
 
-				//get channel's next output sample.
-				_SPU_ChanUpdate(domix, SPU, chan);
-				chanout[i] = SPU->lastdata >> volume_shift[chan->volumeDiv];
+	for(int n = 0; n < count; n++)
+	{
+		const u32 loc = (u32)(pos >> 32);
+		const u32 frac = (u32)pos;
+		s32 data;
 
-				//save the panned results
-				submix[i*2] = SPU->sndbuf[0];
-				submix[i*2+1] = SPU->sndbuf[1];
+		switch(FORMAT)
+		{
+			case 0:
+				if(pos < 0) data = 0;
+				else
+				{
+					data = (s32)chan_read_s8(chan, loc) << 8;
+					if(INTERPOLATE_MODE != SPUInterpolation_None && loc < (chan->totlength << 2) - 1)
+						data = InterpolateFx<INTERPOLATE_MODE>(data, (s32)chan_read_s8(chan, loc + 1) << 8, frac);
+				}
+				break;
 
-				//send sample to our capture mix
-				if(outputToCap)
+			case 1:
+				if(pos < 0) data = 0;
+				else
 				{
-					capmix[0] += submix[i*2];
-					capmix[1] += submix[i*2+1];
+					data = (s32)chan_read16(chan, loc*2);
+					if(INTERPOLATE_MODE != SPUInterpolation_None && loc < (chan->totlength << 1) - 1)
+						data = InterpolateFx<INTERPOLATE_MODE>(data, (s32)chan_read16(chan, loc*2 + 2), frac);
 				}
+				break;
 
-				//send sample to our main mixer
-				if(outputToMix)
+			case 2:
+				if(pos < ((s64)8 << 32)) data = 0;
+				else
 				{
-					mix[0] += submix[i*2];
-					mix[1] += submix[i*2+1];
+					if(chan->lastsampcnt != loc)
+						DecodeADPCMTo(chan, loc);
+					if(INTERPOLATE_MODE != SPUInterpolation_None)
+						data = InterpolateFx<INTERPOLATE_MODE>((s32)chan->pcm16b_last, (s32)chan->pcm16b, frac);
+					else
+						data = (s32)chan->pcm16b;
 				}
+				break;
+
+			case 3:
+				if(pos < 0) data = 0;
+				else FetchPSGDataAt(chan, loc, &data);
+				break;
+		}
+
+		out[n] = data;
+
+		if(stalled) continue;
+		pos += inc;
+
+		if(FORMAT != 3 && pos > end)
+		{
+			if (chan->repeat == 1)
+			{
+				while (pos > end) pos -= step;
+				if(FORMAT == 2) RestartADPCMLoop(chan);
 			}
-			else 
+			else
 			{
-				chanout[i] = 0;
-				submix[i*2] = 0;
-				submix[i*2+1] = 0;
+				SPU->KeyOff(chan->num);
+				return n+1;
 			}
-		} //foreach channel
+		}
+	}
+
+	return count;
+}
+
+static FORCEINLINE void SPU_AccumulateBlock(const channel_struct* const chan, const s32* const src, s32* const dst, const int count)
+{
+	const s32 vol = spugain7(chan->vol);
+	const int shift = 7 + volume_shift[chan->volumeDiv];
+
+	if(chan->pan == 0)
+	{
+		for(int i = 0; i < count; i++)
+			dst[i*2] += (src[i] * vol) >> shift;
+	}
+	else if(chan->pan == 127)
+	{
+		for(int i = 0; i < count; i++)
+			dst[i*2+1] += (src[i] * vol) >> shift;
+	}
+	else
+	{
+		const s32 lgain = spugain7(127 - chan->pan);
+		const s32 rgain = spugain7(chan->pan);
+		for(int i = 0; i < count; i++)
+		{
+			const s32 data = (src[i] * vol) >> shift;
+			dst[i*2] += (data * lgain) >> 7;
+			dst[i*2+1] += (data * rgain) >> 7;
+		}
+	}
+}
 
-		s32 mixout[2] = {mix[0],mix[1]};
-		s32 capmixout[2] = {capmix[0],capmix[1]};
-		s32 sndout[2];
-		s32 capout[2];
+//pans a block the way MixL/MixR/MixLR do, into separate left and right buffers
+static FORCEINLINE void SPU_PanBlock(const channel_struct* const chan, const s32* const src, s32* const left, s32* const right, const int count)
+{
+	const s32 vol = spugain7(chan->vol);
+	const int shift = 7 + volume_shift[chan->volumeDiv];
 
-		//create SPU output
-		switch(SPU->regs.ctl_left)
+	if(chan->pan == 0)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			left[i] = (src[i] * vol) >> shift;
+			right[i] = 0;
+		}
+	}
+	else if(chan->pan == 127)
+	{
+		for(int i = 0; i < count; i++)
 		{
-		case SPU_struct::REGS::LOM_LEFT_MIXER: sndout[0] = mixout[0]; break;
-		case SPU_struct::REGS::LOM_CH1: sndout[0] = submix[1*2+0]; break;
-		case SPU_struct::REGS::LOM_CH3: sndout[0] = submix[3*2+0]; break;
-		case SPU_struct::REGS::LOM_CH1_PLUS_CH3: sndout[0] = submix[1*2+0] + submix[3*2+0]; break;
+			left[i] = 0;
+			right[i] = (src[i] * vol) >> shift;
 		}
-		switch(SPU->regs.ctl_right)
+	}
+	else
+	{
+		const s32 lgain = spugain7(127 - chan->pan);
+		const s32 rgain = spugain7(chan->pan);
+		for(int i = 0; i < count; i++)
 		{
-		case SPU_struct::REGS::ROM_RIGHT_MIXER: sndout[1] = mixout[1]; break;
-		case SPU_struct::REGS::ROM_CH1: sndout[1] = submix[1*2+1]; break;
-		case SPU_struct::REGS::ROM_CH3: sndout[1] = submix[3*2+1]; break;
-		case SPU_struct::REGS::ROM_CH1_PLUS_CH3: sndout[1] = submix[1*2+1] + submix[3*2+1]; break;
+			const s32 data = (src[i] * vol) >> shift;
+			left[i] = (data * lgain) >> 7;
+			right[i] = (data * rgain) >> 7;
 		}
+	}
+}
 
+template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE>
+	static int ___SPU_ChanDecode(SPU_struct* const SPU, channel_struct* const chan, s32* const out, const int count)
+{
+	s64 pos = spu_tofx(chan->sampcnt);
+	const int got = SPU_DecodeBlock<FORMAT,INTERPOLATE_MODE>(SPU, chan, pos, spu_tofx(chan->sampinc), out, count);
+	chan->sampcnt = spu_fromfx(pos);
+	return got;
+}
 
-		//generate capture output ("capture bugs" from gbatek are not emulated)
-		if(SPU->regs.cap[0].source==0) 
-			capout[0] = capmixout[0]; //cap0 = L-mix
-		else if(SPU->regs.cap[0].add)
-			capout[0] = chanout[0] + chanout[1]; //cap0 = ch0+ch1
-		else capout[0] = chanout[0]; //cap0 = ch0
+template<SPUInterpolationMode INTERPOLATE_MODE>
+	static int __SPU_ChanDecode(SPU_struct* const SPU, channel_struct* const chan, s32* const out, const int count)
+{
+	switch(chan->format)
+	{
+		case 0: return ___SPU_ChanDecode<0,INTERPOLATE_MODE>(SPU, chan, out, count);
+		case 1: return ___SPU_ChanDecode<1,INTERPOLATE_MODE>(SPU, chan, out, count);
+		case 2: return ___SPU_ChanDecode<2,INTERPOLATE_MODE>(SPU, chan, out, count);
+		case 3: return ___SPU_ChanDecode<3,INTERPOLATE_MODE>(SPU, chan, out, count);
+		default: assert(false);
+	}
+	return 0;
+}
+
+//decodes up to count samples of a playing channel. returns how many there were before it stopped
+static int SPU_ChanDecode(SPU_struct* const SPU, channel_struct* const chan, s32* const out, const int count)
+{
+	switch(CommonSettings.spuInterpolationMode)
+	{
+	case SPUInterpolation_None: return __SPU_ChanDecode<SPUInterpolation_None>(SPU, chan, out, count);
+	case SPUInterpolation_Linear: return __SPU_ChanDecode<SPUInterpolation_Linear>(SPU, chan, out, count);
+	case SPUInterpolation_Cosine: return __SPU_ChanDecode<SPUInterpolation_Cosine>(SPU, chan, out, count);
+	default: assert(false);
+	}
+	return 0;
+}
 
-		if(SPU->regs.cap[1].source==0) 
-			capout[1] = capmixout[1]; //cap1 = R-mix
-		else if(SPU->regs.cap[1].add)
-			capout[1] = chanout[2] + chanout[3]; //cap1 = ch2+ch3
-		else capout[1] = chanout[2]; //cap1 = ch2
+static void SPU_ChanMixBlock(SPU_struct* const SPU, channel_struct* const chan, const int length)
+{
+	s32 block[SPU_MIXBLOCK_SIZE];
 
-		capout[0] = MinMax(capout[0],-0x8000,0x7FFF);
-		capout[1] = MinMax(capout[1],-0x8000,0x7FFF);
+	for(int done = 0; done < length && chan->status == CHANSTAT_PLAY; )
+	{
+		const int todo = std::min(length - done, SPU_MIXBLOCK_SIZE);
+		const int got = SPU_ChanDecode(SPU, chan, block, todo);
+		SPU_AccumulateBlock(chan, block, SPU->sndbuf + done*2, got);
+		SPU->lastdata = block[got-1];
+		done += got;
+	}
+}
 
-		//write the output sample where it is supposed to go
-		if(samp==0)
+//runs capture unit capchan for one output sample, storing as many samples as the timer of its channel says
+static FORCEINLINE void SPU_CaptureStep(SPU_struct* const SPU, const int capchan, const s32 capout)
+{
+	SPU_struct::REGS::CAP& cap = SPU->regs.cap[capchan];
+	u32 last = sputrunc(cap.runtime.sampcnt);
+	cap.runtime.sampcnt += SPU->channels[1+2*capchan].sampinc;
+	u32 curr = sputrunc(cap.runtime.sampcnt);
+	for(u32 j=last;j<curr;j++)
+	{
+		//so, this is a little strange. why go through a fifo?
+		//it seems that some games will set up a reverb effect by capturing
+		//to the nearly same address as playback, but ahead by a couple.
+		//So, playback will always end up being what was captured a couple of samples ago.
+		//This system counts on playback always having read ahead 16 samples.
+		//In that case, playback will end up being what was processed at one entire buffer length ago,
+		//since the 16 samples would have read ahead before they got captured over
+
+		//It's actually the source channels which should have a fifo, but we are
+		//not going to take the hit in speed and complexity. Save it for a future rewrite.
+		//Instead, what we do here is delay the capture by 16 samples to create a similar effect.
+		//Subjectively, it seems to be working.
+
+		//Don't do anything until the fifo is filled, so as to delay it
+		if(cap.runtime.fifo.size<16)
 		{
-			samp0[0] = sndout[0];
-			samp0[1] = sndout[1];
+			cap.runtime.fifo.enqueue(capout);
+			continue;
+		}
+
+		//(actually capture sample from fifo instead of most recently generated)
+		u32 multiplier;
+		s32 sample = cap.runtime.fifo.dequeue();
+		cap.runtime.fifo.enqueue(capout);
+
+		if(cap.bits8)
+		{
+			s8 sample8 = sample>>8;
+			_MMU_write08<1,MMU_AT_DMA>(cap.runtime.curdad,sample8);
+			cap.runtime.curdad++;
+			multiplier = 4;
 		}
 		else
 		{
-			SPU->sndbuf[samp*2+0] = sndout[0];
-			SPU->sndbuf[samp*2+1] = sndout[1];
+			s16 sample16 = sample;
+			_MMU_write16<1,MMU_AT_DMA>(cap.runtime.curdad,sample16);
+			cap.runtime.curdad+=2;
+			multiplier = 2;
+		}
+
+		if(cap.runtime.curdad>=cap.runtime.maxdad) {
+			cap.runtime.curdad = cap.dad;
+			cap.runtime.sampcnt -= cap.len*multiplier;
 		}
+	} //sampinc loop
+}
+
+//ENTERNEW
+static void SPU_MixAudio_Advanced(bool actuallyMix, SPU_struct *SPU, int length)
+{
+	//the advanced spu function correctly handles all sound control mixing options, as well as capture.
+	//each channel is decoded a block at a time into its own buffer, and then routed to the mixers,
+	//the ch1/ch3 outputs and the capture units a sample at a time.
+	//blocks are kept to the length of the capture fifo, so that games which play back what they just
+	//captured (reverb) hear it about as late as they would if we mixed one sample at a time.
+
+	//BIAS gets ignored since our spu is still not bit perfect,
+	//and it doesnt matter for purposes of capture
+
+	enum { BLOCK = 16 };
+	s32 raw[BLOCK];
+	s32 panned[2][BLOCK];
+	s32 mix[2][BLOCK];
+	s32 capmix[2][BLOCK];
+	s32 submix1[2][BLOCK];
+	s32 submix3[2][BLOCK];
+	s32 chanout[4][BLOCK]; //only channels 0-3 can feed a capture unit directly
+
+	for(int done = 0; done < length; done += BLOCK)
+	{
+		const int count = std::min(length - done, (int)BLOCK);
+
+		memset(mix, 0, sizeof(mix));
+		memset(capmix, 0, sizeof(capmix));
+		memset(submix1, 0, sizeof(submix1));
+		memset(submix3, 0, sizeof(submix3));
+		memset(chanout, 0, sizeof(chanout));
+
+		for(int i=0;i<16;i++)
+		{
+			channel_struct *chan = &SPU->channels[i];
+
+			if (chan->status != CHANSTAT_PLAY)
+				continue;
+
+			bool bypass = false;
+			if(i==1 && SPU->regs.ctl_ch1bypass) bypass=true;
+			if(i==3 && SPU->regs.ctl_ch3bypass) bypass=true;
+
+			//output to mixer unless we are bypassed.
+			//dont output to mixer if the user muted us
+			bool outputToMix = true;
+			if(CommonSettings.spu_muteChannels[i]) outputToMix = false;
+			if(bypass) outputToMix = false;
+			bool outputToCap = outputToMix;
+			if(CommonSettings.spu_captureMuted && !bypass) outputToCap = true;
+
+			//channels 1 and 3 should probably always generate their audio
+			//internally at least, just in case they get used by the spu output
+			bool domix = outputToCap || outputToMix || i==1 || i==3;
+
+			if(!domix)
+			{
+				//nobody hears it, so just move it along
+				SPU->bufpos = 0;
+				SPU->buflength = count;
+				_SPU_ChanUpdate(false, SPU, chan);
+				continue;
+			}
+
+			const int got = SPU_ChanDecode(SPU, chan, raw, count);
+			SPU_PanBlock(chan, raw, panned[0], panned[1], got);
+
+			for(int ch=0;ch<2;ch++)
+			{
+				if(outputToMix)
+					for(int k=0;k<got;k++) mix[ch][k] += panned[ch][k];
+				if(outputToCap)
+					for(int k=0;k<got;k++) capmix[ch][k] += panned[ch][k];
+				if(i==1) memcpy(submix1[ch], panned[ch], got*sizeof(s32));
+				if(i==3) memcpy(submix3[ch], panned[ch], got*sizeof(s32));
+			}
 
-		for(int capchan=0;capchan<2;capchan++)
+			if(i<4)
+				for(int k=0;k<got;k++)
+					chanout[i][k] = raw[k] >> volume_shift[chan->volumeDiv];
+		} //foreach channel
+
+		for(int k=0;k<count;k++)
 		{
-			if(SPU->regs.cap[capchan].runtime.running)
+			s32 sndout[2];
+			s32 capout[2];
+
+			//create SPU output
+			switch(SPU->regs.ctl_left)
 			{
-				SPU_struct::REGS::CAP& cap = SPU->regs.cap[capchan];
-				u32 last = sputrunc(cap.runtime.sampcnt);
-				cap.runtime.sampcnt += SPU->channels[1+2*capchan].sampinc;
-				u32 curr = sputrunc(cap.runtime.sampcnt);
-				for(u32 j=last;j<curr;j++)
-				{
-					//so, this is a little strange. why go through a fifo?
-					//it seems that some games will set up a reverb effect by capturing
-					//to the nearly same address as playback, but ahead by a couple.
-					//So, playback will always end up being what was captured a couple of samples ago.
-					//This system counts on playback always having read ahead 16 samples.
-					//In that case, playback will end up being what was processed at one entire buffer length ago,
-					//since the 16 samples would have read ahead before they got captured over
-
-					//It's actually the source channels which should have a fifo, but we are
-					//not going to take the hit in speed and complexity. Save it for a future rewrite.
-					//Instead, what we do here is delay the capture by 16 samples to create a similar effect.
-					//Subjectively, it seems to be working.
-
-					//Don't do anything until the fifo is filled, so as to delay it
-					if(cap.runtime.fifo.size<16)
-					{
-						cap.runtime.fifo.enqueue(capout[capchan]);
-						continue;
-					}
-
-					//(actually capture sample from fifo instead of most recently generated)
-					u32 multiplier;
-					s32 sample = cap.runtime.fifo.dequeue();
-					cap.runtime.fifo.enqueue(capout[capchan]);
-
-					//static FILE* fp = NULL;
-					//if(!fp) fp = fopen("d:\\capout.raw","wb");
-					//fwrite(&sample,2,1,fp);
-					
-					if(cap.bits8)
-					{
-						s8 sample8 = sample>>8;
-						if(skipcap) _MMU_write08<1,MMU_AT_DMA>(cap.runtime.curdad,0);
-						else _MMU_write08<1,MMU_AT_DMA>(cap.runtime.curdad,sample8);
-						cap.runtime.curdad++;
-						multiplier = 4;
-					}
-					else
-					{
-						s16 sample16 = sample;
-						if(skipcap) _MMU_write16<1,MMU_AT_DMA>(cap.runtime.curdad,0);
-						else _MMU_write16<1,MMU_AT_DMA>(cap.runtime.curdad,sample16);
-						cap.runtime.curdad+=2;
-						multiplier = 2;
-					}
-
-					if(cap.runtime.curdad>=cap.runtime.maxdad) {
-						cap.runtime.curdad = cap.dad;
-						cap.runtime.sampcnt -= cap.len*multiplier;
-					}
-				} //sampinc loop
-			} //if capchan running
-		} //capchan loop
-	} //main sample loop
-
-	SPU->sndbuf[0] = samp0[0];
-	SPU->sndbuf[1] = samp0[1];
+			case SPU_struct::REGS::LOM_LEFT_MIXER: sndout[0] = mix[0][k]; break;
+			case SPU_struct::REGS::LOM_CH1: sndout[0] = submix1[0][k]; break;
+			case SPU_struct::REGS::LOM_CH3: sndout[0] = submix3[0][k]; break;
+			case SPU_struct::REGS::LOM_CH1_PLUS_CH3: sndout[0] = submix1[0][k] + submix3[0][k]; break;
+			}
+			switch(SPU->regs.ctl_right)
+			{
+			case SPU_struct::REGS::ROM_RIGHT_MIXER: sndout[1] = mix[1][k]; break;
+			case SPU_struct::REGS::ROM_CH1: sndout[1] = submix1[1][k]; break;
+			case SPU_struct::REGS::ROM_CH3: sndout[1] = submix3[1][k]; break;
+			case SPU_struct::REGS::ROM_CH1_PLUS_CH3: sndout[1] = submix1[1][k] + submix3[1][k]; break;
+			}
+
+			//generate capture output ("capture bugs" from gbatek are not emulated)
+			if(SPU->regs.cap[0].source==0) 
+				capout[0] = capmix[0][k]; //cap0 = L-mix
+			else if(SPU->regs.cap[0].add)
+				capout[0] = chanout[0][k] + chanout[1][k]; //cap0 = ch0+ch1
+			else capout[0] = chanout[0][k]; //cap0 = ch0
+
+			if(SPU->regs.cap[1].source==0) 
+				capout[1] = capmix[1][k]; //cap1 = R-mix
+			else if(SPU->regs.cap[1].add)
+				capout[1] = chanout[2][k] + chanout[3][k]; //cap1 = ch2+ch3
+			else capout[1] = chanout[2][k]; //cap1 = ch2
+
+			capout[0] = MinMax(capout[0],-0x8000,0x7FFF);
+			capout[1] = MinMax(capout[1],-0x8000,0x7FFF);
+
+			SPU->sndbuf[(done+k)*2+0] = sndout[0];
+			SPU->sndbuf[(done+k)*2+1] = sndout[1];
+
+			for(int capchan=0;capchan<2;capchan++)
+				if(SPU->regs.cap[capchan].runtime.running)
+					SPU_CaptureStep(SPU, capchan, capout[capchan]);
+		}
+	} //block loop
 }
 
 //ENTER
@@ -1587,21 +2009,17 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 	//but for a speed optimization we will still do it
 	if(!SPU->regs.masteren) return;
 
-	//bool advanced = CommonSettings.spu_advanced ;
+	bool advanced = CommonSettings.spu_advanced ;
 
 	//branch here so that slow computers don't have to take the advanced (slower) codepath.
-	//it remainds to be seen exactly how much slower it is
-	//if it isnt much slower then we should refactor everything to be simpler, once it is working
-	
-	//HCF Advanced is not used
-	/**
+	//since it mixes in blocks it isnt much slower any more, but it writes capture to memory,
+	//so it is only for the core spu
 	if(advanced && SPU == SPU_core)
 	{
 		SPU_MixAudio_Advanced(actuallyMix, SPU, length);
 	}
 	else
 	{
-	**/
 		//non-advanced mode
 		//for(int i=0;i<16;i++)
 		for(int i=0;i<16/iSoundQuality;i++)
@@ -1615,9 +2033,13 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 			SPU->buflength = length;
 
 			// Mix audio
-			_SPU_ChanUpdate(!CommonSettings.spu_muteChannels[i] && actuallyMix, SPU, chan);
+			const bool domix = !CommonSettings.spu_muteChannels[i] && actuallyMix;
+			if(domix && CommonSettings.spu_fixedPointMixer)
+				SPU_ChanMixBlock(SPU, chan, length);
+			else
+				_SPU_ChanUpdate(domix, SPU, chan);
 		}
-	//}
+	}
 
 	//we used to bail out if speakers were disabled.
 	//this is technically wrong. sound may still be captured, or something.
@@ -1630,13 +2052,21 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 
 	// convert from 32-bit->16-bit
 	if(actuallyMix && speakers)
-		for (int i = 0; i < length*2; i++)
+	{
+		// Apply Master Volume, a stereo pair at a time and without branching on the volume
+		const s32 gain = spugain7(vol);
+		s32 * const sndbuf = SPU->sndbuf;
+		s16 * const outbuf = SPU->outbuf;
+		for (int i = 0; i < length*2; i += 2)
 		{
-			// Apply Master Volume
-			SPU->sndbuf[i] = spumuldiv7(SPU->sndbuf[i], vol);
-			s16 outsample = MinMax(SPU->sndbuf[i],-0x8000,0x7FFF);
-			SPU->outbuf[i] = outsample;
+			const s32 l = (sndbuf[i] * gain) >> 7;
+			const s32 r = (sndbuf[i+1] * gain) >> 7;
+			sndbuf[i] = l;
+			sndbuf[i+1] = r;
+			outbuf[i] = MinMax(l,-0x8000,0x7FFF);
+			outbuf[i+1] = MinMax(r,-0x8000,0x7FFF);
 		}
+	}
 
 
 }
@@ -1644,19 +2074,13 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 //////////////////////////////////////////////////////////////////////////////
 
 
-//emulates one hline of the cpu core.
-//this will produce a variable number of samples, calculated to keep a 44100hz output
-//in sync with the emulator framerate
+//mixes the next spu_core_samples samples of the core and hands them to the sound core
 int spu_core_samples = 0;
-void SPU_Emulate_core()
+static void SPU_Emulate_core_samples()
 {
 	bool needToMix = true;
 	SoundInterface_struct *soundProcessor = SPU_SoundCore();
 	
-	samples += samples_per_hline;
-	spu_core_samples = (int)(samples);
-	samples -= spu_core_samples;
-	
 	// We don't need to mix audio for Dual Synch/Asynch mode since we do this
 	// later in SPU_Emulate_user(). Disable mixing here to speed up processing.
 	// However, recording still needs to mix the audio, so make sure we're also
@@ -1684,6 +2108,51 @@ void SPU_Emulate_core()
 	}
 }
 
+//emulates one hline of the cpu core.
+//this will produce a variable number of samples, calculated to keep a 44100hz output
+//in sync with the emulator framerate
+void SPU_Emulate_core()
+{
+	samples += samples_per_hline;
+	spu_core_samples = (int)(samples);
+	samples -= spu_core_samples;
+
+	//keep the lazy clock current too, in case lazy mixing gets switched on
+	spu_mixedUntil = nds_timer;
+	spu_clockValid = true;
+
+	SPU_Emulate_core_samples();
+}
+
+//brings the core up to nds_timer when lazy mixing is on. does nothing otherwise
+void SPU_CatchUp()
+{
+	if(!CommonSettings.spu_lazyMixing || !SPU_core) return;
+
+	//after a reset or a loadstate nds_timer may have jumped; start counting again from here
+	if(!spu_clockValid || nds_timer < spu_mixedUntil)
+	{
+		spu_mixedUntil = nds_timer;
+		spu_cycleRemainder = 0;
+		spu_clockValid = true;
+		return;
+	}
+	if(nds_timer == spu_mixedUntil) return;
+
+	spu_cycleRemainder += (nds_timer - spu_mixedUntil) * DESMUME_SAMPLE_RATE;
+	spu_mixedUntil = nds_timer;
+
+	u32 todo = (u32)(spu_cycleRemainder / SPU_CYCLE_CLOCK);
+	spu_cycleRemainder -= (u64)todo * SPU_CYCLE_CLOCK;
+
+	while(todo)
+	{
+		spu_core_samples = std::min(todo, SPU_core->bufsize);
+		todo -= spu_core_samples;
+		SPU_Emulate_core_samples();
+	}
+}
+
 void SPU_Emulate_user(bool mix)
 {
 	static s16 *postProcessBuffer = NULL;
@@ -1692,6 +2161,16 @@ void SPU_Emulate_user(bool mix)
 	size_t processedSampleCount = 0;
 	SoundInterface_struct *soundProcessor = SPU_SoundCore();
 	
+	//the frontend wants audio, so whatever the core owes has to be mixed now
+	SPU_CatchUp();
+
+	//and the spu thread can mix up to here as well
+	if(SPU_threadActive)
+	{
+		SPU_LogWrite(0, 0, 0);
+		SPU_WakeThread();
+	}
+
 	if (soundProcessor == NULL)
 	{
 		return;
@@ -1731,6 +2210,7 @@ void SPU_Emulate_user(bool mix)
 	}
 	
 	soundProcessor->UpdateAudio(postProcessBuffer, processedSampleCount);
+	AVDUMP_PushAudio(postProcessBuffer, processedSampleCount);
 	//WAV_WavSoundUpdate(postProcessBuffer, processedSampleCount, WAVMODE_USER);
 }
 
@@ -1749,7 +2229,16 @@ size_t SPU_DefaultPostProcessSamples(s16 *postProcessBuffer, size_t requestedSam
 	switch (synchMode)
 	{
 		case ESynchMode_DualSynchAsynch:
-			if(SPU_user != NULL)
+			if(SPU_threadActive)
+			{
+				//the spu thread has already mixed into the synchronizer.
+				//the ring one can be read while the thread writes to it, the others need the lock
+				const bool lockfree = (synchmethod == ESynchMethod_R);
+				if(!lockfree) SPU_LockUser();
+				processedSampleCount = theSynchronizer->output_samples(postProcessBuffer, requestedSampleCount);
+				if(!lockfree) SPU_UnlockUser();
+			}
+			else if(SPU_user != NULL)
 			{
 				SPU_MixAudio(true, SPU_user, requestedSampleCount);
 				fast_memcpy(postProcessBuffer, SPU_user->outbuf, requestedSampleCount * 2 * sizeof(s16));
@@ -2032,6 +2521,7 @@ bool spu_loadstate(EMUFILE* is, int size)
 		read32le(&chan.length,is);
 		chan.totlength = chan.length + chan.loopstart;
 		chan.double_totlength_shifted = (double)(chan.totlength << format_shift[chan.format]);
+		resolve_channel_source(&chan);
 		//printf("%f\n",chan.double_totlength_shifted);
 		if(version >= 2)
 		{
@@ -2106,5 +2596,8 @@ bool spu_loadstate(EMUFILE* is, int size)
 	//copy the core spu (the more accurate) to the user spu
 	SPU_CloneUser();
 
+	//nds_timer is restored separately, so dont try to mix up to it from our old position
+	spu_clockValid = false;
+
 	return true;
 }
@@ -99,7 +99,8 @@ struct channel_struct
 						index(0),
 						loop_index(0),
 						x(0),
-						psgnoise_last(0)
+						psgnoise_last(0),
+						hostaddr(NULL)
 	{}
 	u32 num;
    u8 vol;
@@ -127,6 +128,9 @@ struct channel_struct
    int loop_index;
    u16 x;
    s16 psgnoise_last;
+   //the sample data (addr, for totlength words) as a host pointer, when it is linear in host memory.
+   //NULL means the samples go through the MMU instead
+   u8 *hostaddr;
 };
 
 class SPUFifo
@@ -206,6 +210,7 @@ public:
    ~SPU_struct();
    void KeyOff(int channel);
    void KeyOn(int channel);
+   void ResolveSources();
    void KeyProbe(int channel);
    void ProbeCapture(int which);
    void WriteByte(u32 addr, u8 val);
@@ -235,33 +240,47 @@ void SPU_ClearOutputBuffer(void);
 void SPU_Reset(void);
 void SPU_DeInit(void);
 void SPU_KeyOn(int channel);
+void SPU_RefreshSourcePointers();
+void SPU_CatchUp();
+extern bool SPU_threadActive;
+void SPU_LogWrite(u32 addr, u32 val, u32 size);
 static FORCEINLINE void SPU_WriteByte(u32 addr, u8 val)
 {
 	addr &= 0xFFF;
 
+	SPU_CatchUp();
 	SPU_core->WriteByte(addr,val);
-	if(SPU_user)
+	if(SPU_threadActive)
+		SPU_LogWrite(addr,val,1);
+	else if(SPU_user)
 		SPU_user->WriteByte(addr,val);
 }
 static FORCEINLINE void SPU_WriteWord(u32 addr, u16 val)
 {
 	addr &= 0xFFF;
 
+	SPU_CatchUp();
 	SPU_core->WriteWord(addr,val);
-	if(SPU_user)
+	if(SPU_threadActive)
+		SPU_LogWrite(addr,val,2);
+	else if(SPU_user)
 		SPU_user->WriteWord(addr,val);
 }
 static FORCEINLINE void SPU_WriteLong(u32 addr, u32 val)
 {
 	addr &= 0xFFF;
 
+	SPU_CatchUp();
 	SPU_core->WriteLong(addr,val);
-	if(SPU_user) 
+	if(SPU_threadActive)
+		SPU_LogWrite(addr,val,4);
+	else if(SPU_user) 
 		SPU_user->WriteLong(addr,val);
 }
-static FORCEINLINE u8 SPU_ReadByte(u32 addr) { return SPU_core->ReadByte(addr & 0x0FFF); }
-static FORCEINLINE u16 SPU_ReadWord(u32 addr) { return SPU_core->ReadWord(addr & 0x0FFF); }
-static FORCEINLINE u32 SPU_ReadLong(u32 addr) { return SPU_core->ReadLong(addr & 0x0FFF); }
+//reads catch up too, since channels stopping during mixing shows in their status bits
+static FORCEINLINE u8 SPU_ReadByte(u32 addr) { SPU_CatchUp(); return SPU_core->ReadByte(addr & 0x0FFF); }
+static FORCEINLINE u16 SPU_ReadWord(u32 addr) { SPU_CatchUp(); return SPU_core->ReadWord(addr & 0x0FFF); }
+static FORCEINLINE u32 SPU_ReadLong(u32 addr) { SPU_CatchUp(); return SPU_core->ReadLong(addr & 0x0FFF); }
 void SPU_Emulate_core(void);
 void SPU_Emulate_user(bool mix = true);
 void SPU_DefaultFetchSamples(s16 *sampleBuffer, size_t sampleCount, ESynchMode synchMode, ISynchronizingAudioBuffer *theSynchronizer);
@@ -72,6 +72,14 @@ public:
 	{
 		return protocol.read_GCDATAIN(PROCNUM);
 	}
+	virtual void read_GCDATAIN_block(u8 PROCNUM, u32 *dst, u32 count)
+	{
+		//rom data goes to the rom component in one piece. the rest of the protocol is a word at a time
+		if(protocol.operation == eSlot1Operation_B7_Read)
+			rom.readBlock(dst, count);
+		else
+			ISlot1Interface::read_GCDATAIN_block(PROCNUM, dst, count);
+	}
 
 	virtual void slot1client_startOperation(eSlot1Operation operation)
 	{
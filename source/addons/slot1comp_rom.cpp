@@ -97,6 +97,40 @@ u32 Slot1Comp_Rom::read()
 	} //switch(operation)
 } //Slot1Comp_Rom::read()
 
+//count words of the operation at once. B7 reads are copied out of the rom a 4K block's run at a time,
+//and come out the same as that many read()s
+void Slot1Comp_Rom::readBlock(u32 *dst, u32 count)
+{
+	//the 4K wrap of an unaligned address splits a word, so those go the slow way
+	if(operation != eSlot1Operation_B7_Read || (address & 3))
+	{
+		for(u32 i=0;i<count;i++)
+			dst[i] = read();
+		return;
+	}
+
+	//see read(). these only change the address for the first word: after that it stays inside its 4K block
+	address &= gameInfo.mask;
+	if(address < 0x8000)
+		address = (0x8000 + (address & 0x1FF));
+
+	u8 *out = (u8*)dst;
+	u32 len = count * 4;
+	while(len)
+	{
+		const u32 run = std::min(len, 0x1000 - (address & 0xFFF));
+		gameInfo.readROMBlock(address, out, run);
+		out += run;
+		len -= run;
+		address = (address&~0xFFF) + ((address+run)&0xFFF);
+	}
+
+#ifndef LOCAL_LE
+	for(u32 i=0;i<count;i++)
+		dst[i] = LE_TO_LOCAL_32(dst[i]);
+#endif
+}
+
 u32 Slot1Comp_Rom::getAddress()
 {
 	return address & gameInfo.mask;
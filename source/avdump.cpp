@@ -0,0 +1,327 @@
+/*
+	Copyright (C) 2009-2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <zlib.h>
+
+#include "avdump.h"
+#include "GPU.h"
+#include "SPU.h"
+#include "PSP/pspvfpu.h"
+#include "utils/ringbuffer.h"
+
+#ifdef PSP
+#include <pspthreadman.h>
+#endif
+
+#define AVDUMP_FRAME_WIDTH 512
+#define AVDUMP_FRAME_HEIGHT 192
+#define AVDUMP_FRAME_BYTES (AVDUMP_FRAME_WIDTH * AVDUMP_FRAME_HEIGHT * 2)
+
+//each slot is a whole GPU_Screen, so there arent many of them
+#ifdef LOWRAM
+#define AVDUMP_FRAME_SLOTS 2
+#else
+#define AVDUMP_FRAME_SLOTS 4
+#endif
+
+//about a third of a second of audio
+#define AVDUMP_AUDIO_RING 16384
+
+//a keyframe this often lets a reader start somewhere other than the beginning
+#define AVDUMP_KEYFRAME_INTERVAL 300
+
+struct AVDumpFrame
+{
+	u32 frame;
+	u32 audioPos;
+	u8 *pixels;
+};
+
+static bool avdump_active = false;
+static AVDumpVideoMode avdump_mode;
+static AVDumpStats avdump_stats;
+static u32 avdump_frameCounter;
+
+//frame slots go round between the two sides: the emulation thread takes a free one, fills it and
+//queues it; the writer thread writes it out and hands it back
+static AVDumpFrame avdump_frames[AVDUMP_FRAME_SLOTS];
+static u8 *avdump_slotMemory = NULL;
+static SPSCRing<u8,8> avdump_freeSlots;
+static SPSCRing<u8,8> avdump_filledSlots;
+
+//stereo s16 pairs
+static SPSCRing<u32,AVDUMP_AUDIO_RING> *avdump_audio = NULL;
+
+//writer thread only
+static FILE *avdump_videofp = NULL;
+static WavWriter avdump_wav;
+static u32 *avdump_prevFrame = NULL;
+static u8 *avdump_compressBuffer = NULL;
+static uLong avdump_compressBufferSize = 0;
+
+static void AVDUMP_WriteFrame(AVDumpFrame &f)
+{
+	AVDumpFrameHeader header;
+	header.frame = f.frame;
+	header.audioPos = f.audioPos;
+	header.flags = 0;
+	header.size = AVDUMP_FRAME_BYTES;
+
+	const u8 *payload = f.pixels;
+
+	if(avdump_mode == AVDUMP_VIDEO_ZLIB)
+	{
+		//xor against the previous frame, so that whatever didnt change turns into runs of zeroes.
+		//a keyframe is the same thing against a blank frame
+		if(avdump_stats.framesWritten % AVDUMP_KEYFRAME_INTERVAL == 0)
+			memset(avdump_prevFrame, 0, AVDUMP_FRAME_BYTES);
+		else
+			header.flags |= AVDUMP_FRAME_DELTA;
+
+		u32 *cur = (u32*)f.pixels;
+		for(u32 i = 0; i < AVDUMP_FRAME_BYTES / 4; i++)
+		{
+			const u32 pixels = cur[i];
+			cur[i] = pixels ^ avdump_prevFrame[i];
+			avdump_prevFrame[i] = pixels;
+		}
+
+		uLongf compressedSize = avdump_compressBufferSize;
+		if(compress2(avdump_compressBuffer, &compressedSize, f.pixels, AVDUMP_FRAME_BYTES, Z_BEST_SPEED) == Z_OK)
+		{
+			header.flags |= AVDUMP_FRAME_ZLIB;
+			header.size = (u32)compressedSize;
+			payload = avdump_compressBuffer;
+		}
+	}
+
+	fwrite(&header, 1, sizeof(header), avdump_videofp);
+	fwrite(payload, 1, header.size, avdump_videofp);
+}
+
+//writes out whatever is queued
+static void AVDUMP_Drain()
+{
+	u32 samples[1024];
+	u32 count;
+	while((count = avdump_audio->pop(samples, 1024)) != 0)
+	{
+		avdump_wav.update(samples, count);
+		avdump_stats.samplesWritten += count;
+	}
+
+	u8 slot;
+	while(avdump_filledSlots.pop(slot))
+	{
+		AVDUMP_WriteFrame(avdump_frames[slot]);
+		avdump_stats.framesWritten++;
+		avdump_freeSlots.push(slot);
+	}
+}
+
+#ifdef PSP
+static SceUID avdump_thread = -1;
+static SceUID avdump_threadWake = -1;
+static volatile bool avdump_threadStop = false;
+
+static int AVDUMP_ThreadMain(SceSize args, void *argp)
+{
+	while(!avdump_threadStop)
+	{
+		sceKernelWaitSema(avdump_threadWake, 1, NULL);
+		AVDUMP_Drain();
+	}
+
+	//whatever was queued before the stop
+	AVDUMP_Drain();
+
+	sceKernelExitThread(0);
+	return 0;
+}
+
+static void AVDUMP_Wake() { sceKernelSignalSema(avdump_threadWake, 1); }
+
+static bool AVDUMP_StartThread()
+{
+	avdump_threadStop = false;
+
+	avdump_threadWake = sceKernelCreateSema("avdump_wake", 0, 0, 1, NULL);
+	//below both the emulation and the spu thread, so it only gets the time they leave over
+	avdump_thread = sceKernelCreateThread("avdump_Thread", AVDUMP_ThreadMain, 0x30, 0x10000, PSP_THREAD_ATTR_USER, NULL);
+
+	if(avdump_threadWake < 0 || avdump_thread < 0 || sceKernelStartThread(avdump_thread, 0, NULL) < 0)
+	{
+		if(avdump_thread >= 0) sceKernelDeleteThread(avdump_thread);
+		if(avdump_threadWake >= 0) sceKernelDeleteSema(avdump_threadWake);
+		avdump_thread = avdump_threadWake = -1;
+		return false;
+	}
+
+	return true;
+}
+
+static void AVDUMP_StopThread()
+{
+	if(avdump_thread < 0) return;
+
+	avdump_threadStop = true;
+	sceKernelSignalSema(avdump_threadWake, 1);
+	sceKernelWaitThreadEnd(avdump_thread, NULL);
+	sceKernelDeleteThread(avdump_thread);
+	sceKernelDeleteSema(avdump_threadWake);
+	avdump_thread = avdump_threadWake = -1;
+}
+#else
+//no writer thread here, so the writing happens right away
+static void AVDUMP_Wake() { AVDUMP_Drain(); }
+static bool AVDUMP_StartThread() { return true; }
+static void AVDUMP_StopThread() { AVDUMP_Drain(); }
+#endif
+
+static void AVDUMP_FreeBuffers()
+{
+	free(avdump_slotMemory); avdump_slotMemory = NULL;
+	free(avdump_prevFrame); avdump_prevFrame = NULL;
+	free(avdump_compressBuffer); avdump_compressBuffer = NULL;
+	delete avdump_audio; avdump_audio = NULL;
+}
+
+static void AVDUMP_CloseFiles()
+{
+	avdump_wav.close();
+	if(avdump_videofp) fclose(avdump_videofp);
+	avdump_videofp = NULL;
+}
+
+bool AVDUMP_Begin(const char *basename, AVDumpVideoMode mode)
+{
+	AVDUMP_End();
+
+	const std::string base = basename;
+	if(!avdump_wav.open(base + ".wav"))
+		return false;
+	if((avdump_videofp = fopen((base + ".frames").c_str(), "wb")) == NULL)
+	{
+		AVDUMP_CloseFiles();
+		return false;
+	}
+
+	avdump_mode = mode;
+	avdump_slotMemory = (u8*)malloc(AVDUMP_FRAME_SLOTS * AVDUMP_FRAME_BYTES);
+	avdump_audio = new SPSCRing<u32,AVDUMP_AUDIO_RING>();
+	if(mode == AVDUMP_VIDEO_ZLIB)
+	{
+		avdump_compressBufferSize = compressBound(AVDUMP_FRAME_BYTES);
+		avdump_prevFrame = (u32*)malloc(AVDUMP_FRAME_BYTES);
+		avdump_compressBuffer = (u8*)malloc(avdump_compressBufferSize);
+	}
+
+	if(!avdump_slotMemory || (mode == AVDUMP_VIDEO_ZLIB && (!avdump_prevFrame || !avdump_compressBuffer)))
+	{
+		AVDUMP_FreeBuffers();
+		AVDUMP_CloseFiles();
+		return false;
+	}
+
+	AVDumpFileHeader header;
+	memcpy(header.magic, "DSAV", 4);
+	header.version = 1;
+	header.width = AVDUMP_FRAME_WIDTH;
+	header.height = AVDUMP_FRAME_HEIGHT;
+	header.bytesPerLine = AVDUMP_FRAME_WIDTH * 2;
+	header.videoMode = mode;
+	header.sampleRate = DESMUME_SAMPLE_RATE;
+	fwrite(&header, 1, sizeof(header), avdump_videofp);
+
+	avdump_freeSlots.clear();
+	avdump_filledSlots.clear();
+	for(u8 i = 0; i < AVDUMP_FRAME_SLOTS; i++)
+	{
+		avdump_frames[i].pixels = avdump_slotMemory + i * AVDUMP_FRAME_BYTES;
+		avdump_freeSlots.push(i);
+	}
+
+	memset(&avdump_stats, 0, sizeof(avdump_stats));
+	avdump_frameCounter = 0;
+
+	if(!AVDUMP_StartThread())
+	{
+		AVDUMP_FreeBuffers();
+		AVDUMP_CloseFiles();
+		return false;
+	}
+
+	avdump_active = true;
+	return true;
+}
+
+void AVDUMP_End()
+{
+	if(!avdump_active) return;
+	avdump_active = false;
+
+	AVDUMP_StopThread();
+	AVDUMP_CloseFiles();
+	AVDUMP_FreeBuffers();
+}
+
+bool AVDUMP_IsRecording()
+{
+	return avdump_active;
+}
+
+void AVDUMP_PushVideo()
+{
+	if(!avdump_active) return;
+
+	const u32 frame = avdump_frameCounter++;
+
+	u8 slot;
+	if(!avdump_freeSlots.pop(slot))
+	{
+		//the writer still has every slot
+		avdump_stats.framesDropped++;
+		return;
+	}
+
+	AVDumpFrame &f = avdump_frames[slot];
+	f.frame = frame;
+	f.audioPos = avdump_stats.samplesQueued;
+	fast_memcpy(f.pixels, (const void*)GPU_Screen, AVDUMP_FRAME_BYTES);
+
+	avdump_filledSlots.push(slot);
+	avdump_stats.framesQueued++;
+	AVDUMP_Wake();
+}
+
+void AVDUMP_PushAudio(const s16 *samples, u32 count)
+{
+	if(!avdump_active || count == 0) return;
+
+	const u32 pushed = avdump_audio->push((const u32*)samples, count);
+	avdump_stats.samplesQueued += pushed;
+	avdump_stats.samplesDropped += count - pushed;
+}
+
+void AVDUMP_GetStats(AVDumpStats &stats)
+{
+	stats = avdump_stats;
+}
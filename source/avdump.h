@@ -0,0 +1,84 @@
+/*
+	Copyright (C) 2009-2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AVDUMP_H_
+#define _AVDUMP_H_
+
+#include "types.h"
+
+//audio/video dumping for archiving gameplay.
+//the emulation thread only copies the frame or the samples into a queue; a writer thread of lower
+//priority drains it to <basename>.wav and <basename>.frames. if the writer falls behind, frames and
+//samples are dropped and counted instead of waiting for it.
+//
+//the .frames file is an AVDumpFileHeader followed by one AVDumpFrameHeader and its payload per frame.
+//frames are GPU_Screen as it is: 192 lines of 512 16bpp pixels (abgr1555) with both screens side by side
+
+enum AVDumpVideoMode
+{
+	AVDUMP_VIDEO_RAW = 0,	//every frame as it is
+	AVDUMP_VIDEO_ZLIB = 1	//every frame xor'ed with the one before it, then deflated
+};
+
+enum AVDumpFrameFlags
+{
+	AVDUMP_FRAME_DELTA = 1,	//pixels are xor'ed with the previous frame in the file. otherwise it is a keyframe
+	AVDUMP_FRAME_ZLIB = 2	//payload is deflated
+};
+
+#include "PACKED.h"
+struct AVDumpFileHeader
+{
+	char magic[4];		//"DSAV"
+	u32 version;
+	u16 width;
+	u16 height;
+	u32 bytesPerLine;
+	u32 videoMode;		//AVDumpVideoMode
+	u32 sampleRate;
+} __PACKED;
+
+struct AVDumpFrameHeader
+{
+	u32 frame;			//counts every frame pushed, so a gap means frames were dropped
+	u32 audioPos;		//stereo samples in the .wav before this frame
+	u32 flags;			//AVDumpFrameFlags
+	u32 size;			//payload bytes following this header
+} __PACKED;
+#include "PACKED_END.h"
+
+struct AVDumpStats
+{
+	u32 framesQueued;
+	u32 framesWritten;
+	u32 framesDropped;
+	u32 samplesQueued;
+	u32 samplesWritten;
+	u32 samplesDropped;
+};
+
+bool AVDUMP_Begin(const char *basename, AVDumpVideoMode mode = AVDUMP_VIDEO_ZLIB);
+void AVDUMP_End();
+bool AVDUMP_IsRecording();
+
+//emulation thread side. both return immediately
+void AVDUMP_PushVideo();
+void AVDUMP_PushAudio(const s16 *samples, u32 count);
+
+void AVDUMP_GetStats(AVDumpStats &stats);
+
+#endif
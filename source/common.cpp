@@ -385,6 +385,49 @@ std::string getDeveloperNameByID(u16 id)
 	return "Unknown";
 }
 
+// ===============================================================================
+// Replacing files
+// ===============================================================================
+static bool fileExists(const std::string &fname)
+{
+	FILE *fp = fopen(fname.c_str(), "rb");
+	if (!fp) return false;
+	fclose(fp);
+	return true;
+}
+
+bool replaceFile(const std::string &tmpName, const std::string &fname)
+{
+	const std::string oldName = fname + ".old";
+
+	//rename wont replace an existing file everywhere, so the old one is moved aside rather than removed
+	remove(oldName.c_str());
+	const bool hadOld = (rename(fname.c_str(), oldName.c_str()) == 0);
+	if (rename(tmpName.c_str(), fname.c_str()) != 0)
+	{
+		if (hadOld) rename(oldName.c_str(), fname.c_str());
+		return false;
+	}
+	if (hadOld) remove(oldName.c_str());
+	return true;
+}
+
+void recoverReplacedFile(const std::string &fname)
+{
+	if (fileExists(fname)) return;
+
+	//the old file is only moved to .old once the .tmp is complete, so with a .old there the .tmp is whole.
+	//without one, a .tmp could be a write cut short and is left alone
+	const std::string tmpName = fname + ".tmp";
+	const std::string oldName = fname + ".old";
+	if (!fileExists(oldName)) return;
+
+	if (rename(tmpName.c_str(), fname.c_str()) == 0)
+		remove(oldName.c_str());
+	else
+		rename(oldName.c_str(), fname.c_str());
+}
+
 
 // ===============================================================================
 // PNG/BMP
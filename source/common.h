@@ -60,6 +60,15 @@ char *intToBin(T val)
 extern char *trim(char *s, int len=-1);
 extern char *removeSpecialChars(char *s);
 
+// ===============================================================================
+// Replacing files
+// ===============================================================================
+//puts the finished tmpName in place of fname. the old file stays around as <fname>.old until the
+//new one has its name, so a crash in between never leaves neither of them
+extern bool replaceFile(const std::string &tmpName, const std::string &fname);
+//if fname is missing because of such a crash, puts <fname>.tmp or <fname>.old back under its name
+extern void recoverReplacedFile(const std::string &fname);
+
 // ===============================================================================
 // Message dialogs
 // ===============================================================================
@@ -31,6 +31,7 @@
 #include <pspkernel.h>
 
 #include "GPU.h"
+#include "avdump.h"
 
 
 /*
@@ -82,6 +83,7 @@ u16 keyboard_cfg[NB_KEYS];
 u16 joypad_cfg[NB_KEYS];
 u16 nbr_joy;
 mouse_status mouse;
+bool rewind_held = false;
 
 /* Keypad key names */
 const char *key_names[NB_KEYS] =
@@ -384,10 +386,25 @@ typedef struct{
 	int var;
 }option;
 
-option Options[] = {{"Resume",-1},{"Change Rom",-1},{"Reset Rom",-1},{"Save State",-1},{"Load State",-1},{"Emu Config",-1},{"Exit",-1}};
+option Options[] = {{"Resume",-1},{"Change Rom",-1},{"Reset Rom",-1},{"Save State",-1},{"Load State",-1},{"Emu Config",-1},{"A/V Dump",0},{"Exit",-1}};
 
 u8 curr_index = 0;
-u8 N_options = 7;
+u8 N_options = 8;
+
+extern char rom_filename[256];
+
+//the dump goes next to the rom, as <rom>.wav and <rom>.frames
+static void ToggleAVDump(){
+	if (AVDUMP_IsRecording())
+		AVDUMP_End();
+	else {
+		char base[256];
+		strcpy(base, rom_filename);
+		if (strlen(base) > 4) base[strlen(base) - 4] = '\0';
+		AVDUMP_Begin(base);
+	}
+	Options[6].var = AVDUMP_IsRecording() ? 1 : 0;
+}
 bool menu_quit = false;
 
 void MenuAction(){
@@ -425,6 +442,11 @@ void MenuAction(){
 		break;
 
 		case 6:
+			menu_quit = true;
+			ToggleAVDump();
+		break;
+
+		case 7:
 			sceKernelExitGame();
 		break;
 	}
@@ -532,6 +554,13 @@ process_ctrls_event(u16 &keypad)
 	  if (pad.Buttons & PSP_CTRL_HOME) {
 		  Menu();
 	  }
+
+	  if (CommonSettings.rewindBufferKB && pad.Buttons & PSP_CTRL_LTRIGGER && pad.Buttons & PSP_CTRL_SELECT) {
+		rewind_held = true;
+		return;
+	  }else{
+		rewind_held = false;
+	  }
 	  
 
 	  for(int i=0;i<12;i++) {
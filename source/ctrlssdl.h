@@ -156,6 +156,9 @@ struct mouse_status
 };
 
 extern mouse_status mouse;
+
+//held while L and select are, when rewinding is on
+extern bool rewind_held;
 #endif // !GTK_UI
 
 struct ctrls_event_config {
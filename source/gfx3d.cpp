@@ -50,6 +50,7 @@
 #include "NDSSystem.h"
 #include "readwrite.h"
 #include "FIFO.h"
+#include "gfx3dtrace.h"
 
 #include <map>
 
@@ -103,6 +104,8 @@ static const u8 gfx3d_commandTypes[] = {
 	/* F0 */ 0xCC,0xCC,0xCC,0xCC,0xCC,0xCC,0xCC,0xCC, 0xCC,0xCC,0xCC,0xCC,0xCC,0xCC,0xCC,0xCC
 };
 
+static void gfx3d_execute(u8 cmd, u32 param);
+
 class GXF_Hardware
 {
 public:
@@ -116,8 +119,51 @@ public:
 	{
 		shiftCommand = 0;
 		paramCounter = 0;
+		blockDirect = false;
+		blockQueued = 0;
+	}
+
+	void receive(u32 val)
+	{
+		receive<false>(val);
 	}
 
+	//unpacks a whole run of words, as a gxfifo dma delivers them.
+	//while the fifo is empty and nothing is watching it (no gxfifo irq, no swap pending), the unpacked commands
+	//are run right away instead of going through the fifo: that is all the fifo would do with them anyway, 
+	//before the cpu gets to look at gxstat again. once a command does land in the fifo, the rest follow it in order.
+	void receiveBlock(const u32 *vals, u32 count)
+	{
+		blockDirect = CommonSettings.GFX3D_DirectGXFifo && gxFIFO.size == 0 && !isSwapBuffers && MMU_new.gxstat.gxfifo_irq == 0;
+		blockQueued = 0;
+
+		for(u32 i=0;i<count;i++)
+			receive<true>(vals[i]);
+
+		GFX_FIFOsendDone(blockQueued);
+	}
+
+private:
+
+	template<bool BLOCK>
+	FORCEINLINE void send(u8 cmd, u32 param)
+	{
+		if(!BLOCK)
+			GFX_FIFOsend(cmd, param);
+		else if(blockDirect)
+		{
+			gfx3d_execute(cmd, param);
+			//everything after a swap has to wait in the fifo for the flush
+			if(isSwapBuffers) blockDirect = false;
+		}
+		else
+		{
+			GFX_FIFOsendQueued(cmd, param);
+			blockQueued++;
+		}
+	}
+
+	template<bool BLOCK>
 	void receive(u32 val) 
 	{
 		//so, it seems as if the dummy values and restrictions on the highest-order command in the packed command set 
@@ -159,7 +205,7 @@ public:
 		//finish receiving args
 		if(paramCounter>0)
 		{
-			GFX_FIFOsend(currCommand, val);
+			send<BLOCK>(currCommand, val);
 			paramCounter--;
 			if(paramCounter <= 0)
 				shiftCommand >>= 8;
@@ -176,7 +222,7 @@ public:
 				shiftCommand >>= 8;
 			else if(currCommandType == GFX_NOARG_COMMAND)
 			{
-				GFX_FIFOsend(currCommand, 0);
+				send<BLOCK>(currCommand, 0);
 				shiftCommand >>= 8;
 			}
 			else if(currCommandType == GFX_INVALID_COMMAND)
@@ -189,11 +235,12 @@ public:
 		}
 	}
 
-private:
-
 	u32 shiftCommand;
 	u32 paramCounter;
 
+	bool blockDirect;
+	u32 blockQueued;
+
 public:
 
 	void savestate(EMUFILE *f)
@@ -337,6 +384,25 @@ CACHE_ALIGN float		mtxCurrent[4][16];
 static CACHE_ALIGN float		mtxTemporal[16];
 static u32 mode = 0;
 
+//fixed point geometry pipeline (CommonSettings.GFX3D_FixedPointGeometry, latched on reset).
+//when it is on, these 20.12 matrices are the real geometry engine state and mtxCurrent
+//only mirrors them for the float consumers (lighting, boxtest, the GU renderer).
+static bool fixedPointGeometry = false;
+static CACHE_ALIGN s32		mtxCurrentFx[4][16];
+static CACHE_ALIGN s32		mtxTemporalFx[16];
+static CACHE_ALIGN s32		mtxStackFx[4][32][16];
+static CACHE_ALIGN s32		transFx[4] = {0, 0, 0, 0};
+static CACHE_ALIGN s32		scaleFx[4] = {0, 0, 0, 0};
+static CACHE_ALIGN s32		PTcoordsFx[4] = {0, 0, 0, 1<<12};
+
+//#define _GFX3D_BENCH_GEOMETRY	// print geometry engine time per vertex, to compare the float and fixed point pipelines
+#ifdef _GFX3D_BENCH_GEOMETRY
+#include <psprtc.h>
+static u64 benchGeometryTicks = 0;
+static u32 benchGeometryVerts = 0;
+static u32 benchGeometryFrames = 0;
+#endif
+
 // Indexes for matrix loading/multiplication
 static u8 ML4x4ind = 0;
 static u8 ML4x3ind = 0;
@@ -440,6 +506,12 @@ struct tmpVertInfo {
 } tempVertInfo;
 
 
+//the flush wants the polys split into opaque and translucent, with the opaque ones sorted by depth.
+//that gets worked out as each poly is completed (see gfx3d_classifyPoly), so the flush only has to radix sort the keys
+static int polyOpaqueList[POLYLIST_SIZE], polyTranslucentList[POLYLIST_SIZE];
+static u32 polyOpaqueKeys[POLYLIST_SIZE];
+static int polyOpaqueCount = 0, polyTranslucentCount = 0;
+
 static void twiddleLists() {
 	listTwiddle++;
 	listTwiddle &= 1;
@@ -447,6 +519,7 @@ static void twiddleLists() {
 	vertlist = &vertlists[listTwiddle];
 	polylist->count = 0;
 	vertlist->count = 0;
+	polyOpaqueCount = polyTranslucentCount = 0;
 }
 
 static BOOL flushPending = FALSE;
@@ -513,6 +586,58 @@ FORCEINLINE void vector_fix2float(float* matrix, const float divisor)
 	}
 }
 
+//mirror the fixed point matrix of a matrix mode out to the float matrices.
+//the position-vector mode also changes the position matrix.
+static FORCEINLINE void gfx3d_syncFloatMatrix(u32 which)
+{
+	MatrixFix2Float(mtxCurrent[which], mtxCurrentFx[which]);
+	if (which == 2)
+		MatrixFix2Float(mtxCurrent[1], mtxCurrentFx[1]);
+}
+
+static FORCEINLINE s32* gfx3d_matrixStackFx(int which, int pos)
+{
+	//the projection and texture stacks only have the one slot
+	if ((mtxStack[which].type == 0) || (mtxStack[which].type == 3))
+		pos = 0;
+	return mtxStackFx[which][pos & 31];
+}
+
+//rebuild the fixed point state from the float state (after a savestate load, which only carries the floats)
+static void gfx3d_syncFixedMatrices()
+{
+	for (int i = 0; i < 4; i++)
+	{
+		MatrixFloat2Fix(mtxCurrentFx[i], mtxCurrent[i]);
+		//size is the last slot (MatrixStackSetMaxSize), so this covers all 32 of mtxStackFx
+		for (int j = 0; j <= mtxStack[i].size; j++)
+			MatrixFloat2Fix(mtxStackFx[i][j], MatrixStackGetPos(&mtxStack[i], j));
+	}
+	MatrixFloat2Fix(mtxTemporalFx, mtxTemporal);
+}
+
+//quantizes a poly depth (0..1 for anything which isnt clipped) to 16bits for the sort keys
+static FORCEINLINE u32 gfx3d_depthSortKey(float z)
+{
+	s32 q = (s32)((z + 0.5f) * 16384.0f);
+	return (u32)std::min(std::max(q,0),0xFFFF);
+}
+
+//z/w as 1.14 fixed point, which is what the hardware derives its z-buffer value from: ((z/w)*0x4000+0x3FFF)*0x200.
+//w can only be zero for a vertex sitting right on the eye, so saturate by the sign of z instead of dividing.
+static FORCEINLINE s32 gfx3d_fixedDepth(s32 z, s32 w)
+{
+	static const s32 limit = (1<<24);
+
+	if (w == 0)
+		return (z < 0) ? -limit : limit;
+
+	s64 depth = (((s64)z) << 14) / w;
+	if (depth > limit) return limit;
+	if (depth < -limit) return -limit;
+	return (s32)depth;
+}
+
 #define OSWRITE(x) os->fwrite((char*)&(x),sizeof((x)));
 #define OSREAD(x) is->fread((char*)&(x),sizeof((x)));
 
@@ -551,6 +676,48 @@ void VERT::load(EMUFILE* is)
 	OSREAD(fcolor[0]); OSREAD(fcolor[1]); OSREAD(fcolor[2]);
 }
 
+//the records as save() writes them, field after field
+#define POLY_SAVESIZE (4 + 4*2 + 3*4 + 4 + 2*4)
+#define VERT_SAVESIZE (4*4 + 2*4 + 3 + 3*4)
+#define PREAD(x) { memcpy(&(x),p,sizeof((x))); p += sizeof((x)); }
+
+const u8* POLY::load(const u8 *p)
+{
+	PREAD(type);
+	PREAD(vertIndexes[0]); PREAD(vertIndexes[1]); PREAD(vertIndexes[2]); PREAD(vertIndexes[3]);
+	PREAD(polyAttr); PREAD(texParam); PREAD(texPalette);
+	PREAD(viewport);
+	PREAD(miny);
+	PREAD(maxy);
+	return p;
+}
+
+const u8* VERT::load(const u8 *p)
+{
+	PREAD(x); PREAD(y); PREAD(z); PREAD(w);
+	PREAD(u); PREAD(v);
+	PREAD(color[0]); PREAD(color[1]); PREAD(color[2]);
+	PREAD(fcolor[0]); PREAD(fcolor[1]); PREAD(fcolor[2]);
+	return p;
+}
+
+//reads a list some records at a time, rather than with a read per field
+template<typename T, int RECSIZE>
+static bool gfx3d_loadList(EMUFILE* is, T *list, int count)
+{
+	const int BLOCK = 32;
+	u8 block[RECSIZE*BLOCK];
+	for(int i=0;i<count;)
+	{
+		const int todo = std::min(count-i,BLOCK);
+		if(is->fread(block,RECSIZE*todo) != (size_t)(RECSIZE*todo)) return false;
+		const u8 *p = block;
+		for(const int end=i+todo;i<end;i++)
+			p = list[i].load(p);
+	}
+	return true;
+}
+
 void gfx3d_init()
 {
 	gxf_hardware.reset();
@@ -645,6 +812,17 @@ void gfx3d_reset()
 	MatrixStackInit(&mtxStack[2]);
 	MatrixStackInit(&mtxStack[3]);
 
+	fixedPointGeometry = CommonSettings.GFX3D_FixedPointGeometry;
+	for (int i = 0; i < 4; i++)
+	{
+		MatrixInit(mtxCurrentFx[i]);
+		for (int j = 0; j < 32; j++)
+			MatrixInit(mtxStackFx[i][j]);
+	}
+	MatrixInit(mtxTemporalFx);
+	memset(transFx, 0, sizeof(transFx));
+	memset(scaleFx, 0, sizeof(scaleFx));
+
 	clCmd = 0;
 	clInd = 0;
 
@@ -686,6 +864,135 @@ inline float vec3dot(float* a, float* b) {
 
 #define SUBMITVERTEX(ii, nn) polylist->list[polylist->count].vertIndexes[ii] = tempVertInfo.map[nn];
 
+//find the y and depth range of a newly completed poly, and file it with the opaque or the translucent polys.
+//TODO - this _MUST_ be moved later in the pipeline, after clipping.
+//the w-division here is just an approximation to fix the shop in harvest moon island of happiness
+//also the buttons in the knights in the nightmare frontend depend on this
+static void gfx3d_classifyPoly(int index)
+{
+	POLY& poly = polylist->list[index];
+	const VERT& vert0 = vertlist->list[poly.vertIndexes[0]];
+
+	poly.miny = poly.maxy = vert0.y;
+
+	if (fixedPointGeometry)
+	{
+		//the fixed point pipeline already worked out z/w per vertex in SetVertex,
+		//so this is just a min/max over integers and no w==0 hack is needed
+		s32 depthMin = vert0.fixedDepth, depthMax = vert0.fixedDepth;
+		for (int j = 1; j < poly.type; j++)
+		{
+			s32 depth = vertlist->list[poly.vertIndexes[j]].fixedDepth;
+			depthMin = min(depthMin, depth);
+			depthMax = max(depthMax, depth);
+		}
+		poly.minz = (0x4000 - depthMax) / 32768.0f;
+		poly.maxz = (0x4000 - depthMin) / 32768.0f;
+	}
+	else
+	{
+		// TODO: Possible divide by zero with the w-coordinate.
+		// Is the vertex being read correctly? Is 0 a valid value for w?
+		// If both of these questions answer to yes, then how does the NDS handle a NaN?
+		// For now, simply prevent w from being zero.
+		for (int j = 0; j < poly.type; j++)
+		{
+			const VERT& vert = vertlist->list[poly.vertIndexes[j]];
+			float vertw = (vert.w != 0.0f) ? vert.w : 0.00000001f;
+			float vertz = 1.0f - (vert.z + vertw) / (2 * vertw);
+
+			if (j == 0) poly.minz = poly.maxz = vertz;
+			else
+			{
+				poly.minz = min(poly.minz, vertz);
+				poly.maxz = max(poly.maxz, vertz);
+			}
+		}
+	}
+
+	//we need to sort the poly list with alpha polys last, and the opaque ones by maxz then minz.
+	//ties keep the order the game sent them in, since the radix sort is stable
+	if (poly.isTranslucent())
+		polyTranslucentList[polyTranslucentCount++] = index;
+	else
+	{
+		polyOpaqueKeys[polyOpaqueCount] = (gfx3d_depthSortKey(poly.maxz)<<16) | gfx3d_depthSortKey(poly.minz);
+		polyOpaqueList[polyOpaqueCount++] = index;
+	}
+}
+
+//savestates, and switching the math over, only leave the float matrices and vertices current.
+//this rebuilds the fixed point side from them, and the sort keys of the polys in the list being built
+static void gfx3d_rebuildGeometryState()
+{
+	if (fixedPointGeometry)
+	{
+		gfx3d_syncFixedMatrices();
+		for(int i=0;i<vertlist->count;i++)
+		{
+			VERT& vert = vertlist->list[i];
+			vert.fixedDepth = gfx3d_fixedDepth((s32)(vert.z * 4096.0f), (s32)(vert.w * 4096.0f));
+		}
+	}
+
+	polyOpaqueCount = polyTranslucentCount = 0;
+	for(int i=0;i<polylist->count;i++)
+		gfx3d_classifyPoly(i);
+}
+
+void gfx3d_setFixedPointGeometry(bool enable)
+{
+	CommonSettings.GFX3D_FixedPointGeometry = enable;
+	if (enable == fixedPointGeometry) return;
+
+	fixedPointGeometry = enable;
+	gfx3d_rebuildGeometryState();
+}
+
+//stable LSD radix sort of the opaque polys on their keys, one byte per pass
+static void gfx3d_sortOpaquePolys(int* out)
+{
+	static u32 keysTemp[POLYLIST_SIZE];
+	static int listTemp[POLYLIST_SIZE];
+
+	const int count = polyOpaqueCount;
+	u32* keys = polyOpaqueKeys;
+	int* list = polyOpaqueList;
+	u32* keysDst = keysTemp;
+	int* listDst = listTemp;
+
+	for (int shift = 0; shift < 32 && count > 1; shift += 8)
+	{
+		int histogram[256];
+		memset(histogram, 0, sizeof(histogram));
+		for (int i = 0; i < count; i++)
+			histogram[(keys[i]>>shift)&0xFF]++;
+
+		//skip the pass when every key has the same byte here, which is common for the high byte of maxz
+		if (histogram[(keys[0]>>shift)&0xFF] == count)
+			continue;
+
+		for (int i = 0, pos = 0; i < 256; i++)
+		{
+			int n = histogram[i];
+			histogram[i] = pos;
+			pos += n;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			int dst = histogram[(keys[i]>>shift)&0xFF]++;
+			keysDst[dst] = keys[i];
+			listDst[dst] = list[i];
+		}
+
+		std::swap(keys, keysDst);
+		std::swap(list, listDst);
+	}
+
+	memcpy(out, list, count*sizeof(int));
+}
+
 //Submit a vertex to the GE
 static void SetVertex()
 {
@@ -717,11 +1024,37 @@ static void SetVertex()
 	
 	//printf("%f\n", mtxCurrent[3][0]);
 
+#ifdef _GFX3D_BENCH_GEOMETRY
+	u64 benchStart;
+	sceRtcGetCurrentTick(&benchStart);
+#endif
+
 	//TODO - think about keeping the clip matrix concatenated,
 	//so that we only have to multiply one matrix here
 	//(we could lazy cache the concatenated clip matrix and only generate it
 	//when we need to)
-	MatrixMultVec4x4_M2(mtxCurrent[0], coordTransformed);
+	s32 fixedDepth = 0;
+	if (fixedPointGeometry)
+	{
+		s32 coordFx[4] = { (s16)u16coord[0], (s16)u16coord[1], (s16)u16coord[2], (1<<12) };
+		MatrixMultVec4x4_M2(mtxCurrentFx[0], coordFx);
+
+		static const float _div = (1.f / 4096.f);
+		coordTransformed[0] = (float)coordFx[0] * _div;
+		coordTransformed[1] = (float)coordFx[1] * _div;
+		coordTransformed[2] = (float)coordFx[2] * _div;
+		coordTransformed[3] = (float)coordFx[3] * _div;
+		fixedDepth = gfx3d_fixedDepth(coordFx[2], coordFx[3]);
+	}
+	else
+		MatrixMultVec4x4_M2(mtxCurrent[0], coordTransformed);
+
+#ifdef _GFX3D_BENCH_GEOMETRY
+	u64 benchEnd;
+	sceRtcGetCurrentTick(&benchEnd);
+	benchGeometryTicks += benchEnd - benchStart;
+	benchGeometryVerts++;
+#endif
 
 	//TODO - culling should be done here.
 	//TODO - viewport transform?
@@ -743,7 +1076,8 @@ static void SetVertex()
 	vert.coord[1] = coordTransformed[1];
 	vert.coord[2] = coordTransformed[2];
 	vert.coord[3] = coordTransformed[3];
-	
+	vert.fixedDepth = fixedDepth;
+
 	vert.color[0] = GFX3D_5TO6(colorRGB[0]);
 	vert.color[1] = GFX3D_5TO6(colorRGB[1]);
 	vert.color[2] = GFX3D_5TO6(colorRGB[2]);
@@ -858,6 +1192,7 @@ static void SetVertex()
 			poly.texParam = textureFormat;
 			poly.texPalette = texturePalette;
 			poly.viewport = viewport;
+			gfx3d_classifyPoly(polylist->count);
 			polylist->count++;
 		}
 	}
@@ -916,6 +1251,13 @@ static void gfx3d_glPushMatrix()
 	//this command always works on both pos and vector when either pos or pos-vector are the current mtx mode
 	short mymode = (mode==1?2:mode);
 
+	if (fixedPointGeometry)
+	{
+		MatrixCopy(gfx3d_matrixStackFx(mymode, mtxStack[mymode].position), mtxCurrentFx[mymode]);
+		if(mymode==2)
+			MatrixCopy(gfx3d_matrixStackFx(1, mtxStack[1].position), mtxCurrentFx[1]);
+	}
+
 	MatrixStackPushMatrix(&mtxStack[mymode], mtxCurrent[mymode]);
 
 	GFX_DELAY(17);
@@ -947,6 +1289,13 @@ static void gfx3d_glPopMatrix(s32 i)
 
 	if (mymode == 2)
 		MatrixStackPopMatrix(mtxCurrent[1], &mtxStack[1], i);
+
+	if (fixedPointGeometry)
+	{
+		MatrixCopy(mtxCurrentFx[mymode], gfx3d_matrixStackFx(mymode, mtxStack[mymode].position));
+		if (mymode == 2)
+			MatrixCopy(mtxCurrentFx[1], gfx3d_matrixStackFx(1, mtxStack[1].position));
+	}
 }
 
 static void gfx3d_glStoreMatrix(u32 v)
@@ -974,6 +1323,13 @@ static void gfx3d_glStoreMatrix(u32 v)
 
 	if(mymode==2)
 		MatrixStackLoadMatrix (&mtxStack[1], v, mtxCurrent[1]);
+
+	if (fixedPointGeometry)
+	{
+		MatrixCopy(gfx3d_matrixStackFx(mymode, v), mtxCurrentFx[mymode]);
+		if(mymode==2)
+			MatrixCopy(gfx3d_matrixStackFx(1, v), mtxCurrentFx[1]);
+	}
 }
 
 static void gfx3d_glRestoreMatrix(u32 v)
@@ -1002,6 +1358,13 @@ static void gfx3d_glRestoreMatrix(u32 v)
 
 	if (mymode == 2)
 		MatrixCopy (mtxCurrent[1], MatrixStackGetPos(&mtxStack[1], v));
+
+	if (fixedPointGeometry)
+	{
+		MatrixCopy(mtxCurrentFx[mymode], gfx3d_matrixStackFx(mymode, v));
+		if (mymode == 2)
+			MatrixCopy(mtxCurrentFx[1], gfx3d_matrixStackFx(1, v));
+	}
 }
 
 static void gfx3d_glLoadIdentity()
@@ -1013,12 +1376,22 @@ static void gfx3d_glLoadIdentity()
 	if (mode == 2)
 		MatrixIdentity (mtxCurrent[1]);
 
+	if (fixedPointGeometry)
+	{
+		MatrixIdentity(mtxCurrentFx[mode]);
+		if (mode == 2)
+			MatrixIdentity(mtxCurrentFx[1]);
+	}
+
 	//printf("identity: %d to: \n",mode); MatrixPrint(mtxCurrent[1]);
 }
 
 static BOOL gfx3d_glLoadMatrix4x4(s32 v)
 {
-	mtxCurrent[mode][ML4x4ind] = (float)((v << 4) >> 4);
+	if (fixedPointGeometry)
+		mtxCurrentFx[mode][ML4x4ind] = v;
+	else
+		mtxCurrent[mode][ML4x4ind] = (float)((v << 4) >> 4);
 
 	++ML4x4ind;
 	if(ML4x4ind<16) return FALSE;
@@ -1026,6 +1399,14 @@ static BOOL gfx3d_glLoadMatrix4x4(s32 v)
 
 	GFX_DELAY(19);
 
+	if (fixedPointGeometry)
+	{
+		if (mode == 2)
+			MatrixCopy(mtxCurrentFx[1], mtxCurrentFx[2]);
+		gfx3d_syncFloatMatrix(mode);
+		return TRUE;
+	}
+
 	vector_fix2float<4>(mtxCurrent[mode], 4096.f);
 
 	if (mode == 2)
@@ -1037,13 +1418,29 @@ static BOOL gfx3d_glLoadMatrix4x4(s32 v)
 
 static BOOL gfx3d_glLoadMatrix4x3(s32 v)
 {
-	mtxCurrent[mode][ML4x3ind] = (float)((v << 4) >> 4);
+	if (fixedPointGeometry)
+		mtxCurrentFx[mode][ML4x3ind] = v;
+	else
+		mtxCurrent[mode][ML4x3ind] = (float)((v << 4) >> 4);
 
 	ML4x3ind++;
 	if((ML4x3ind & 0x03) == 3) ML4x3ind++;
 	if(ML4x3ind<16) return FALSE;
 	ML4x3ind = 0;
 
+	if (fixedPointGeometry)
+	{
+		mtxCurrentFx[mode][3] = mtxCurrentFx[mode][7] = mtxCurrentFx[mode][11] = 0;
+		mtxCurrentFx[mode][15] = (1<<12);
+
+		GFX_DELAY(30);
+
+		if (mode == 2)
+			MatrixCopy(mtxCurrentFx[1], mtxCurrentFx[2]);
+		gfx3d_syncFloatMatrix(mode);
+		return TRUE;
+	}
+
 	vector_fix2float<4>(mtxCurrent[mode], 4096.f);
 
 	//fill in the unusued matrix values
@@ -1060,7 +1457,10 @@ static BOOL gfx3d_glLoadMatrix4x3(s32 v)
 
 static BOOL gfx3d_glMultMatrix4x4(s32 v)
 {
-	mtxTemporal[MM4x4ind] = (float)((v << 4) >> 4);
+	if (fixedPointGeometry)
+		mtxTemporalFx[MM4x4ind] = v;
+	else
+		mtxTemporal[MM4x4ind] = (float)((v << 4) >> 4);
 
 	MM4x4ind++;
 	if(MM4x4ind<16) return FALSE;
@@ -1068,6 +1468,18 @@ static BOOL gfx3d_glMultMatrix4x4(s32 v)
 
 	GFX_DELAY(35);
 
+	if (fixedPointGeometry)
+	{
+		MatrixMultiply(mtxCurrentFx[mode], mtxTemporalFx);
+		if (mode == 2)
+		{
+			MatrixMultiply(mtxCurrentFx[1], mtxTemporalFx);
+			GFX_DELAY_M2(30);
+		}
+		gfx3d_syncFloatMatrix(mode);
+		return TRUE;
+	}
+
 	vector_fix2float<4>(mtxTemporal, 4096.f);
 
 	MatrixMultiply (mtxCurrent[mode], mtxTemporal);
@@ -1086,7 +1498,10 @@ static BOOL gfx3d_glMultMatrix4x4(s32 v)
 
 static BOOL gfx3d_glMultMatrix4x3(s32 v)
 {
-	mtxTemporal[MM4x3ind] = (float)((v << 4) >> 4);
+	if (fixedPointGeometry)
+		mtxTemporalFx[MM4x3ind] = v;
+	else
+		mtxTemporal[MM4x3ind] = (float)((v << 4) >> 4);
 
 	MM4x3ind++;
 	if((MM4x3ind & 0x03) == 3) MM4x3ind++;
@@ -1095,6 +1510,22 @@ static BOOL gfx3d_glMultMatrix4x3(s32 v)
 
 	GFX_DELAY(31);
 
+	if (fixedPointGeometry)
+	{
+		mtxTemporalFx[3] = mtxTemporalFx[7] = mtxTemporalFx[11] = 0;
+		mtxTemporalFx[15] = (1<<12);
+
+		MatrixMultiply(mtxCurrentFx[mode], mtxTemporalFx);
+		if (mode == 2)
+		{
+			MatrixMultiply(mtxCurrentFx[1], mtxTemporalFx);
+			GFX_DELAY_M2(30);
+		}
+		gfx3d_syncFloatMatrix(mode);
+		MatrixIdentity(mtxTemporalFx);
+		return TRUE;
+	}
+
 	vector_fix2float<4>(mtxTemporal, 4096.f);
 
 	//fill in the unusued matrix values
@@ -1118,7 +1549,10 @@ static BOOL gfx3d_glMultMatrix4x3(s32 v)
 
 static BOOL gfx3d_glMultMatrix3x3(s32 v)
 {
-	mtxTemporal[MM3x3ind] = (float)((v << 4) >> 4);
+	if (fixedPointGeometry)
+		mtxTemporalFx[MM3x3ind] = v;
+	else
+		mtxTemporal[MM3x3ind] = (float)((v << 4) >> 4);
 
 	MM3x3ind++;
 	if((MM3x3ind & 0x03) == 3) MM3x3ind++;
@@ -1127,6 +1561,23 @@ static BOOL gfx3d_glMultMatrix3x3(s32 v)
 
 	GFX_DELAY(28);
 
+	if (fixedPointGeometry)
+	{
+		mtxTemporalFx[3] = mtxTemporalFx[7] = mtxTemporalFx[11] = 0;
+		mtxTemporalFx[15] = (1<<12);
+		mtxTemporalFx[12] = mtxTemporalFx[13] = mtxTemporalFx[14] = 0;
+
+		MatrixMultiply(mtxCurrentFx[mode], mtxTemporalFx);
+		if (mode == 2)
+		{
+			MatrixMultiply(mtxCurrentFx[1], mtxTemporalFx);
+			GFX_DELAY_M2(30);
+		}
+		gfx3d_syncFloatMatrix(mode);
+		MatrixIdentity(mtxTemporalFx);
+		return TRUE;
+	}
+
 	vector_fix2float<3>(mtxTemporal, 4096.f);
 
 	//fill in the unusued matrix values
@@ -1153,13 +1604,20 @@ static BOOL gfx3d_glMultMatrix3x3(s32 v)
 static BOOL gfx3d_glScale(s32 v)
 {
 	scale[scaleind] = fix2float(v);
+	scaleFx[scaleind] = v;
 
 	++scaleind;
 
 	if(scaleind<3) return FALSE;
 	scaleind = 0;
 
-	MatrixScale (mtxCurrent[(mode==2?1:mode)], scale);
+	if (fixedPointGeometry)
+	{
+		MatrixScale(mtxCurrentFx[(mode==2?1:mode)], scaleFx);
+		MatrixFix2Float(mtxCurrent[(mode==2?1:mode)], mtxCurrentFx[(mode==2?1:mode)]);
+	}
+	else
+		MatrixScale (mtxCurrent[(mode==2?1:mode)], scale);
 	//printf("scale: matrix %d to: \n",mode); MatrixPrint(mtxCurrent[1]);
 
 	GFX_DELAY(22);
@@ -1175,12 +1633,26 @@ static BOOL gfx3d_glScale(s32 v)
 static BOOL gfx3d_glTranslate(s32 v)
 {
 	trans[transind] = fix2float(v);
+	transFx[transind] = v;
 
 	++transind;
 
 	if(transind<3) return FALSE;
 	transind = 0;
 
+	if (fixedPointGeometry)
+	{
+		MatrixTranslate(mtxCurrentFx[mode], transFx);
+		GFX_DELAY(22);
+		if (mode == 2)
+		{
+			MatrixTranslate(mtxCurrentFx[1], transFx);
+			GFX_DELAY_M2(30);
+		}
+		gfx3d_syncFloatMatrix(mode);
+		return TRUE;
+	}
+
 	MatrixTranslate (mtxCurrent[mode], trans);
 
 	GFX_DELAY(22);
@@ -1671,7 +2143,9 @@ static BOOL gfx3d_glPosTest(u32 v)
 	//printf("POSTEST\n");
 	MMU_new.gxstat.tb = 1;
 
+	PTcoordsFx[PTind] = (s16)(v & 0xFFFF);
 	PTcoords[PTind++] = float16table[v & 0xFFFF];
+	PTcoordsFx[PTind] = (s16)(v >> 16);
 	PTcoords[PTind++] = float16table[v >> 16];
 
 	//PTind++;PTind++;
@@ -1681,8 +2155,18 @@ static BOOL gfx3d_glPosTest(u32 v)
 
 	PTcoords[3] = 1.0f;
 
-	MatrixMultVec4x4(mtxCurrent[1], PTcoords);
-	MatrixMultVec4x4(mtxCurrent[0], PTcoords);
+	if (fixedPointGeometry)
+	{
+		PTcoordsFx[3] = (1<<12);
+		MatrixMultVec4x4_M2(mtxCurrentFx[0], PTcoordsFx);
+		for (int i = 0; i < 4; i++)
+			PTcoords[i] = PTcoordsFx[i] / 4096.0f;
+	}
+	else
+	{
+		MatrixMultVec4x4(mtxCurrent[1], PTcoords);
+		MatrixMultVec4x4(mtxCurrent[0], PTcoords);
+	}
 
 	MMU_new.gxstat.tb = 0;
 
@@ -1783,6 +2267,9 @@ void gfx3d_UpdateToonTable(u8 offset, u32 val)
 //s32 gfx3d_GetClipMatrix (unsigned int index)
 s32 gfx3d_GetClipMatrix (u32 index)
 {
+	if (fixedPointGeometry)
+		return MatrixGetMultipliedIndex(index, mtxCurrentFx[0], mtxCurrentFx[1]);
+
 	float val = MatrixGetMultipliedIndex(index, mtxCurrent[0], mtxCurrent[1]);
 
 	val *= (1 << 12);
@@ -1795,6 +2282,9 @@ s32 gfx3d_GetDirectionalMatrix (u32 index)
 {
 	int _index = (((index / 3) * 4) + (index % 3));
 
+	if (fixedPointGeometry)
+		return mtxCurrentFx[2][_index];
+
 	return (s32)(mtxCurrent[2][_index] * (1 << 12));
 }
 
@@ -1941,6 +2431,8 @@ static void gfx3d_execute(u8 cmd, u32 param)
 	//log3D(cmd, param);
 #endif
 
+	if(gfx3d_traceRecording) gfx3d_traceCommand(cmd, param);
+
 	switch (cmd)
 	{
 		case 0x10:		// MTX_MODE - Set Matrix Mode (W)
@@ -2191,6 +2683,11 @@ static bool HasTo_ogfx3d_execute(u8 cmd, u32 param)
 }
 
 
+void gfx3d_executeCommand(u8 cmd, u32 param)
+{
+	gfx3d_execute(cmd, param);
+}
+
 void gfx3d_execute3D()
 {
 	u8	cmd = 0;
@@ -2375,6 +2872,15 @@ static void gfx3d_doFlush()
 	gfx3d.state.activeFlushCommand = gfx3d.state.pendingFlushCommand;
 
 	int polycount = polylist->count;
+#ifdef _GFX3D_BENCH_GEOMETRY
+	benchGeometryFrames++;
+	if (benchGeometryFrames == 60)
+	{
+		printf("geometry (%s): %u verts, %.3f us/vert\n", fixedPointGeometry ? "fixed" : "float",
+			benchGeometryVerts, benchGeometryVerts ? (float)benchGeometryTicks / benchGeometryVerts : 0.0f);
+		benchGeometryTicks = benchGeometryVerts = benchGeometryFrames = 0;
+	}
+#endif
 #ifdef _SHOW_VTX_COUNTERS
 	max_polys = max((u32)polycount, max_polys);
 	max_verts = max((u32)vertlist->count, max_verts);
@@ -2382,73 +2888,13 @@ static void gfx3d_doFlush()
 	osd->addFixed(180, 35, "%i/%i", max_polys, max_verts);		// max
 #endif
 
-//find the min and max y values for each poly.
-	//TODO - this could be a small waste of time if we are manual sorting the translucent polys
-	//TODO - this _MUST_ be moved later in the pipeline, after clipping.
-	//the w-division here is just an approximation to fix the shop in harvest moon island of happiness
-	//also the buttons in the knights in the nightmare frontend depend on this
-	for (int i = 0; i < polycount; i++)
-	{
-		// TODO: Possible divide by zero with the w-coordinate.
-		// Is the vertex being read correctly? Is 0 a valid value for w?
-		// If both of these questions answer to yes, then how does the NDS handle a NaN?
-		// For now, simply prevent w from being zero.
-		POLY& poly = polylist->list[i];
-		float verty = vertlist->list[poly.vertIndexes[0]].y;
-		float vertz = vertlist->list[poly.vertIndexes[0]].z;
-		float vertw = (vertlist->list[poly.vertIndexes[0]].w != 0.0f) ? vertlist->list[poly.vertIndexes[0]].w : 0.00000001f;
-	//	verty = 1.0f - (verty + vertw) / (2 * vertw);
-		vertz = 1.0f - (vertz + vertw) / (2 * vertw);
-
-		poly.miny = poly.maxy = verty;
-		poly.minz = poly.maxz = vertz;
-
-		for (int j = 1; j < poly.type; j++)
-		{
-			//verty = vertlist->list[poly.vertIndexes[j]].y;
-			vertz = vertlist->list[poly.vertIndexes[j]].z;
-
-			vertw = (vertlist->list[poly.vertIndexes[j]].w != 0.0f) ? vertlist->list[poly.vertIndexes[j]].w : 0.00000001f;
-
-			//verty = 1.0f - (verty + vertw) / (2 * vertw);
-			vertz = 1.0f - (vertz + vertw) / (2 * vertw);
-
-			//poly.miny = min(poly.miny, verty);
-			//poly.maxy = max(poly.maxy, verty);
-			
-			poly.minz = min(poly.minz, vertz);
-			poly.maxz = max(poly.maxz, vertz);
-		}
-
-	}
-
-	//we need to sort the poly list with alpha polys last
-	//first, look for opaque polys
-	int ctr = 0;
-	for (int i = 0;i < polycount;i++) {
-		POLY& poly = polylist->list[i];
-		if (!poly.isTranslucent())
-			gfx3d.indexlist.list[ctr++] = i;
-	}
-	int opaqueCount = ctr;
-	//then look for translucent polys
-	for (int i = 0;i < polycount;i++) {
-		POLY& poly = polylist->list[i];
-		if (poly.isTranslucent())
-			gfx3d.indexlist.list[ctr++] = i;
-	}
-
-	//NOTE: the use of the stable_sort below must be here as a workaround for some compilers on osx and linux.
-	//we're hazy on the exact behaviour of the resulting bug, all thats known is the list gets mangled somehow.
-	//it should not in principle be relevant since the predicate results in no ties.
-	//perhaps the compiler is buggy. perhaps the predicate is wrong.
-
-	//now we have to sort the opaque polys by y-value.
+	//the polys were classified and given their sort keys as they were completed (see gfx3d_classifyPoly).
+	//all that is left is to sort the opaque ones by depth, and put the translucent ones after them.
 	//(test case: harvest moon island of happiness character cretor UI)
 	//should this be done after clipping??
-    
-	//std::stable_sort(gfx3d.indexlist.list, gfx3d.indexlist.list + opaqueCount, gfx3d_ysort_compare);
-	std::stable_sort(gfx3d.indexlist.list, gfx3d.indexlist.list + opaqueCount, gfx3d_zsort_compare);
+	gfx3d_sortOpaquePolys(gfx3d.indexlist.list);
+	int opaqueCount = polyOpaqueCount;
+	memcpy(gfx3d.indexlist.list + opaqueCount, polyTranslucentList, polyTranslucentCount*sizeof(int));
 	
 
 /*
@@ -2462,6 +2908,8 @@ static void gfx3d_doFlush()
 	//switch to the new lists
 	twiddleLists();
 
+	if(gfx3d_traceRecording) gfx3d_traceFlush(control);
+
 	/*if(driver->view3d->IsRunning())
 	{
 //		viewer3d_state->frameNumber = currFrameCounter;
@@ -2508,6 +2956,10 @@ void gfx3d_VBlankEndSignal(bool skipFrame)
 	//EMU_SCREEN();
 	
 	gpu3D->NDS_3D_Render();
+
+	//the render waits for the GU, so the frame's textures arent in use anymore. this is where the
+	//texture cache gets back within its budget (see TexCache_EvictFrame)
+	gpu3D->NDS_3D_RenderFinish();
 }
 
 //#define _3D_LOG
@@ -2519,6 +2971,11 @@ void gfx3d_sendCommandToFIFO(u32 val)
 	gxf_hardware.receive(val);
 }
 
+void gfx3d_sendCommandsToFIFO(const u32 *vals, u32 count)
+{
+	gxf_hardware.receiveBlock(vals, count);
+}
+
 void gfx3d_sendCommand(u32 cmd, u32 param)
 {
 	cmd = (cmd & 0x01FF) >> 2;
@@ -2796,11 +3253,11 @@ bool gfx3d_loadstate(EMUFILE* is, int size)
 	if(version>=1)
 	{
 		OSREAD(vertlist->count);
-		for(int i=0;i<vertlist->count;i++)
-			vertlist->list[i].load(is);
+		if(vertlist->count < 0 || vertlist->count > VERTLIST_SIZE) return false;
+		if(!gfx3d_loadList<VERT,VERT_SAVESIZE>(is,vertlist->list,vertlist->count)) return false;
 		OSREAD(polylist->count);
-		for(int i=0;i<polylist->count;i++)
-			polylist->list[i].load(is);
+		if(polylist->count < 0 || polylist->count > POLYLIST_SIZE) return false;
+		if(!gfx3d_loadList<POLY,POLY_SAVESIZE>(is,polylist->list,polylist->count)) return false;
 	}
 
 	if(version>=2)
@@ -2808,8 +3265,7 @@ bool gfx3d_loadstate(EMUFILE* is, int size)
 		for(int i=0;i<4;i++)
 		{
 			OSREAD(mtxStack[i].position);
-			for(int j=0;j<mtxStack[i].size*16;j++)
-				OSREAD(mtxStack[i].matrix[j]);
+			is->fread((char*)mtxStack[i].matrix,mtxStack[i].size*16*sizeof(float));
 		}
 	}
 
@@ -2817,6 +3273,9 @@ bool gfx3d_loadstate(EMUFILE* is, int size)
 		gxf_hardware.loadstate(is);
 	}
 
+	//savestates only carry the float matrices and vertices
+	gfx3d_rebuildGeometryState();
+
 	gfx3d.polylist = &polylists[listTwiddle^1];
 	gfx3d.vertlist = &vertlists[listTwiddle^1];
 	gfx3d.polylist->count=0;
@@ -228,6 +228,9 @@ enum
 
 void gfx3d_init();
 void gfx3d_reset();
+//switches the geometry engine between the float and the fixed point math (GFX3D_FixedPointGeometry)
+//right away, carrying over the matrices and the lists being built
+void gfx3d_setFixedPointGeometry(bool enable);
 
 typedef struct
 {
@@ -499,6 +502,7 @@ struct POLY {
 	
 	void save(EMUFILE* os);
 	void load(EMUFILE* is);
+	const u8* load(const u8 *p);	//from a record as save() wrote it, returns the end of it
 };
 
 //HCF PSP
@@ -566,6 +570,8 @@ struct VERT {
 	}
 	float fcolor[3];
 	u8 color[3];
+	//z/w as 1.14 fixed point; only filled in by the fixed point geometry pipeline
+	s32 fixedDepth;
 
 
 	void color_to_float() {
@@ -575,6 +581,7 @@ struct VERT {
 	}
 	void save(EMUFILE* os);
 	void load(EMUFILE* is);
+	const u8* load(const u8 *p);
 };
 
 //HCF PSP
@@ -785,7 +792,10 @@ void gfx3d_VBlankSignal();
 void gfx3d_VBlankEndSignal(bool skipFrame);
 void gfx3d_Control(u32 v);
 void gfx3d_execute3D();
+//runs one command right away, without the fifo
+void gfx3d_executeCommand(u8 cmd, u32 param);
 void gfx3d_sendCommandToFIFO(u32 val);
+void gfx3d_sendCommandsToFIFO(const u32 *vals, u32 count);
 void gfx3d_sendCommand(u32 cmd, u32 param);
 
 //other misc stuff
@@ -0,0 +1,373 @@
+/*
+	Copyright (C) 2009-2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <vector>
+#include <zlib.h>
+#include <psprtc.h>
+
+#include "gfx3dtrace.h"
+#include "gfx3d.h"
+#include "render3D.h"
+#include "texcache.h"
+#include "MMU.h"
+#include "emufile.h"
+#include "readwrite.h"
+#include "saves.h"
+
+//file layout, all little endian:
+//  "DS3T", version, frame count
+//  size of the 3d state, then the state in savestate chunk format (see savestate_save3D)
+//  per frame:
+//    DISP3DCNT
+//    block: the command bytes, then the params
+//    per texture slot (4) and texture palette slot (6): a TRACE_SLOT_* kind, then a block for TRACE_SLOT_DATA
+//a block is its size, its deflated size and the deflated bytes
+
+#define TRACE_VERSION 1
+
+#define TRACE_TEXTURE_SLOTS 4
+#define TRACE_SLOTS (TRACE_TEXTURE_SLOTS + 6)
+
+enum
+{
+	TRACE_SLOT_UNMAPPED = 0,
+	TRACE_SLOT_SAME = 1,	//same contents as in the frame before
+	TRACE_SLOT_DATA = 2
+};
+
+static u8*& trace_slot(int i)
+{
+	if(i < TRACE_TEXTURE_SLOTS) return MMU.texInfo.textureSlotAddr[i];
+	return MMU.texInfo.texPalSlot[i - TRACE_TEXTURE_SLOTS];
+}
+
+static u32 trace_slotSize(int i)
+{
+	return (i < TRACE_TEXTURE_SLOTS) ? 0x20000 : 0x4000;
+}
+
+static void trace_writeBlock(EMUFILE *os, const u8 *data, u32 len)
+{
+	uLongf compressedLen = compressBound(len);
+	std::vector<u8> compressed(compressedLen + 1);
+	if(compress2(&compressed[0], &compressedLen, data, len, Z_BEST_SPEED) != Z_OK)
+		compressedLen = 0;
+
+	write32le(len, os);
+	write32le((u32)compressedLen, os);
+	os->fwrite(&compressed[0], compressedLen);
+}
+
+static bool trace_readBlock(EMUFILE *is, std::vector<u8> &out)
+{
+	u32 len, compressedLen;
+	if(!read32le(&len, is) || !read32le(&compressedLen, is)) return false;
+
+	std::vector<u8> compressed(compressedLen + 1);
+	if(is->fread(&compressed[0], compressedLen) != compressedLen) return false;
+
+	out.resize(len + 1);
+	uLongf outLen = len;
+	if(uncompress(&out[0], &outLen, &compressed[0], compressedLen) != Z_OK || outLen != len) return false;
+	out.resize(len);
+	return true;
+}
+
+//--------------recording
+
+bool gfx3d_traceRecording = false;
+
+static EMUFILE_FILE *trace_file = NULL;
+static u32 trace_framesLeft = 0;
+static u32 trace_framesWritten = 0;
+static bool trace_started = false;
+static std::vector<u8> trace_cmds;
+static std::vector<u32> trace_params;
+
+//what each slot held in the last frame written
+static u8 *trace_lastVram = NULL;
+static bool trace_lastMapped[TRACE_SLOTS];
+
+bool gfx3d_traceBegin(const char *fname, u32 frames)
+{
+	gfx3d_traceEnd();
+	if(frames == 0) return false;
+
+	u32 vramSize = 0;
+	for(int i=0;i<TRACE_SLOTS;i++) vramSize += trace_slotSize(i);
+	trace_lastVram = new u8[vramSize];
+
+	trace_file = new EMUFILE_FILE(fname, "wb");
+	if(trace_file->fail())
+	{
+		delete trace_file; trace_file = NULL;
+		delete[] trace_lastVram; trace_lastVram = NULL;
+		return false;
+	}
+
+	trace_file->fwrite("DS3T", 4);
+	write32le(TRACE_VERSION, trace_file);
+	write32le(0, trace_file); //frame count, filled in at the end
+
+	trace_framesLeft = frames;
+	trace_framesWritten = 0;
+	trace_started = false;
+	trace_cmds.clear();
+	trace_params.clear();
+	gfx3d_traceRecording = true;
+
+	return true;
+}
+
+void gfx3d_traceEnd()
+{
+	if(!trace_file) return;
+
+	trace_file->fseek(8, SEEK_SET);
+	write32le(trace_framesWritten, trace_file);
+
+	delete trace_file; trace_file = NULL;
+	delete[] trace_lastVram; trace_lastVram = NULL;
+	trace_cmds.clear();
+	trace_params.clear();
+	gfx3d_traceRecording = false;
+}
+
+void gfx3d_traceCommand(u8 cmd, u32 param)
+{
+	if(!trace_started) return;
+	trace_cmds.push_back(cmd);
+	trace_params.push_back(param);
+}
+
+static void trace_writeFrame(u32 disp3dcnt)
+{
+	write32le(disp3dcnt, trace_file);
+
+	const u32 count = trace_cmds.size();
+	std::vector<u8> block(count * 5 + 1);
+	if(count)
+	{
+		memcpy(&block[0], &trace_cmds[0], count);
+		memcpy(&block[count], &trace_params[0], count * 4);
+	}
+	trace_writeBlock(trace_file, &block[0], count * 5);
+	trace_cmds.clear();
+	trace_params.clear();
+
+	//only the slots which changed since the frame before get stored again
+	u8 *last = trace_lastVram;
+	for(int i=0;i<TRACE_SLOTS;i++)
+	{
+		const u8 *ptr = trace_slot(i);
+		const u32 size = trace_slotSize(i);
+
+		if(ptr == MMU.blank_memory)
+		{
+			write32le(TRACE_SLOT_UNMAPPED, trace_file);
+			trace_lastMapped[i] = false;
+		}
+		else if(trace_framesWritten > 0 && trace_lastMapped[i] && !memcmp(last, ptr, size))
+			write32le(TRACE_SLOT_SAME, trace_file);
+		else
+		{
+			write32le(TRACE_SLOT_DATA, trace_file);
+			trace_writeBlock(trace_file, ptr, size);
+			memcpy(last, ptr, size);
+			trace_lastMapped[i] = true;
+		}
+
+		last += size;
+	}
+
+	trace_framesWritten++;
+}
+
+void gfx3d_traceFlush(u32 disp3dcnt)
+{
+	if(!trace_file) return;
+
+	if(!trace_started)
+	{
+		//the lists were just handed to the renderer, so this is a clean point to start from
+		EMUFILE_MEMORY state;
+		savestate_save3D(&state);
+		write32le(state.size(), trace_file);
+		trace_file->fwrite(state.buf(), state.size());
+		trace_started = true;
+		return;
+	}
+
+	trace_writeFrame(disp3dcnt);
+
+	if(--trace_framesLeft == 0)
+		gfx3d_traceEnd();
+}
+
+//--------------replay
+
+struct TraceFrame
+{
+	u32 disp3dcnt;
+	std::vector<u8> cmds;
+	std::vector<u32> params;
+	u8 *slots[TRACE_SLOTS];
+};
+
+struct TraceReplayData
+{
+	std::vector<u8> state;
+	std::vector<TraceFrame> frames;
+	std::vector<std::vector<u8>*> vram;
+
+	~TraceReplayData()
+	{
+		for(u32 i=0;i<vram.size();i++)
+			delete vram[i];
+	}
+
+	bool load(const char *fname)
+	{
+		EMUFILE_FILE f(fname, "rb");
+		if(f.fail()) return false;
+
+		char magic[4];
+		u32 version, frameCount, stateSize;
+		if(f.fread(magic, 4) != 4 || memcmp(magic, "DS3T", 4)) return false;
+		if(!read32le(&version, &f) || version != TRACE_VERSION) return false;
+		if(!read32le(&frameCount, &f) || !read32le(&stateSize, &f)) return false;
+
+		state.resize(stateSize + 1);
+		if(f.fread(&state[0], stateSize) != stateSize) return false;
+		state.resize(stateSize);
+
+		frames.resize(frameCount);
+		std::vector<u8> block;
+		for(u32 n=0;n<frameCount;n++)
+		{
+			TraceFrame &frame = frames[n];
+			if(!read32le(&frame.disp3dcnt, &f)) return false;
+
+			if(!trace_readBlock(&f, block) || block.size() % 5) return false;
+			const u32 count = block.size() / 5;
+			frame.cmds.assign(block.begin(), block.begin() + count);
+			frame.params.resize(count);
+			if(count) memcpy(&frame.params[0], &block[count], count * 4);
+
+			for(int i=0;i<TRACE_SLOTS;i++)
+			{
+				u32 kind;
+				if(!read32le(&kind, &f)) return false;
+				switch(kind)
+				{
+					case TRACE_SLOT_UNMAPPED:
+						frame.slots[i] = MMU.blank_memory;
+						break;
+					case TRACE_SLOT_SAME:
+						if(n == 0) return false;
+						frame.slots[i] = frames[n-1].slots[i];
+						break;
+					case TRACE_SLOT_DATA:
+						vram.push_back(new std::vector<u8>());
+						if(!trace_readBlock(&f, *vram.back()) || vram.back()->size() != trace_slotSize(i)) return false;
+						frame.slots[i] = &(*vram.back())[0];
+						break;
+					default:
+						return false;
+				}
+			}
+		}
+
+		return true;
+	}
+};
+
+bool gfx3d_traceReplay(const char *fname, u32 iterations, GFX3D_TraceReplayStats &stats)
+{
+	memset(&stats, 0, sizeof(stats));
+	if(gfx3d_traceRecording) return false;
+
+	TraceReplayData trace;
+	if(!trace.load(fname) || trace.frames.empty())
+	{
+		printf("3d trace: couldnt load %s\n", fname);
+		return false;
+	}
+
+	//keep the emulator's own 3d state to put back afterwards
+	gpu3D->NDS_3D_RenderFinish();
+	EMUFILE_MEMORY saved;
+	savestate_save3D(&saved);
+	const MMU_struct::TextureInfo savedTexInfo = MMU.texInfo;
+	const u64 savedGfx3dCycles = MMU.gfx3dCycles;
+
+	TexCache_Reset();
+
+	for(u32 it=0;it<iterations;it++)
+	{
+		EMUFILE_MEMORY state(&trace.state);
+		savestate_load3D(&state);
+
+		for(u32 n=0;n<trace.frames.size();n++)
+		{
+			const TraceFrame &frame = trace.frames[n];
+
+			for(int i=0;i<TRACE_SLOTS;i++)
+				trace_slot(i) = frame.slots[i];
+			TexCache_Invalidate();
+			gfx3d_Control(frame.disp3dcnt);
+
+			u64 start, end;
+			sceRtcGetCurrentTick(&start);
+
+			const u32 count = frame.cmds.size();
+			for(u32 i=0;i<count;i++)
+				gfx3d_executeCommand(frame.cmds[i], frame.params[i]);
+			gfx3d_VBlankSignal();
+
+			stats.vertices += gfx3d.vertlist->count;
+			stats.polygons += gfx3d.polylist->count;
+
+			gfx3d_VBlankEndSignal(false);
+			gpu3D->NDS_3D_RenderFinish();
+
+			sceRtcGetCurrentTick(&end);
+			stats.micros += end - start;
+			stats.frames++;
+		}
+	}
+
+	//the texture cache may hold items decoded from the trace's vram, which is about to go away
+	MMU.texInfo = savedTexInfo;
+	TexCache_Reset();
+	saved.fseek(0, SEEK_SET);
+	savestate_load3D(&saved);
+	MMU.gfx3dCycles = savedGfx3dCycles;
+
+	if(stats.frames && stats.micros)
+	{
+		stats.msPerFrame = (float)stats.micros / 1000.0f / (float)stats.frames;
+		stats.verticesPerSecond = (float)stats.vertices * 1000000.0f / (float)stats.micros;
+		stats.polygonsPerSecond = (float)stats.polygons * 1000000.0f / (float)stats.micros;
+	}
+
+	printf("3d trace: %u frames x %u: %.3f ms/frame, %.0f verts/s, %.0f polys/s\n",
+		(u32)trace.frames.size(), iterations, stats.msPerFrame, stats.verticesPerSecond, stats.polygonsPerSecond);
+
+	return true;
+}
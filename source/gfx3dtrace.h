@@ -0,0 +1,53 @@
+/*
+	Copyright (C) 2009-2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _GFX3DTRACE_H_
+#define _GFX3DTRACE_H_
+
+#include "types.h"
+
+//3d command traces, for profiling the geometry engine and the 3d renderer apart from the rest of the emulation.
+//
+//recording starts at the next flush: the 3d engine state is saved there, and from then on every command the
+//geometry engine executes is kept. at each following flush, the frame's commands are written along with
+//DISP3DCNT and the texture and texture palette vram as it is mapped for rendering that frame.
+//
+//a replay restores the saved state and runs the frames straight through the geometry engine and the current
+//3d renderer, as many times as asked. the emulator's own 3d state is put back afterwards.
+
+bool gfx3d_traceBegin(const char *fname, u32 frames);
+void gfx3d_traceEnd();
+
+struct GFX3D_TraceReplayStats
+{
+	u32 frames;			//frames replayed in total, over all iterations
+	u64 vertices;
+	u64 polygons;
+	u64 micros;			//time spent in the geometry engine and the renderer
+	float msPerFrame;
+	float verticesPerSecond;
+	float polygonsPerSecond;
+};
+
+bool gfx3d_traceReplay(const char *fname, u32 iterations, GFX3D_TraceReplayStats &stats);
+
+//hooks for gfx3d.cpp
+extern bool gfx3d_traceRecording;
+void gfx3d_traceCommand(u8 cmd, u32 param);
+void gfx3d_traceFlush(u32 disp3dcnt);
+
+#endif
@@ -0,0 +1,332 @@
+/*
+	Copyright (C) 2009-2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <psprtc.h>
+
+#include "headless.h"
+#include "NDSSystem.h"
+#include "GPU.h"
+#include "SPU.h"
+#include "MMU.h"
+#include "mc.h"
+#include "render3D.h"
+#include "ROMReader.h"
+#include "statehash.h"
+#include "gfx3dtrace.h"
+#include "avdump.h"
+#include "PSP/FrontEnd.h"
+
+extern char rom_filename[256];
+
+bool headless_active = false;
+u64 headless_timers[HEADLESS_TIMER_COUNT];
+u64 headless_timedTotal = 0;
+
+static const char *headless_timerNames[HEADLESS_TIMER_COUNT] = { "2d", "3d", "spu", "dma" };
+
+//without a movie or --frames, this many frames get run
+#define HEADLESS_DEFAULT_FRAMES 600
+
+u64 HEADLESS_Tick()
+{
+	u64 tick;
+	sceRtcGetCurrentTick(&tick);
+	return tick;
+}
+
+//--------------movie input
+
+//the movie commands we act on (see movie.h in upstream desmume)
+enum
+{
+	HEADLESS_MOVIECMD_MIC = 1,
+	HEADLESS_MOVIECMD_RESET = 2
+};
+
+struct HeadlessMovieRecord
+{
+	u8 commands;
+	u16 pad;		//one bit per button, in NDS_setPad's order
+	u8 touchX, touchY;
+	bool touch;
+};
+
+//reads the input log of a .dsm. the header lines are skipped; every record is a line like
+//  |0|RLDUTSBAYXWEG 128 096 1|
+//with a '.' for each button that isnt held
+static bool HEADLESS_LoadMovie(const char *fname, std::vector<HeadlessMovieRecord> &records)
+{
+	FILE *fp = fopen(fname, "rb");
+	if(!fp) return false;
+
+	char line[256];
+	while(fgets(line, sizeof(line), fp))
+	{
+		if(line[0] != '|') continue;
+
+		char *p = line + 1;
+		HeadlessMovieRecord rec;
+		rec.commands = (u8)strtoul(p, &p, 10);
+		if(*p++ != '|') continue;
+
+		rec.pad = 0;
+		for(int i = 0; i < 13; i++, p++)
+		{
+			if(*p == 0) break;
+			if(*p != '.' && *p != ' ') rec.pad |= 1 << i;
+		}
+
+		int x = 0, y = 0, touch = 0;
+		sscanf(p, "%d %d %d", &x, &y, &touch);
+		rec.touchX = (u8)x;
+		rec.touchY = (u8)y;
+		rec.touch = touch != 0;
+
+		records.push_back(rec);
+	}
+
+	fclose(fp);
+	return true;
+}
+
+static void HEADLESS_ApplyInput(const HeadlessMovieRecord &rec)
+{
+	if(rec.commands & HEADLESS_MOVIECMD_RESET)
+		NDS_Reset();
+
+	#define BUTTON(n) ((rec.pad >> (n)) & 1)
+	NDS_setPad(BUTTON(0), BUTTON(1), BUTTON(2), BUTTON(3), BUTTON(4), BUTTON(5), BUTTON(6),
+		BUTTON(7), BUTTON(8), BUTTON(9), BUTTON(10), BUTTON(11), BUTTON(12), false);
+	#undef BUTTON
+
+	if(rec.touch) NDS_setTouchPos(rec.touchX, rec.touchY);
+	else NDS_releaseTouch();
+
+	NDS_setMic((rec.commands & HEADLESS_MOVIECMD_MIC) != 0);
+
+	NDS_beginProcessingInput();
+	NDS_endProcessingInput();
+}
+
+//--------------runner
+
+static void HEADLESS_Report(FILE *fp, u32 frames, u64 micros, u64 hash)
+{
+	if(!fp) return;
+
+	const float ms = (float)micros / 1000.0f;
+	fprintf(fp, "headless: %s\n", rom_filename);
+	fprintf(fp, "headless: %u frames in %.1f ms, %.2f fps\n", frames, ms,
+		micros ? (float)frames * 1000000.0f / (float)micros : 0.0f);
+
+	//whatever isnt in one of the subsystems is the arm cores and the rest of the scheduling
+	u64 cpu = micros;
+	for(int i = 0; i < HEADLESS_TIMER_COUNT; i++)
+		cpu -= std::min(cpu, headless_timers[i]);
+
+	fprintf(fp, "headless: %-4s %10.1f ms %5.1f%%\n", "cpu", (float)cpu / 1000.0f,
+		micros ? (float)cpu * 100.0f / (float)micros : 0.0f);
+	for(int i = 0; i < HEADLESS_TIMER_COUNT; i++)
+		fprintf(fp, "headless: %-4s %10.1f ms %5.1f%%\n", headless_timerNames[i], (float)headless_timers[i] / 1000.0f,
+			micros ? (float)headless_timers[i] * 100.0f / (float)micros : 0.0f);
+
+	char str[17];
+	STATEHASH_ToString(hash, str);
+	fprintf(fp, "headless: frame hash %s\n", str);
+}
+
+int HEADLESS_Main(int argc, char **argv)
+{
+	const char *rom = NULL, *movie = NULL, *save = NULL, *report = NULL, *compress = NULL, *hashes = NULL;
+	const char *trace = NULL, *replay = NULL, *dump = NULL;
+	u32 frames = 0, traceFrames = 0, replayIterations = 0;
+	bool framesGiven = false;
+	bool lazyMix = false, fixedMix = false, fixedGeometry = false, directGXFifo = false;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--movie") && i + 1 < argc) movie = argv[++i];
+		else if(!strcmp(argv[i], "--save") && i + 1 < argc) save = argv[++i];
+		else if(!strcmp(argv[i], "--frames") && i + 1 < argc) { frames = strtoul(argv[++i], NULL, 10); framesGiven = true; }
+		else if(!strcmp(argv[i], "--report") && i + 1 < argc) report = argv[++i];
+		else if(!strcmp(argv[i], "--compress") && i + 1 < argc) compress = argv[++i];
+		else if(!strcmp(argv[i], "--hashes") && i + 1 < argc) hashes = argv[++i];
+		else if(!strcmp(argv[i], "--dump") && i + 1 < argc) dump = argv[++i];
+		else if(!strcmp(argv[i], "--trace") && i + 2 < argc) { trace = argv[++i]; traceFrames = strtoul(argv[++i], NULL, 10); }
+		else if(!strcmp(argv[i], "--replay") && i + 2 < argc) { replay = argv[++i]; replayIterations = strtoul(argv[++i], NULL, 10); }
+		else if(!strcmp(argv[i], "--lazy-mix")) lazyMix = true;
+		else if(!strcmp(argv[i], "--fixed-mix")) fixedMix = true;
+		else if(!strcmp(argv[i], "--fixed-geometry")) fixedGeometry = true;
+		else if(!strcmp(argv[i], "--direct-gxfifo")) directGXFifo = true;
+		else if(argv[i][0] != '-' && !rom) rom = argv[i];
+		else
+		{
+			printf("headless: unknown argument %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if(!rom)
+	{
+		printf("headless: usage: <rom.nds> [--movie <file.dsm>] [--save <file.dsv>] [--frames <n>] [--report <file>] [--hashes <file>]\n");
+		printf("headless:                  [--trace <file> <frames>] [--replay <file> <iterations>] [--dump <basename>]\n");
+		printf("headless:                  [--lazy-mix] [--fixed-mix] [--fixed-geometry] [--direct-gxfifo]\n");
+		printf("headless:        <rom.nds> --compress <file.ndsc>\n");
+		return 1;
+	}
+
+	if(compress)
+	{
+		if(!CHUNKEDROM_Create(rom, compress))
+		{
+			printf("headless: couldnt write %s\n", compress);
+			return 1;
+		}
+		printf("headless: wrote %s\n", compress);
+		return 0;
+	}
+
+	std::vector<HeadlessMovieRecord> records;
+	if(movie && !HEADLESS_LoadMovie(movie, records))
+	{
+		printf("headless: couldnt load movie %s\n", movie);
+		return 1;
+	}
+	if(!framesGiven)
+		frames = movie ? records.size() : HEADLESS_DEFAULT_FRAMES;
+
+	//the same settings every run, whatever the gui was left with. the spu core still mixes,
+	//but into the dummy sound core, and the 2d gets drawn here rather than on the me
+	memset(&my_config, 0, sizeof(my_config));
+	InitDisplayParams(&my_config);
+	my_config.enable_sound = true;
+	my_config.Render3D = true;
+	NDS_3D_ChangeCore(1);
+	SPU_ChangeSoundCore(SNDCORE_DUMMY, 0);
+	backup_setManualBackupType(0);
+	CommonSettings.spu_lazyMixing = lazyMix;
+	CommonSettings.spu_fixedPointMixer = fixedMix;
+	gfx3d_setFixedPointGeometry(fixedGeometry);
+	CommonSettings.GFX3D_DirectGXFifo = directGXFifo;
+
+	strncpy(rom_filename, rom, sizeof(rom_filename) - 1);
+	if(NDS_LoadROM(rom_filename) < 0)
+	{
+		printf("headless: couldnt load rom %s\n", rom);
+		return 1;
+	}
+
+	//importing resets the system, so the movie still starts from power on
+	if(save && !MMU_new.backupDevice.importData(save))
+	{
+		printf("headless: couldnt import save %s\n", save);
+		return 1;
+	}
+
+	FILE *hashFile = NULL;
+	if(hashes && !(hashFile = fopen(hashes, "w")))
+	{
+		printf("headless: couldnt write %s\n", hashes);
+		return 1;
+	}
+
+	//the trace starts at the next flush, so with the first frame run
+	if(trace && !gfx3d_traceBegin(trace, traceFrames))
+	{
+		printf("headless: couldnt record trace %s\n", trace);
+		if(hashFile) fclose(hashFile);
+		return 1;
+	}
+
+	if(dump && !AVDUMP_Begin(dump))
+	{
+		printf("headless: couldnt dump to %s\n", dump);
+		if(trace) gfx3d_traceEnd();
+		if(hashFile) fclose(hashFile);
+		return 1;
+	}
+
+	memset(headless_timers, 0, sizeof(headless_timers));
+	headless_timedTotal = 0;
+	headless_active = true;
+
+	static const HeadlessMovieRecord noInput = { 0, 0, 0, 0, false };
+
+	//the hashing is left out of the time measured
+	u64 hashMicros = 0;
+
+	const u64 start = HEADLESS_Tick();
+	for(u32 frame = 0; frame < frames; frame++)
+	{
+		HEADLESS_ApplyInput(frame < records.size() ? records[frame] : noInput);
+		NDS_exec<false>();
+
+		if(hashFile)
+		{
+			const u64 hashStart = HEADLESS_Tick();
+			char frameStr[17], stateStr[17];
+			STATEHASH_ToString(STATEHASH_Frame(), frameStr);
+			STATEHASH_ToString(STATEHASH_State(), stateStr);
+			fprintf(hashFile, "%u %s %s\n", frame, frameStr, stateStr);
+			hashMicros += HEADLESS_Tick() - hashStart;
+		}
+	}
+	const u64 micros = HEADLESS_Tick() - start - hashMicros;
+
+	headless_active = false;
+	if(hashFile) fclose(hashFile);
+
+	//whatever the run was too short for is written as it is
+	if(trace) gfx3d_traceEnd();
+	if(dump) AVDUMP_End();
+
+	const u64 hash = STATEHASH_Frame();
+	HEADLESS_Report(stdout, frames, micros, hash);
+	if(report)
+	{
+		FILE *fp = fopen(report, "a");
+		HEADLESS_Report(fp, frames, micros, hash);
+		if(fp) fclose(fp);
+	}
+
+	if(replay)
+	{
+		GFX3D_TraceReplayStats stats;
+		if(!gfx3d_traceReplay(replay, replayIterations, stats))
+		{
+			NDS_DeInit();
+			return 1;
+		}
+		if(report)
+		{
+			FILE *fp = fopen(report, "a");
+			if(fp)
+			{
+				fprintf(fp, "headless: 3d trace %s: %u frames, %.3f ms/frame, %.0f verts/s, %.0f polys/s\n",
+					replay, stats.frames, stats.msPerFrame, stats.verticesPerSecond, stats.polygonsPerSecond);
+				fclose(fp);
+			}
+		}
+	}
+
+	NDS_DeInit();
+	return 0;
+}
@@ -0,0 +1,79 @@
+/*
+	Copyright (C) 2009-2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HEADLESS_H_
+#define _HEADLESS_H_
+
+#include "types.h"
+
+//headless benchmark runner. started instead of the gui when the program gets arguments:
+//
+//  <rom.nds> [--movie <file.dsm>] [--save <file.dsv>] [--frames <n>] [--report <file>] [--hashes <file>]
+//            [--trace <file> <frames>] [--replay <file> <iterations>] [--dump <basename>]
+//            [--lazy-mix] [--fixed-mix] [--fixed-geometry] [--direct-gxfifo]
+//  <rom.nds> --compress <file.ndsc>
+//
+//the rom runs from power on (after the save is imported, if any) with the movie's input fed through
+//NDS_beginProcessingInput/NDS_endProcessingInput, as fast as it goes, with no sound output and nothing
+//shown. without --frames it runs for as long as the movie lasts. at the end it reports the emulated
+//frames per second, the time spent in each subsystem and a hash of the last frame, so that two builds
+//can be compared on the same input. --hashes writes a line per frame with the frame number, its frame
+//hash and its state hash (see statehash.h), for finding the first frame where two builds part ways.
+//
+//--trace records a 3d command trace (see gfx3dtrace.h) of that many frames, starting with the first one run.
+//--replay runs a trace through the geometry engine and the 3d renderer that many times once the run is over,
+//and reports the time it took. it only needs the rom for the 3d setup: with --frames 0 nothing else is run.
+//--dump writes every frame of the run to <basename>.frames (see avdump.h). the dummy sound core puts
+//nothing out, so the <basename>.wav next to it stays empty. the time spent queueing the frames is measured.
+//
+//the other switches turn on the optional code paths of the same names in CommonSettings, so a run can
+//compare them against the default ones: --lazy-mix for spu_lazyMixing, --fixed-mix for spu_fixedPointMixer,
+//--fixed-geometry for GFX3D_FixedPointGeometry, --direct-gxfifo for GFX3D_DirectGXFifo.
+//
+//with --compress, the rom is only written out as a chunked container (see ROMReader.h) and nothing is run.
+
+int HEADLESS_Main(int argc, char **argv);
+
+enum HeadlessTimer
+{
+	HEADLESS_TIMER_2D = 0,
+	HEADLESS_TIMER_3D,
+	HEADLESS_TIMER_SPU,
+	HEADLESS_TIMER_DMA,
+	HEADLESS_TIMER_COUNT
+};
+
+//the subsystem timers only run while the headless runner does, so the normal build pays a flag test
+extern bool headless_active;
+extern u64 headless_timers[HEADLESS_TIMER_COUNT];
+extern u64 headless_timedTotal;		//all the time the timers got, nested blocks counted once
+u64 HEADLESS_Tick();
+
+//a timed block nested in another (the geometry a gxfifo dma runs, say) is taken out of the outer one,
+//so every microsecond goes to one timer only
+#define HEADLESS_TIMED(timer, expr) do { \
+	if(headless_active) { \
+		const u64 _headless_nested = headless_timedTotal; \
+		const u64 _headless_start = HEADLESS_Tick(); \
+		expr; \
+		const u64 _headless_time = HEADLESS_Tick() - _headless_start; \
+		headless_timers[timer] += _headless_time - (headless_timedTotal - _headless_nested); \
+		headless_timedTotal = _headless_nested + _headless_time; \
+	} else { expr; } \
+	} while(0)
+
+#endif
@@ -44,6 +44,8 @@
 #include "sndpsp.h"
 #include "ctrlssdl.h"
 #include "slot2.h"
+#include "headless.h"
+#include "saves.h"
 
 #include "render3D.h"
 #include "rasterize.h"
@@ -211,6 +213,9 @@ bool audio_inited = false;
 
 #define PSP_AUDIO_SAMPLE_MAX  8192
 
+//on top of the 4.6MB the rewind buffer keeps as a copy of main memory and vram
+#define REWIND_BUFFER_KB  4096
+
 void EMU_Conf(){
 
   //ReAddress display to 32bit vram
@@ -219,6 +224,8 @@ void EMU_Conf(){
   DoConfig(&my_config);
 
   NDS_3D_ChangeCore(my_config.Render3D);
+  gfx3d_setFixedPointGeometry(my_config.fixed_geometry);
+  CommonSettings.GFX3D_DirectGXFifo = my_config.direct_gxfifo;
   backup_setManualBackupType(my_config.savetype);
 
   pspDebugScreenClear();
@@ -227,17 +234,35 @@ void EMU_Conf(){
   if (my_config.frameskip > 9) my_config.frameskip = 9;*/
 
 #ifndef LOWRAM
+  //the ring lets the spu thread and the audio output pass samples without the user spu lock, but doesnt resample
+  const int syncMethod = my_config.audio_ring ? ESynchMethod_R : ESynchMethod_N;
+  //the user spu mixes on a thread of its own, next to the emulation. the ring is only read without
+  //the lock while that thread runs, so it brings the thread along
+  const bool threaded = my_config.spu_thread || my_config.audio_ring;
+  const bool syncChanged = (syncMethod != CommonSettings.SPU_sync_method) || (threaded != CommonSettings.spu_threaded);
+  CommonSettings.SPU_sync_method = syncMethod;
+  CommonSettings.spu_threaded = threaded;
+
   if (my_config.enable_sound && !audio_inited) {
 	  SPU_ChangeSoundCore(SNDCORE_PSP, PSP_AUDIO_SAMPLE_MAX);
-	  SPU_SetSynchMode(0, 0 /*CommonSettings.SPU_sync_method*/);
+	  SPU_SetSynchMode(CommonSettings.SPU_sync_mode, CommonSettings.SPU_sync_method);
 	  audio_inited = true;
   }
+  else if (audio_inited && my_config.enable_sound && syncChanged) {
+	  SPU_SetSynchMode(CommonSettings.SPU_sync_mode, CommonSettings.SPU_sync_method);
+  }
   else if (audio_inited && !my_config.enable_sound){
 	  SPU_ChangeSoundCore(SNDCORE_DUMMY, 0);
 	  audio_inited = false;
   }
 #endif
 
+#ifndef LOWRAM
+  CommonSettings.rewindBufferKB = my_config.rewind ? REWIND_BUFFER_KB : 0;
+  CommonSettings.spu_lazyMixing = my_config.spu_lazy;
+  CommonSettings.spu_fixedPointMixer = my_config.spu_fixed;
+#endif
+
   GPU_remove(MainScreen.gpu, 0);
   GPU_remove(SubScreen.gpu, 0);
 
@@ -325,6 +350,10 @@ int main(int argc, char **argv) {
   /* Create the dummy firmware */
   NDS_CreateDummyFirmware( &fw_config);
 
+  /* with arguments, run the headless benchmark instead of the gui */
+  if (argc > 1)
+    return HEADLESS_Main(argc, argv);
+
   ChangeRom(false);
 
   EMU_Conf();
@@ -378,10 +407,19 @@ int main(int argc, char **argv) {
 #endif
 	++fps_frame_counter;
 
+	if (rewind_held)
+		dorewind();
+	else
+		rewindsave();
+
+	//a quicksave being written in the background gets its slot updated once it is done
+	savestate_asyncPoll();
+
 	NDS_exec<false>();
 	
   }
 
+  savestate_asyncWait();
   NDS_DeInit();
   return 0;
 }
@@ -443,4 +443,111 @@ void Vector4Copy(float *dst, const float *src)
 	dst[1] = src[1];
 	dst[2] = src[2];
 	dst[3] = src[3];
-}
\ No newline at end of file
+}
+//-------------------------
+//fixed point (20.12) functions
+
+void MatrixInit(s32 *matrix)
+{
+	memset(matrix, 0, sizeof(s32)*16);
+	matrix[0] = matrix[5] = matrix[10] = matrix[15] = (1<<12);
+}
+
+void MatrixIdentity(s32 *matrix)
+{
+	MatrixInit(matrix);
+}
+
+void MatrixCopy(s32 *matrixDST, const s32 *matrixSRC)
+{
+	memcpy(matrixDST, matrixSRC, sizeof(s32)*16);
+}
+
+//there is no integer SIMD on the allegrex, but mult/madd accumulate straight into hi/lo,
+//so four products per output element is about as cheap as it gets
+#define FX_DOT4(a0,b0,a1,b1,a2,b2,a3,b3) fx32_shiftdown(fx32_mul(a0,b0)+fx32_mul(a1,b1)+fx32_mul(a2,b2)+fx32_mul(a3,b3))
+
+void MatrixMultiply(s32 *matrix, const s32 *rightMatrix)
+{
+	s32 tmpMatrix[16];
+
+	for (int col = 0; col < 16; col += 4)
+	{
+		const s32 r0 = rightMatrix[col+0];
+		const s32 r1 = rightMatrix[col+1];
+		const s32 r2 = rightMatrix[col+2];
+		const s32 r3 = rightMatrix[col+3];
+
+		tmpMatrix[col+0] = FX_DOT4(matrix[0],r0, matrix[4],r1, matrix[ 8],r2, matrix[12],r3);
+		tmpMatrix[col+1] = FX_DOT4(matrix[1],r0, matrix[5],r1, matrix[ 9],r2, matrix[13],r3);
+		tmpMatrix[col+2] = FX_DOT4(matrix[2],r0, matrix[6],r1, matrix[10],r2, matrix[14],r3);
+		tmpMatrix[col+3] = FX_DOT4(matrix[3],r0, matrix[7],r1, matrix[11],r2, matrix[15],r3);
+	}
+
+	memcpy(matrix, tmpMatrix, sizeof(s32)*16);
+}
+
+void MatrixTranslate(s32 *matrix, const s32 *ptr)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		s64 temp = fx32_shiftup(matrix[i+12]);
+		temp += fx32_mul(matrix[i+0], ptr[0]);
+		temp += fx32_mul(matrix[i+4], ptr[1]);
+		temp += fx32_mul(matrix[i+8], ptr[2]);
+		matrix[i+12] = fx32_shiftdown(temp);
+	}
+}
+
+void MatrixScale(s32 *matrix, const s32 *ptr)
+{
+	for (int i = 0; i < 12; i++)
+		matrix[i] = fx32_shiftdown(fx32_mul(matrix[i], ptr[i>>2]));
+}
+
+void MatrixMultVec4x4(const s32 *matrix, s32 *vecPtr)
+{
+	const s32 x = vecPtr[0];
+	const s32 y = vecPtr[1];
+	const s32 z = vecPtr[2];
+	const s32 w = vecPtr[3];
+
+	vecPtr[0] = FX_DOT4(x,matrix[0], y,matrix[4], z,matrix[ 8], w,matrix[12]);
+	vecPtr[1] = FX_DOT4(x,matrix[1], y,matrix[5], z,matrix[ 9], w,matrix[13]);
+	vecPtr[2] = FX_DOT4(x,matrix[2], y,matrix[6], z,matrix[10], w,matrix[14]);
+	vecPtr[3] = FX_DOT4(x,matrix[3], y,matrix[7], z,matrix[11], w,matrix[15]);
+}
+
+void MatrixMultVec3x3(const s32 *matrix, s32 *vecPtr)
+{
+	const s32 x = vecPtr[0];
+	const s32 y = vecPtr[1];
+	const s32 z = vecPtr[2];
+
+	vecPtr[0] = fx32_shiftdown(fx32_mul(x,matrix[0]) + fx32_mul(y,matrix[4]) + fx32_mul(z,matrix[ 8]));
+	vecPtr[1] = fx32_shiftdown(fx32_mul(x,matrix[1]) + fx32_mul(y,matrix[5]) + fx32_mul(z,matrix[ 9]));
+	vecPtr[2] = fx32_shiftdown(fx32_mul(x,matrix[2]) + fx32_mul(y,matrix[6]) + fx32_mul(z,matrix[10]));
+}
+
+s32 MatrixGetMultipliedIndex(int index, const s32 *matrix, const s32 *rightMatrix)
+{
+	int iMod = index%4, iDiv = (index>>2)<<2;
+
+	return FX_DOT4(matrix[iMod  ],rightMatrix[iDiv  ], matrix[iMod+ 4],rightMatrix[iDiv+1],
+	               matrix[iMod+8],rightMatrix[iDiv+2], matrix[iMod+12],rightMatrix[iDiv+3]);
+}
+
+#undef FX_DOT4
+
+void MatrixFix2Float(float *matrixDST, const s32 *matrixSRC)
+{
+	static const float _div = (1.f / 4096.f);
+	for (int i = 0; i < 16; i++)
+		matrixDST[i] = (float)matrixSRC[i] * _div;
+}
+
+void MatrixFloat2Fix(s32 *matrixDST, const float *matrixSRC)
+{
+	for (int i = 0; i < 16; i++)
+		matrixDST[i] = (s32)floorf(matrixSRC[i] * 4096.f + 0.5f);
+}
@@ -82,6 +82,27 @@ void Vector3Normalize(float* dst);
 
 void Vector4Copy(float* dst, const float* src);
 
+//fixed point (20.12) matrix functions, used by the fixed point geometry pipeline.
+//these accumulate in 64bits and shift down by 12 the same way the geometry engine does,
+//so they dont drift from the hardware results the way the float versions do.
+void	MatrixInit(s32* matrix);
+void	MatrixIdentity(s32* matrix);
+void	MatrixCopy(s32* matrixDST, const s32* matrixSRC);
+void	MatrixMultiply(s32* matrix, const s32* rightMatrix);
+void	MatrixTranslate(s32* matrix, const s32* ptr);
+void	MatrixScale(s32* matrix, const s32* ptr);
+void	MatrixMultVec4x4(const s32* matrix, s32* vecPtr);
+void	MatrixMultVec3x3(const s32* matrix, s32* vecPtr);
+s32		MatrixGetMultipliedIndex(int index, const s32* matrix, const s32* rightMatrix);
+void	MatrixFix2Float(float* matrixDST, const s32* matrixSRC);
+void	MatrixFloat2Fix(s32* matrixDST, const float* matrixSRC);
+
+FORCEINLINE void MatrixMultVec4x4_M2(const s32* matrix, s32* vecPtr)
+{
+	MatrixMultVec4x4(matrix + 16, vecPtr);
+	MatrixMultVec4x4(matrix, vecPtr);
+}
+
 //these functions are an unreliable, inaccurate floor.
 //it should only be used for positive numbers
 //this isnt as fast as it could be if we used a visual c++ intrinsic, but those appear not to be universally available
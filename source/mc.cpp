@@ -32,6 +32,10 @@
 #include "path.h"
 #include "utils/advanscene.h"
 
+#ifdef PSP
+#include <pspthreadman.h>
+#endif
+
 //#define _DONT_SAVE_BACKUP
 //#define _MCLOG
 
@@ -119,6 +123,134 @@ void backup_setManualBackupType(int type)
 	CommonSettings.manualBackupType = type;
 }
 
+//--------------save file writer
+
+//the one write in flight. the emulation thread only fills it in while the writer is idle
+static std::string backup_writeName;
+static std::vector<u8> backup_writeData;
+static volatile bool backup_writerBusy = false;
+static volatile bool backup_writerQuit = false;
+
+//replaces the file through a temporary one, so a write cut short never costs the old save
+static bool BACKUP_WriteFile(const std::string &fname, const std::vector<u8> &data)
+{
+	const std::string tmpName = fname + ".tmp";
+
+	FILE *fp = fopen(tmpName.c_str(), "wb");
+	if (!fp) return false;
+	bool ok = data.empty() || (fwrite(&data[0], 1, data.size(), fp) == data.size());
+	ok = (fclose(fp) == 0) && ok;
+
+	if (ok) ok = replaceFile(tmpName, fname);
+	if (!ok) remove(tmpName.c_str());
+	return ok;
+}
+
+#ifdef PSP
+static SceUID backup_writerThread = -1;
+static SceUID backup_writerWake = -1;
+
+static int BACKUP_WriterMain(SceSize args, void *argp)
+{
+	for (;;)
+	{
+		sceKernelWaitSema(backup_writerWake, 1, NULL);
+		if (backup_writerQuit) break;
+		BACKUP_WriteFile(backup_writeName, backup_writeData);
+		backup_writerBusy = false;
+	}
+	return 0;
+}
+
+//started with the first flush, and kept from then on
+static bool BACKUP_StartWriter()
+{
+	if (backup_writerThread >= 0) return true;
+
+	backup_writerQuit = false;
+	backup_writerWake = sceKernelCreateSema("backup_wake", 0, 0, 1, NULL);
+	//below the emulation and the spu thread, so the writing only gets the time they leave over
+	backup_writerThread = sceKernelCreateThread("backup_Thread", BACKUP_WriterMain, 0x30, 0x4000, PSP_THREAD_ATTR_USER, NULL);
+
+	if (backup_writerWake < 0 || backup_writerThread < 0 || sceKernelStartThread(backup_writerThread, 0, NULL) < 0)
+	{
+		if (backup_writerThread >= 0) sceKernelDeleteThread(backup_writerThread);
+		if (backup_writerWake >= 0) sceKernelDeleteSema(backup_writerWake);
+		backup_writerThread = backup_writerWake = -1;
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+static void BACKUP_WaitWriter()
+{
+#ifdef PSP
+	while (backup_writerBusy)
+		sceKernelDelayThread(1000);
+#endif
+}
+
+void backup_stopWriter()
+{
+	BACKUP_WaitWriter();
+#ifdef PSP
+	if (backup_writerThread < 0) return;
+
+	backup_writerQuit = true;
+	sceKernelSignalSema(backup_writerWake, 1);
+	sceKernelWaitThreadEnd(backup_writerThread, NULL);
+	sceKernelDeleteThread(backup_writerThread);
+	sceKernelDeleteSema(backup_writerWake);
+	backup_writerThread = backup_writerWake = -1;
+#endif
+}
+
+//hands the whole save memory to the writer. with wait, or without a writer thread, it is written right here
+void BackupDevice::flush(bool wait)
+{
+	//even with nothing new to write, the caller may be about to reopen or remove the file the writer is replacing
+	if (wait) BACKUP_WaitWriter();
+
+#ifdef _DONT_SAVE_BACKUP
+	dirty = false;
+#endif
+	if (!dirty || isMovieMode || !fileWritable) return;
+	if (backup_writerBusy) return;
+
+	backup_writeName = filename;
+	backup_writeData.resize(fpMC->size());
+	u32 pos = fpMC->ftell();
+	fpMC->fseek(0, SEEK_SET);
+	if (backup_writeData.size() != 0)
+		fpMC->fread((char *)&backup_writeData[0], backup_writeData.size());
+	fpMC->fseek(pos, SEEK_SET);
+
+	dirty = false;
+	flushRequested = false;
+
+#ifdef PSP
+	if (!wait && BACKUP_StartWriter())
+	{
+		backup_writerBusy = true;
+		sceKernelSignalSema(backup_writerWake, 1);
+		return;
+	}
+#endif
+
+	BACKUP_WriteFile(backup_writeName, backup_writeData);
+}
+
+void BackupDevice::flushIfIdle()
+{
+	if (!dirty) return;
+
+	framesSinceWrite++;
+	if (flushRequested || (CommonSettings.backupFlushFrames != 0 && framesSinceWrite >= CommonSettings.backupFlushFrames))
+		flush(false);
+}
+
 bool BackupDevice::save_state(EMUFILE* os)
 {
 	u32 savePos = fpMC->ftell();
@@ -199,6 +331,7 @@ bool BackupDevice::load_state(EMUFILE* is)
 	if(data.size()!=0)
 		fpMC->fwrite((char *)&data[0], fsize);
 	ensure(data.size(), 0, fpMC);
+	markDirty();
 #endif
 
 	if(version>=5)
@@ -219,6 +352,10 @@ BackupDevice::BackupDevice()
 	fsize = 0;
 	addr_size = 0;
 	isMovieMode = false;
+	fileWritable = false;
+	dirty = false;
+	flushRequested = false;
+	framesSinceWrite = 0;
 
 	//default for most games; will be altered where appropriate
 	//usually 0xFF, but occasionally others. If these exceptions could be related to a particular backup memory type, that would be helpful.
@@ -242,6 +379,10 @@ BackupDevice::BackupDevice()
 	filename = std::string(buf) + ".dsv";
 
 	//MCLOG("MC: %s\n", filename.c_str());
+
+	//a write of the last device may still be replacing the file, or may have been cut short by a crash
+	BACKUP_WaitWriter();
+	recoverReplacedFile(filename);
 	
 	bool fexists = (access(filename.c_str(), 0) == 0)?true:false;
 
@@ -344,22 +485,28 @@ BackupDevice::BackupDevice()
 		delete fpTmp;
 	}
 
-	fpMC = new EMUFILE_FILE(filename, fexists?"rb+":"wb+");
+	//the file is only read here. from now on the save memory is worked on in memory, and written back by flush()
+	EMUFILE_FILE *fpFile = new EMUFILE_FILE(filename, fexists?"rb+":"wb+");
 
-	const bool fileCanReadWrite = (fpMC->get_fp() != NULL);
-	if (!fileCanReadWrite)
+	fileWritable = (fpFile->get_fp() != NULL);
+	if (fileWritable)
+		fpMC = fpFile->memwrap();
+	else
 	{
-		delete fpMC;
 		fpMC = new EMUFILE_MEMORY();
 		//printf("BackupDevice: WARNING! Failed to get read/write access to the save file! Will operate in RAM instead.\n");
 		
 	}
+	delete fpFile;
 
 	if (!fpMC->fail())
 	{
 		fsize = fpMC->size();
 		if (fsize < saveSizes[0])
+		{
 			fpMC->truncate(0);
+			markDirty();
+		}
 
 		if (readFooter() == 0)
 			fsize -= (strlen(kDesmumeSaveCookie) + strlen(DESMUME_BACKUP_FOOTER_TXT) + 24);
@@ -386,6 +533,7 @@ BackupDevice::BackupDevice()
 						info.size = adv_size;
 						fpMC->truncate(adv_size);
 						ensure(adv_size, 0, fpMC);
+						markDirty();
 					}
 					else
 						if (info.size < adv_size)
@@ -431,6 +579,8 @@ BackupDevice::BackupDevice()
 
 BackupDevice::~BackupDevice()
 {
+	//whatever hasnt reached the file yet does now
+	if (fpMC) flush(true);
 	delete fpMC;
 	fpMC = NULL;
 }
@@ -547,24 +697,28 @@ bool  BackupDevice::write(u8 val)
 	//never use save files if we are in movie mode
 	if (isMovieMode) return true;
 
+	markDirty();
 	return (fpMC->fwrite(&val, 1) == 1);
 }
 
 void BackupDevice::writeByte(u32 addr, u8 val)
 {
 	if (isMovieMode) return;
+	markDirty();
 	fpMC->fseek(addr, SEEK_SET);
 	fpMC->write8le(val);
 }
 void BackupDevice::writeWord(u32 addr, u16 val)
 {
 	if (isMovieMode) return;
+	markDirty();
 	fpMC->fseek(addr, SEEK_SET);
 	fpMC->write16le(val);
 }
 void BackupDevice::writeLong(u32 addr, u32 val)
 {
 	if (isMovieMode) return;
+	markDirty();
 	fpMC->fseek(addr, SEEK_SET);
 	fpMC->write32le(val);
 }
@@ -572,16 +726,19 @@ void BackupDevice::writeLong(u32 addr, u32 val)
 void BackupDevice::writeByte(u8 val)
 {
 	if (isMovieMode) return;
+	markDirty();
 	fpMC->write8le(val);
 }
 void BackupDevice::writeWord(u16 val)
 {
 	if (isMovieMode) return;
+	markDirty();
 	fpMC->write16le(val);
 }
 void BackupDevice::writeLong(u32 val)
 {
 	if (isMovieMode) return;
+	markDirty();
 	fpMC->write32le(val);
 }
 
@@ -592,7 +749,7 @@ void BackupDevice::seek(u32 pos)
 
 void BackupDevice::flushBackup()
 {
-	fpMC->fflush();
+	flushRequested = true;
 }
 
 bool BackupDevice::saveBuffer(u8 *data, u32 size, bool _rewind, bool _truncate)
@@ -606,6 +763,7 @@ bool BackupDevice::saveBuffer(u8 *data, u32 size, bool _rewind, bool _truncate)
 	fsize = size;
 	fpMC->fwrite(data, size);
 	ensure(size, 0, fpMC);
+	markDirty();
 	return true;
 }
 
@@ -645,7 +803,7 @@ void BackupDevice::reset()
 
 void BackupDevice::close_rom()
 {
-	fpMC->fflush();
+	flush(true);
 	delete fpMC;
 	fpMC = NULL;
 }
@@ -723,8 +881,9 @@ void BackupDevice::checkReset()
 	{
 		//printf("MC  : reset command\n");
 
+		//the card was deselected, so the write is done with
 		if(com == BM_CMD_WRITELOW || com == BM_CMD_WRITEHIGH)
-			fpMC->fflush();
+			flushRequested = true;
 		
 		com = 0;
 		reset_command_state = false;
@@ -955,6 +1114,7 @@ void BackupDevice::ensureReal(u32 addr, u8 val, int inReset, EMUFILE *fpOut)
 	if (!fpOut && (addr < fsize)) return;
     
 	EMUFILE *fp = fpOut?fpOut:fpMC;
+	if (fp == fpMC) markDirty();
     
 #ifndef _DONT_SAVE_BACKUP
 	fp->fseek(fsize, SEEK_SET);
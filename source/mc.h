@@ -86,7 +86,11 @@ public:
 
 	void seek(u32 pos);
 
+	//the save memory is kept in memory, and goes to the file as a whole through a background writer.
+	//flushBackup asks for that at the next vblank; flushIfIdle is called at every vblank, and also flushes
+	//once nothing has been written for CommonSettings.backupFlushFrames
 	void flushBackup();
+	void flushIfIdle();
 	
 	u8 searchFileSaveType(u32 size);
 
@@ -147,6 +151,13 @@ private:
 	EMUFILE *fpMC;
 	std::string filename;
 	u32	fsize;
+
+	bool fileWritable;
+	bool dirty;
+	bool flushRequested;
+	u32 framesSinceWrite;
+	void markDirty() { dirty = true; framesSinceWrite = 0; }
+	void flush(bool wait);
 	int readFooter();
 	bool write(u8 val);
 	u8	read();
@@ -186,6 +197,8 @@ private:
 
 void backup_setManualBackupType(int type);
 void backup_forceManualBackupType();
+//waits for the save file writer and ends its thread; the next flush starts it again
+void backup_stopWriter();
 
 struct SAVE_TYPE
 {
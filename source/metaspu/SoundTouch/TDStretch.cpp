@@ -195,6 +195,19 @@ void TDStretch::getParameters(int *pSampleRate, int *pSequenceMs, int *pSeekWind
 void TDStretch::overlapMono(SAMPLETYPE *pOutput, const SAMPLETYPE *pInput) const
 {
     int i;
+#ifdef SOUNDTOUCH_FLOAT_SAMPLES
+    // same ramp as overlapStereo; multiplying by the step saves a divide per sample
+    const float fScale = 1.0f / (float)overlapLength;
+    float f1 = 0;
+    float f2 = 1.0f;
+
+    for (i = 0; i < overlapLength ; i ++) 
+    {
+        pOutput[i] = pInput[i] * f1 + pMidBuffer[i] * f2;
+        f1 += fScale;
+        f2 -= fScale;
+    }
+#else
     SAMPLETYPE m1, m2;
 
     m1 = (SAMPLETYPE)0;
@@ -206,6 +219,7 @@ void TDStretch::overlapMono(SAMPLETYPE *pOutput, const SAMPLETYPE *pInput) const
         m1 += 1;
         m2 -= 1;
     }
+#endif
 }
 
 
@@ -286,22 +300,32 @@ inline void TDStretch::overlap(SAMPLETYPE *pOutput, const SAMPLETYPE *pInput, ui
 int TDStretch::seekBestOverlapPositionFull(const SAMPLETYPE *refPos) 
 {
     int bestOffs;
-    double bestCorr, corr;
+    float bestCorr, corr;
+    float norm;
     int i;
 
+    // the scan is done in single precision, which the PSP has in hardware, rather than in double
     bestCorr = FLT_MIN;
     bestOffs = 0;
+    const float seekScale = 1.0f / (float)seekLength;
 
     // Scans for the best correlation value by testing each possible position
-    // over the permitted range.
+    // over the permitted range. Neighbouring positions share all but one sample
+    // frame of their normalizer, so it is carried over from one to the next. In
+    // single precision the running sum drifts, so it is calculated in full again
+    // every NORM_RESYNC positions.
+    const int NORM_RESYNC = 16;
     for (i = 0; i < seekLength; i ++) 
     {
         // Calculates correlation value for the mixing position corresponding
         // to 'i'
-        corr = calcCrossCorr(refPos + channels * i, pMidBuffer);
+        if ((i % NORM_RESYNC) == 0)
+            corr = (float)calcCrossCorr(refPos + channels * i, pMidBuffer, norm);
+        else
+            corr = (float)calcCrossCorrAccumulate(refPos + channels * i, pMidBuffer, norm);
         // heuristic rule to slightly favour values close to mid of the range
-        double tmp = (double)(2 * i - seekLength) / (double)seekLength;
-        corr = ((corr + 0.1) * (1.0 - 0.25 * tmp * tmp));
+        float tmp = (float)(2 * i - seekLength) * seekScale;
+        corr = ((corr + 0.1f) * (1.0f - 0.25f * tmp * tmp));
 
         // Checks for the highest correlation value
         if (corr > bestCorr) 
@@ -327,8 +351,9 @@ int TDStretch::seekBestOverlapPositionQuick(const SAMPLETYPE *refPos)
 {
     int j;
     int bestOffs;
-    double bestCorr, corr;
+    float bestCorr, corr;
     int scanCount, corrOffset, tempOffset;
+    const float seekScale = 1.0f / (float)seekLength;
 
     bestCorr = FLT_MIN;
     bestOffs = _scanOffsets[0][0];
@@ -351,10 +376,10 @@ int TDStretch::seekBestOverlapPositionQuick(const SAMPLETYPE *refPos)
 
             // Calculates correlation value for the mixing position corresponding
             // to 'tempOffset'
-            corr = (double)calcCrossCorr(refPos + channels * tempOffset, pMidBuffer);
+            corr = (float)calcCrossCorr(refPos + channels * tempOffset, pMidBuffer);
             // heuristic rule to slightly favour values close to mid of the range
-            double tmp = (double)(2 * tempOffset - seekLength) / seekLength;
-            corr = ((corr + 0.1) * (1.0 - 0.25 * tmp * tmp));
+            float tmp = (float)(2 * tempOffset - seekLength) * seekScale;
+            corr = ((corr + 0.1f) * (1.0f - 0.25f * tmp * tmp));
 
             // Checks for the highest correlation value
             if (corr > bestCorr) 
@@ -729,6 +754,20 @@ double TDStretch::calcCrossCorr(const short *mixingPos, const short *compare) co
     return (double)corr / sqrt((double)norm);
 }
 
+
+// the shifted integer sums dont split per sample, so just calculate them in full
+double TDStretch::calcCrossCorr(const short *mixingPos, const short *compare, float &norm) const
+{
+    norm = 0;
+    return calcCrossCorr(mixingPos, compare);
+}
+
+
+double TDStretch::calcCrossCorrAccumulate(const short *mixingPos, const short *compare, float &norm) const
+{
+    return calcCrossCorr(mixingPos, compare);
+}
+
 #endif // SOUNDTOUCH_INTEGER_SAMPLES
 
 //////////////////////////////////////////////////////////////////////////////
@@ -778,33 +817,59 @@ void TDStretch::calculateOverlapLength(int overlapInMsec)
 }
 
 
+// Sums the products of the two sequences in four independent single precision lanes.
+// double is emulated in software on the PSP, and the separate lanes keep the FPU
+// pipeline busy instead of waiting on one running sum.
+static inline float _dotProduct(const float *a, const float *b, int count)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < count; i += 4) 
+    {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+
 double TDStretch::calcCrossCorr(const float *mixingPos, const float *compare) const
 {
-    double corr;
-    double norm;
-    int i;
+    float norm;
+    return calcCrossCorr(mixingPos, compare, norm);
+}
 
-    corr = norm = 0;
-    // Same routine for stereo and mono. For Stereo, unroll by factor of 2.
-    // For mono it's same routine yet unrollsd by factor of 4.
-    for (i = 0; i < channels * overlapLength; i += 4) 
-    {
-        corr += mixingPos[i] * compare[i] +
-                mixingPos[i + 1] * compare[i + 1];
 
-        norm += mixingPos[i] * mixingPos[i] + 
-                mixingPos[i + 1] * mixingPos[i + 1];
+double TDStretch::calcCrossCorr(const float *mixingPos, const float *compare, float &norm) const
+{
+    // Same routine for stereo and mono; overlapLength is a multiple of 8
+    const int count = channels * overlapLength;
+    const float corr = _dotProduct(mixingPos, compare, count);
+    norm = _dotProduct(mixingPos, mixingPos, count);
 
-        // unroll the loop for better CPU efficiency:
-        corr += mixingPos[i + 2] * compare[i + 2] +
-                mixingPos[i + 3] * compare[i + 3];
+    const float div = (norm < 1e-9f) ? 1.0f : norm;    // to avoid div by zero
+    return corr / sqrtf(div);
+}
 
-        norm += mixingPos[i + 2] * mixingPos[i + 2] +
-                mixingPos[i + 3] * mixingPos[i + 3];
-    }
 
-    if (norm < 1e-9) norm = 1.0;    // to avoid div by zero
-    return corr / sqrt(norm);
+double TDStretch::calcCrossCorrAccumulate(const float *mixingPos, const float *compare, float &norm) const
+{
+    const int count = channels * overlapLength;
+    int i;
+
+    // drop the sample frame that the window just moved past from the normalizer...
+    for (i = 1; i <= channels; i ++)
+        norm -= mixingPos[-i] * mixingPos[-i];
+
+    // ...and add the one it moved onto
+    for (i = count - channels; i < count; i ++)
+        norm += mixingPos[i] * mixingPos[i];
+
+    const float corr = _dotProduct(mixingPos, compare, count);
+
+    const float div = (norm < 1e-9f) ? 1.0f : norm;    // to avoid div by zero
+    return corr / sqrtf(div);
 }
 
 #endif // SOUNDTOUCH_FLOAT_SAMPLES
@@ -140,6 +140,11 @@ protected:
     void calculateOverlapLength(int overlapMs);
 
     virtual double calcCrossCorr(const SAMPLETYPE *mixingPos, const SAMPLETYPE *compare) const;
+    /// As above, also returning the normalizer for use by calcCrossCorrAccumulate.
+    virtual double calcCrossCorr(const SAMPLETYPE *mixingPos, const SAMPLETYPE *compare, float &norm) const;
+    /// Same as calcCrossCorr, but for the position right after the previous one: 'norm' 
+    /// holds the previous position's normalizer and is updated instead of recalculated.
+    virtual double calcCrossCorrAccumulate(const SAMPLETYPE *mixingPos, const SAMPLETYPE *compare, float &norm) const;
 
     virtual int seekBestOverlapPositionFull(const SAMPLETYPE *refPos);
     virtual int seekBestOverlapPositionQuick(const SAMPLETYPE *refPos);
@@ -506,12 +506,28 @@ public:
 #endif
 
 
+void RingSynchronizer::enqueue_samples(s16* buf, int samples_provided)
+{
+	const u32 pushed = ring.push((const StereoSample*)buf, samples_provided);
+	if(pushed < (u32)samples_provided)
+		overruns += samples_provided - pushed;
+}
+
+int RingSynchronizer::output_samples(s16* buf, int samples_requested)
+{
+	const u32 popped = ring.pop((StereoSample*)buf, samples_requested);
+	if(popped < (u32)samples_requested)
+		underruns += samples_requested - popped;
+	return popped;
+}
+
 ISynchronizingAudioBuffer* metaspu_construct(ESynchMethod method)
 {
 	switch(method)
 	{
 	case ESynchMethod_N: return new NitsujaSynchronizer();
 	case ESynchMethod_Z: return new ZeromusSynchronizer();
+	case ESynchMethod_R: return new RingSynchronizer();
 #if defined(_MSC_VER) || defined(HAVE_LIBSOUNDTOUCH) || defined(DESMUME_COCOA) || defined(DESMUME_QT)
 	case ESynchMethod_P: return new PCSX2Synchronizer();
 #endif
@@ -27,6 +27,7 @@
 #include <algorithm>
 
 #include "../types.h"
+#include "../utils/ringbuffer.h"
 
 template< typename T >
 static FORCEINLINE void Clampify( T& src, T min, T max )
@@ -60,6 +61,28 @@ enum ESynchMethod
 	ESynchMethod_N, //nitsuja's
 	ESynchMethod_Z, //zero's
 	ESynchMethod_P, //PCSX2 spu2-x
+	ESynchMethod_R, //lock-free ring, no resampling
+};
+
+//passes samples straight through a fixed size ring, for a producer and a consumer on different threads.
+//nothing is allocated or locked once it is constructed. when the ring is full, new samples are dropped;
+//when it runs dry, fewer samples are returned. both are counted, in stereo samples
+class RingSynchronizer : public ISynchronizingAudioBuffer
+{
+public:
+	RingSynchronizer() : overruns(0), underruns(0) {}
+
+	virtual void enqueue_samples(s16* buf, int samples_provided);
+	virtual int output_samples(s16* buf, int samples_requested);
+
+	u32 queued() const { return ring.size(); }
+
+	volatile u32 overruns;
+	volatile u32 underruns;
+
+private:
+	struct StereoSample { s16 l, r; };
+	SPSCRing<StereoSample,8192> ring;
 };
 
 ISynchronizingAudioBuffer* metaspu_construct(ESynchMethod method);
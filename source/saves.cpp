@@ -22,12 +22,19 @@
 #include <zlib.h>
 //#endif
 #include <stack>
+#include <deque>
 #include <set>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <fstream>
+#include <new>
+#include <string>
+
+#ifdef PSP
+#include <pspthreadman.h>
+#endif
 
 #include "common.h"
 #include "armcpu.h"
@@ -53,6 +60,7 @@
 #include "wifi.h"
 
 #include "path.h"
+#include "statehash.h"
 
 
 int lastSaveState = 0;		//Keeps track of last savestate used for quick save/load functions
@@ -181,6 +189,16 @@ SFORMAT SF_MEM[]={
 	{ 0 }
 };
 
+//the rewind buffer follows main memory and the LCDC vram by page, so its snapshots leave them out
+static SFORMAT SF_MEM_REWIND[]={
+	{ "ITCM", 1, sizeof(MMU.ARM9_ITCM),   MMU.ARM9_ITCM},
+	{ "DTCM", 1, sizeof(MMU.ARM9_DTCM),   MMU.ARM9_DTCM},
+	{ "9REG", 1, 0x2000,   MMU.ARM9_REG},
+	{ "VMEM", 1, sizeof(MMU.ARM9_VMEM),    MMU.ARM9_VMEM},
+	{ "OAMS", 1, sizeof(MMU.ARM9_OAM),    MMU.ARM9_OAM},
+	{ 0 }
+};
+
 SFORMAT SF_NDS[]={
 	{ "_WCY", 4, 1, &nds.wifiCycle},
 	{ "_TCY", 8, 8, nds.timerCycle},
@@ -666,12 +684,16 @@ void scan_savestates()
 
   clear_savestates();
 
+  //a slot being replaced right now isnt missing
+  savestate_asyncWait();
+
   for(int i = 0; i < NB_STATES; i++ )
     {
      path.getpathnoext(path.STATES, filename);
 	  
 	  if (strlen(filename) + strlen(".dst") + strlen("-2147483648") /* = biggest string for i */ >MAX_PATH) return ;
       sprintf(filename+strlen(filename), ".ds%d", i);
+      recoverReplacedFile(filename);
       if( stat(filename,&sbuf) == -1 ) continue;
       savestates[i].exists = TRUE;
       strncpy(savestates[i].date, format_time(sbuf.st_mtime),40);
@@ -681,9 +703,23 @@ void scan_savestates()
   return ;
 }
 
-void savestate_slot(int num)
+//the slot list gets the new date once the file is really there
+static void savestate_slotDone(const char *file_name, bool ok, int num)
 {
    struct stat sbuf;
+
+   if (!ok || num < 0 || num >= NB_STATES) return;
+
+   if (stat(file_name,&sbuf) != -1)
+   {
+	   savestates[num].exists = TRUE;
+	   strncpy(savestates[num].date, format_time(sbuf.st_mtime),40);
+	   savestates[num].date[40-1] = '\0';
+   }
+}
+
+void savestate_slot(int num)
+{
    char filename[MAX_PATH+1];
 
 	lastSaveState = num;		//Set last savestate used
@@ -693,18 +729,7 @@ void savestate_slot(int num)
    if (strlen(filename) + strlen(".dsx") + strlen("-2147483648") /* = biggest string for num */ >MAX_PATH) return ;
    sprintf(filename+strlen(filename), ".ds%d", num);
 
-   if (!savestate_save(filename))
-	   return;
-
-   if (num >= 0 && num < NB_STATES)
-   {
-	   if (stat(filename,&sbuf) != -1)
-	   {
-		   savestates[num].exists = TRUE;
-		   strncpy(savestates[num].date, format_time(sbuf.st_mtime),40);
-		   savestates[num].date[40-1] = '\0';
-	   }
-   }
+   savestate_saveAsync(filename, savestate_slotDone, num);
 }
 
 void loadstate_slot(int num)
@@ -759,8 +784,65 @@ static const SFORMAT *CheckS(const SFORMAT *guessSF, const SFORMAT *firstSF, u32
 	return 0;
 }
 
+//a hash of the descriptors of one SFORMAT table, built the first time a state is loaded into it.
+//slots hold the index of the entry plus one, 0 being empty
+#define SFINDEX_BITS 8
+#define SFINDEX_SLOTS (1<<SFINDEX_BITS)
+
+struct SFORMAT_Index
+{
+	const SFORMAT *table;
+	bool built;
+	u16 slots[SFINDEX_SLOTS];
+};
+
+static u32 SFINDEX_Hash(const char *desc)
+{
+	u32 tag;
+	memcpy(&tag,desc,4);
+	return (tag * 2654435761U) >> (32 - SFINDEX_BITS);
+}
+
+static void SFINDEX_Build(SFORMAT_Index &index)
+{
+	memset(index.slots,0,sizeof(index.slots));
+	for(u32 i=0;index.table[i].v && i<SFINDEX_SLOTS-1;i++)
+	{
+		u32 h = SFINDEX_Hash(index.table[i].desc);
+		while(index.slots[h]) h = (h+1) & (SFINDEX_SLOTS-1);
+		index.slots[h] = i+1;
+	}
+	index.built = true;
+}
 
-static bool ReadStateChunk(EMUFILE* is, const SFORMAT *sf, int size)
+static const SFORMAT *SFINDEX_Find(SFORMAT_Index &index, u32 size, u32 count, char *desc)
+{
+	if(!index.built) SFINDEX_Build(index);
+
+	for(u32 h = SFINDEX_Hash(desc); index.slots[h]; h = (h+1) & (SFINDEX_SLOTS-1))
+	{
+		const SFORMAT *sf = &index.table[index.slots[h]-1];
+		if(!memcmp(desc,sf->desc,4))
+		{
+			if(sf->size != size || sf->count != count)
+				return 0;
+			return sf;
+		}
+	}
+	return 0;
+}
+
+static SFORMAT_Index sfindex_ARM9 = { SF_ARM9 };
+static SFORMAT_Index sfindex_ARM7 = { SF_ARM7 };
+static SFORMAT_Index sfindex_MEM = { SF_MEM };
+static SFORMAT_Index sfindex_NDS = { SF_NDS };
+static SFORMAT_Index sfindex_MMU = { SF_MMU };
+static SFORMAT_Index sfindex_GFX3D = { SF_GFX3D };
+static SFORMAT_Index sfindex_WIFI = { SF_WIFI };
+static SFORMAT_Index sfindex_RTC = { SF_RTC };
+
+//tables without an index (built on the stack for one load) are searched through with CheckS
+static bool ReadStateChunk(EMUFILE* is, const SFORMAT *sf, int size, SFORMAT_Index *index = NULL)
 {
 	const SFORMAT *tmp = NULL;
 	const SFORMAT *guessSF = NULL;
@@ -778,7 +860,7 @@ static bool ReadStateChunk(EMUFILE* is, const SFORMAT *sf, int size)
 		if(!read32le(&sz,is)) return false;
 		if(!read32le(&count,is)) return false;
 
-		if((tmp=CheckS(guessSF,sf,sz,count,toa)))
+		if((tmp = index ? SFINDEX_Find(*index,sz,count,toa) : CheckS(guessSF,sf,sz,count,toa)))
 		{
 		#ifdef LOCAL_LE
 			// no need to ever loop one at a time if not flipping byte order
@@ -942,124 +1024,435 @@ static void savestate_WriteChunk(EMUFILE* os, int type, void (*saveproc)(EMUFILE
 */
 }
 
-static void writechunks(EMUFILE* os);
+//the chunks of a savestate in order, for whatever T does with them:
+//T::chunk(type, sformat), T::chunk(type, saveproc) and T::end()
+template<typename T> static void enumchunks(T &out, const SFORMAT *sfMem)
+{
+	//DateTime tm = DateTime::get_Now();
+	svn_rev = 11;
 
-bool savestate_save(EMUFILE* outstream, int compressionLevel)
+	//save_time = tm.get_Ticks();
+
+	out.chunk(1,SF_ARM9);
+	out.chunk(2,SF_ARM7);
+	out.chunk(3,cp15_savestate);
+	out.chunk(4,sfMem);
+	out.chunk(5,SF_NDS);
+	out.chunk(51,nds_savestate);
+	out.chunk(60,SF_MMU);
+	out.chunk(61,mmu_savestate);
+	out.chunk(7,gpu_savestate);
+	out.chunk(8,spu_savestate);
+	out.chunk(81,mic_savestate);
+	out.chunk(90,SF_GFX3D);
+	out.chunk(91,gfx3d_savestate);
+	//out.chunk(100,SF_MOVIE);
+	//out.chunk(101,mov_savestate);
+	out.chunk(110,SF_WIFI);
+	out.chunk(120,SF_RTC);
+	out.chunk(130,SF_NDS_INFO);
+	out.chunk(140,s_slot1_savestate);
+	out.chunk(150,s_slot2_savestate);
+	// reserved for future versions
+	out.chunk(160,reserveChunks);
+	out.chunk(170,reserveChunks);
+	out.chunk(180,reserveChunks);
+	// ============================
+	out.end();
+}
+
+struct ChunkWriter
 {
-#ifdef HAVE_JIT 
-	arm_jit_sync();
-#endif
-	#ifndef HAVE_LIBZ
-	//compressionLevel = Z_NO_COMPRESSION;
-	#endif
+	EMUFILE *os;
+	void chunk(int type, const SFORMAT *sf) { savestate_WriteChunk(os,type,sf); }
+	void chunk(int type, void (*saveproc)(EMUFILE* os)) { savestate_WriteChunk(os,type,saveproc); }
+	void end() { savestate_WriteChunk(os,0xFFFFFFFF,(SFORMAT*)0); }
+};
 
-	EMUFILE_MEMORY ms;
-	EMUFILE* os;
-	
-	if(compressionLevel != Z_NO_COMPRESSION)
+static void writechunks(EMUFILE* os, const SFORMAT *sfMem = SF_MEM)
+{
+	ChunkWriter writer = { os };
+	enumchunks(writer, sfMem);
+}
+
+//lays a savestate out as a list of spans without copying it together: the SFORMAT arrays are referenced
+//where they are, and only their headers and the chunks written by save procs go through a scratch buffer.
+//both are kept from one savestate to the next, so once they have grown there is nothing left to allocate
+class ChunkGatherer
+{
+	struct Span
+	{
+		const u8 *ptr;		//NULL for a span of the scratch buffer
+		u32 ofs;
+		u32 len;
+	};
+
+	std::vector<Span> spans;
+	std::vector<u8> scratchBuf;
+	EMUFILE_MEMORY *scratch;
+	u32 scratchStart;		//what of the scratch buffer isnt in a span yet
+
+	void closeScratch()
 	{
-		//generate the savestate in memory first
-		os = (EMUFILE*)&ms;
-		writechunks(os);
+		const u32 end = scratch->size();
+		if(end == scratchStart) return;
+		Span span = { NULL, scratchStart, end - scratchStart };
+		spans.push_back(span);
+		size += span.len;
+		scratchStart = end;
 	}
-	else
+
+	void reference(const void *ptr, u32 len)
 	{
-		os = outstream;
-		os->fseek(32,SEEK_SET); //skip the header
-		writechunks(os);
+		if(len == 0) return;
+		closeScratch();
+		Span span = { (const u8*)ptr, 0, len };
+		spans.push_back(span);
+		size += len;
 	}
 
-	//save the length of the file
-	u32 len = os->ftell();
+public:
+	u32 size;
 
-	u32 comprlen = 0xFFFFFFFF;
-	u8* cbuf;
+	ChunkGatherer() : scratch(NULL) {}
+	~ChunkGatherer() { delete scratch; }
 
-	//compress the data
-	int error = Z_OK;
-	if(compressionLevel != Z_NO_COMPRESSION)
+	void begin()
 	{
-		cbuf = ms.buf();
-		uLongf comprlen2;
-		//worst case compression.
-		//zlib says "0.1% larger than sourceLen plus 12 bytes"
-		comprlen = (len>>9)+12 + len;
-		cbuf = new u8[comprlen];
-		// Workaround to make it compile under linux 64bit
-		comprlen2 = comprlen;
-		error = compress2(cbuf,&comprlen2,ms.buf(),len,compressionLevel);
-		comprlen = (u32)comprlen2;
+		spans.clear();
+		scratchBuf.clear();
+		delete scratch;
+		scratch = new EMUFILE_MEMORY(&scratchBuf);
+		scratchStart = 0;
+		size = 0;
 	}
 
-	//dump the header
+	u32 count() const { return spans.size(); }
+	u32 length(u32 i) const { return spans[i].len; }
+	const u8* data(u32 i) const { return spans[i].ptr ? spans[i].ptr : &scratchBuf[spans[i].ofs]; }
+
+	//the same bytes as savestate_WriteChunk, less the duplicate key check
+	void chunk(int type, const SFORMAT *sf)
+	{
+		u32 bsize = 0;
+		for(const SFORMAT *it = sf; it->v; it++)
+			bsize += 4 + sizeof(it->size) + sizeof(it->count) + it->size * it->count;
+
+		write32le(type,scratch);
+		write32le(bsize,scratch);
+
+		for(; sf->v; sf++)
+		{
+			scratch->fwrite(sf->desc,4);
+			write32le(sf->size,scratch);
+			write32le(sf->count,scratch);
+
+		#ifdef LOCAL_LE
+			reference(sf->v, sf->size * sf->count);
+		#else
+			if(sf->size == 1)
+				reference(sf->v, sf->count);
+			else
+			{
+				for(u32 i=0;i<sf->count;i++)
+				{
+					FlipByteOrder((u8*)sf->v + i*sf->size, sf->size);
+					scratch->fwrite((char*)sf->v + i*sf->size, sf->size);
+					FlipByteOrder((u8*)sf->v + i*sf->size, sf->size);
+				}
+			}
+		#endif
+		}
+	}
+
+	void chunk(int type, void (*saveproc)(EMUFILE* os))
+	{
+		savestate_WriteChunk(scratch,type,saveproc);
+	}
+
+	void end()
+	{
+		write32le(0xFFFFFFFF,scratch);
+		closeScratch();
+	}
+};
+
+static ChunkGatherer savestate_gatherer;
+
+//deflate output goes to the stream this much at a time
+#define SAVESTATE_DEFLATE_CHUNK 0x10000
+
+//the spans go through deflate one after the other, so the state is never copied together.
+//the output is the same zlib stream compress2 makes. out is SAVESTATE_DEFLATE_CHUNK bytes to deflate into
+template<typename T> static int savestate_deflate(EMUFILE *os, const T &state, int compressionLevel, u32 &comprlen, u8 *out)
+{
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	int error = deflateInit(&zs, compressionLevel);
+	if(error != Z_OK) return error;
+
+	comprlen = 0;
+	for(u32 i = 0; i <= state.count(); i++)
+	{
+		const bool last = (i == state.count());
+		zs.next_in = last ? Z_NULL : (Bytef*)state.data(i);
+		zs.avail_in = last ? 0 : state.length(i);
+
+		do
+		{
+			zs.next_out = out;
+			zs.avail_out = SAVESTATE_DEFLATE_CHUNK;
+			error = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+			if(error == Z_STREAM_ERROR)
+			{
+				deflateEnd(&zs);
+				return error;
+			}
+			const u32 have = SAVESTATE_DEFLATE_CHUNK - zs.avail_out;
+			os->fwrite(out, have);
+			comprlen += have;
+		} while(zs.avail_out == 0);
+	}
+
+	deflateEnd(&zs);
+	return error == Z_STREAM_END ? Z_OK : error;
+}
+
+static void savestate_writeHeader(EMUFILE* outstream, u32 len, u32 comprlen)
+{
 	outstream->fseek(0,SEEK_SET);
 	outstream->fwrite(magic,16);
 	write32le(SAVESTATE_VERSION,outstream);
 	write32le(9,outstream); //desmume version
 	write32le(len,outstream); //uncompressed length
 	write32le(comprlen,outstream); //compressed length (-1 if it is not compressed)
+}
+
+bool savestate_save(EMUFILE* outstream, int compressionLevel)
+{
+#ifdef HAVE_JIT 
+	arm_jit_sync();
+#endif
+	#ifndef HAVE_LIBZ
+	//compressionLevel = Z_NO_COMPRESSION;
+	#endif
+
+	ChunkGatherer &state = savestate_gatherer;
+	state.begin();
+	enumchunks(state, SF_MEM);
 
-	if(compressionLevel != Z_NO_COMPRESSION)
+	if(compressionLevel == Z_NO_COMPRESSION)
 	{
-		outstream->fwrite((char*)cbuf,comprlen==(u32)-1?len:comprlen);
-		delete[] cbuf;
+		//the length counts the header here, as it always has
+		savestate_writeHeader(outstream, 32 + state.size, 0xFFFFFFFF);
+		for(u32 i = 0; i < state.count(); i++)
+			outstream->fwrite(state.data(i), state.length(i));
+		return true;
 	}
 
+	static u8 out[SAVESTATE_DEFLATE_CHUNK];
+
+	//the compressed length isnt known until the end, so it gets filled in then
+	savestate_writeHeader(outstream, state.size, 0);
+	u32 comprlen = 0;
+	const int error = savestate_deflate(outstream, state, compressionLevel, comprlen, out);
+	const u32 end = outstream->ftell();
+	outstream->fseek(28,SEEK_SET);
+	write32le(comprlen,outstream);
+	outstream->fseek(end,SEEK_SET);
+
 	return error == Z_OK;
 }
 
 bool savestate_save (const char *file_name)
 {
-	EMUFILE_MEMORY ms;
-	size_t elems_written;
-//#ifdef HAVE_LIBZ
-	if(!savestate_save(&ms, Z_DEFAULT_COMPRESSION))
-/*#else
-	//if(!savestate_save(&ms, 0))
-#endif*/
+	//the same file may be in flight, and the deflate output chunk isnt shared
+	savestate_asyncWait();
+
+	//straight into the file, and removed again if something went wrong
+	bool ok;
+	{
+		EMUFILE_FILE file(file_name,"wb");
+		if(file.fail()) return false;
+		ok = savestate_save(&file, Z_DEFAULT_COMPRESSION) && !file.fail();
+	}
+	if(!ok) remove(file_name);
+	return ok;
+}
+
+//--------------async saving
+
+//a save in flight: the raw state as it was copied out of the emulator, which the worker deflates into
+//<file>.tmp and renames over <file> at the end, so a save that fails halfway never costs the old state
+struct SavestateAsync
+{
+	std::string fileName;
+	savestate_done_t done;
+	int param;
+	u8 *raw;
+	u32 size;
+	u8 *out;
+	volatile bool finished;
+	bool ok;
+
+	//a single span, for savestate_deflate
+	u32 count() const { return 1; }
+	u32 length(u32 i) const { return size; }
+	const u8* data(u32 i) const { return raw; }
+
+	~SavestateAsync()
+	{
+		delete[] raw;
+		delete[] out;
+	}
+};
+
+static SavestateAsync *savestate_pending = NULL;
+
+static bool savestate_asyncWrite(SavestateAsync &job)
+{
+	const std::string tmpName = job.fileName + ".tmp";
+
+	bool ok;
+	{
+		EMUFILE_FILE file(tmpName,"wb");
+		if(file.fail()) return false;
+
+		savestate_writeHeader(&file, job.size, 0);
+		u32 comprlen = 0;
+		ok = savestate_deflate(&file, job, Z_DEFAULT_COMPRESSION, comprlen, job.out) == Z_OK;
+		file.fseek(28,SEEK_SET);
+		write32le(comprlen,&file);
+		ok = ok && !file.fail();
+	}
+
+	if(ok) ok = replaceFile(tmpName, job.fileName);
+	if(!ok) remove(tmpName.c_str());
+	return ok;
+}
+
+#ifdef PSP
+static SceUID savestate_thread = -1;
+
+static int savestate_threadMain(SceSize args, void *argp)
+{
+	SavestateAsync *job = *(SavestateAsync**)argp;
+	job->ok = savestate_asyncWrite(*job);
+	job->finished = true;
+
+	sceKernelExitThread(0);
+	return 0;
+}
+
+static bool savestate_startThread(SavestateAsync *job)
+{
+	//below the emulation and the spu thread, so the deflating only gets the time they leave over
+	savestate_thread = sceKernelCreateThread("savestate_Thread", savestate_threadMain, 0x30, 0x10000, PSP_THREAD_ATTR_USER, NULL);
+	if(savestate_thread < 0) return false;
+
+	if(sceKernelStartThread(savestate_thread, sizeof(job), &job) < 0)
+	{
+		sceKernelDeleteThread(savestate_thread);
+		savestate_thread = -1;
 		return false;
-	FILE* file = fopen(file_name,"wb");
-	if(file)
+	}
+	return true;
+}
+
+static void savestate_joinThread()
+{
+	if(savestate_thread < 0) return;
+	sceKernelWaitThreadEnd(savestate_thread, NULL);
+	sceKernelDeleteThread(savestate_thread);
+	savestate_thread = -1;
+}
+#else
+//no worker thread here, so the writing happens right away and is reported at the next poll
+static bool savestate_startThread(SavestateAsync *job)
+{
+	job->ok = savestate_asyncWrite(*job);
+	job->finished = true;
+	return true;
+}
+static void savestate_joinThread() {}
+#endif
+
+bool savestate_saveAsync(const char *file_name, savestate_done_t done, int param)
+{
+	savestate_asyncWait();
+
+#ifdef HAVE_JIT 
+	arm_jit_sync();
+#endif
+
+	ChunkGatherer &state = savestate_gatherer;
+	state.begin();
+	enumchunks(state, SF_MEM);
+
+	SavestateAsync *job = new SavestateAsync();
+	job->fileName = file_name;
+	job->done = done;
+	job->param = param;
+	job->size = state.size;
+	job->raw = new (std::nothrow) u8[state.size];
+	job->out = new (std::nothrow) u8[SAVESTATE_DEFLATE_CHUNK];
+	job->finished = false;
+	job->ok = false;
+
+	if(job->raw && job->out)
 	{
-		elems_written = fwrite(ms.buf(),1,ms.size(),file);
-		fclose(file);
-		return (elems_written == ms.size());
-	} else return false;
+		u8 *dst = job->raw;
+		for(u32 i = 0; i < state.count(); i++)
+		{
+			memcpy(dst, state.data(i), state.length(i));
+			dst += state.length(i);
+		}
+
+		if(savestate_startThread(job))
+		{
+			savestate_pending = job;
+			return true;
+		}
+	}
+
+	//no memory for the copy or no thread for the work, so it gets saved the slow way
+	delete job;
+	const bool ok = savestate_save(file_name);
+	if(done) done(file_name, ok, param);
+	return ok;
 }
 
-static void writechunks(EMUFILE* os) {
+bool savestate_asyncPoll()
+{
+	SavestateAsync *job = savestate_pending;
+	if(!job) return false;
+	if(!job->finished) return true;
+
+	savestate_joinThread();
+	savestate_pending = NULL;
+	if(job->done) job->done(job->fileName.c_str(), job->ok, job->param);
+	delete job;
+	return false;
+}
 
-	//DateTime tm = DateTime::get_Now();
-	svn_rev = 11;
+void savestate_asyncWait()
+{
+	if(!savestate_pending) return;
+	savestate_joinThread();
+	savestate_asyncPoll();
+}
 
-	//save_time = tm.get_Ticks();
+void savestate_hash(StateHasher &hasher)
+{
+#ifdef HAVE_JIT 
+	arm_jit_sync();
+#endif
 
-	savestate_WriteChunk(os,1,SF_ARM9);
-	savestate_WriteChunk(os,2,SF_ARM7);
-	savestate_WriteChunk(os,3,cp15_savestate);
-	savestate_WriteChunk(os,4,SF_MEM);
-	savestate_WriteChunk(os,5,SF_NDS);
-	savestate_WriteChunk(os,51,nds_savestate);
-	savestate_WriteChunk(os,60,SF_MMU);
-	savestate_WriteChunk(os,61,mmu_savestate);
-	savestate_WriteChunk(os,7,gpu_savestate);
-	savestate_WriteChunk(os,8,spu_savestate);
-	savestate_WriteChunk(os,81,mic_savestate);
-	savestate_WriteChunk(os,90,SF_GFX3D);
-	savestate_WriteChunk(os,91,gfx3d_savestate);
-	//savestate_WriteChunk(os,100,SF_MOVIE);
-	//savestate_WriteChunk(os,101,mov_savestate);
-	savestate_WriteChunk(os,110,SF_WIFI);
-	savestate_WriteChunk(os,120,SF_RTC);
-	savestate_WriteChunk(os,130,SF_NDS_INFO);
-	savestate_WriteChunk(os,140,s_slot1_savestate);
-	savestate_WriteChunk(os,150,s_slot2_savestate);
-	// reserved for future versions
-	savestate_WriteChunk(os,160,reserveChunks);
-	savestate_WriteChunk(os,170,reserveChunks);
-	savestate_WriteChunk(os,180,reserveChunks);
-	// ============================
-	savestate_WriteChunk(os,0xFFFFFFFF,(SFORMAT*)0);
+	ChunkGatherer &state = savestate_gatherer;
+	state.begin();
+	enumchunks(state, SF_MEM_REWIND);
+	for(u32 i = 0; i < state.count(); i++)
+		hasher.update(state.data(i), state.length(i));
 }
 
 static bool ReadStateChunks(EMUFILE* is, s32 totalsize)
@@ -1095,23 +1488,23 @@ static bool ReadStateChunks(EMUFILE* is, s32 totalsize)
 		if(!read32le(&size,is))  { ret=false; break; }
 		switch(t)
 		{
-			case 1: if(!ReadStateChunk(is,SF_ARM9,size)) ret=false; break;
-			case 2: if(!ReadStateChunk(is,SF_ARM7,size)) ret=false; break;
+			case 1: if(!ReadStateChunk(is,SF_ARM9,size,&sfindex_ARM9)) ret=false; break;
+			case 2: if(!ReadStateChunk(is,SF_ARM7,size,&sfindex_ARM7)) ret=false; break;
 			case 3: if(!cp15_loadstate(is,size)) ret=false; break;
-			case 4: if(!ReadStateChunk(is,SF_MEM,size)) ret=false; break;
-			case 5: if(!ReadStateChunk(is,SF_NDS,size)) ret=false; break;
+			case 4: if(!ReadStateChunk(is,SF_MEM,size,&sfindex_MEM)) ret=false; break;
+			case 5: if(!ReadStateChunk(is,SF_NDS,size,&sfindex_NDS)) ret=false; break;
 			case 51: if(!nds_loadstate(is,size)) ret=false; break;
-			case 60: if(!ReadStateChunk(is,SF_MMU,size)) ret=false; break;
+			case 60: if(!ReadStateChunk(is,SF_MMU,size,&sfindex_MMU)) ret=false; break;
 			case 61: if(!mmu_loadstate(is,size)) ret=false; break;
 			case 7: if(!gpu_loadstate(is,size)) ret=false; break;
 			case 8: if(!spu_loadstate(is,size)) ret=false; break;
 			case 81: if(!mic_loadstate(is,size)) ret=false; break;
-			case 90: if(!ReadStateChunk(is,SF_GFX3D,size)) ret=false; break;
+			case 90: if(!ReadStateChunk(is,SF_GFX3D,size,&sfindex_GFX3D)) ret=false; break;
 			case 91: if(!gfx3d_loadstate(is,size)) ret=false; break;
 			//case 100: if(!ReadStateChunk(is,SF_MOVIE, size)) ret=false; break;
 			//case 101: if(!mov_loadstate(is, size)) ret=false; break;
-			case 110: if(!ReadStateChunk(is,SF_WIFI,size)) ret=false; break;
-			case 120: if(!ReadStateChunk(is,SF_RTC,size)) ret=false; break;
+			case 110: if(!ReadStateChunk(is,SF_WIFI,size,&sfindex_WIFI)) ret=false; break;
+			case 120: if(!ReadStateChunk(is,SF_RTC,size,&sfindex_RTC)) ret=false; break;
 			case 130: if(!ReadStateChunk(is,SF_INFO,size)) ret=false; else haveInfo=true; break;
 			case 140: if(!s_slot1_loadstate(is, size)) ret=false; break;
 			case 150: if(!s_slot2_loadstate(is, size)) ret=false; break;
@@ -1212,14 +1605,21 @@ bool savestate_load(EMUFILE* is)
 
 	if(ssversion != SAVESTATE_VERSION) return false;
 
-	std::vector<u8> buf(len);
+	//an uncompressed state which is already in memory is read from where it is, without a copy.
+	//the buffers are freed again on the way out, there is no room to keep several MB around between loads
+	std::vector<u8> buf;
+	EMUFILE *chunks = NULL;
+
+	if(len < 32) return false;
 
 	if(comprlen != 0xFFFFFFFF) {
 #ifndef HAVE_LIBZ
 		//without libz, we can't decompress this savestate
 		return false;
 #endif
-		std::vector<char> cbuf(comprlen);
+		//the compressed data goes as soon as it is inflated, ahead of the reset and the chunk parsing
+		std::vector<u8> cbuf(comprlen + 1);
+		buf.resize(len);
 		is->fread(&cbuf[0],comprlen);
 		if(is->fail()) return false;
 
@@ -1229,7 +1629,11 @@ bool savestate_load(EMUFILE* is)
 		if(error != Z_OK || uncomprlen != len)
 			return false;
 #endif
+	} else if(!is->get_fp()) {
+		if((u32)(is->size() - is->ftell()) < len - 32) return false;
+		chunks = is;
 	} else {
+		buf.resize(len);
 		is->fread((char*)&buf[0],len-32);
 	}
 
@@ -1255,7 +1659,7 @@ bool savestate_load(EMUFILE* is)
 	//SPU_Reset();
 
 	EMUFILE_MEMORY mstemp(&buf);
-	bool x = ReadStateChunks(&mstemp,(s32)len);
+	bool x = ReadStateChunks(chunks ? chunks : &mstemp,(s32)len);
 
 	if(!x && !SAV_silent_fail_flag)
 	{
@@ -1279,71 +1683,315 @@ bool savestate_load(EMUFILE* is)
 
 bool savestate_load(const char *file_name)
 {
+	//it may be the file still being written
+	savestate_asyncWait();
+	recoverReplacedFile(file_name);
+
 	EMUFILE_FILE f(file_name,"rb");
 	if(f.fail()) return false;
 
 	return savestate_load(&f);
 }
 
-static std::stack<EMUFILE_MEMORY*> rewindFreeList;
-static std::vector<EMUFILE_MEMORY*> rewindbuffer;
+void savestate_save3D(EMUFILE* os)
+{
+	savestate_WriteChunk(os,90,SF_GFX3D);
+	savestate_WriteChunk(os,91,gfx3d_savestate);
+	savestate_WriteChunk(os,0xFFFFFFFF,(SFORMAT*)0);
+}
 
-int rewindstates = 16;
-int rewindinterval = 4;
+bool savestate_load3D(EMUFILE* is)
+{
+	return ReadStateChunks(is,(s32)is->size());
+}
 
-void rewindsave () {
+//--------------rewind
+//
+//the rewind buffer keeps a snapshot every CommonSettings.rewindInterval frames. main memory and the LCDC vram
+//are followed by page through mainmem_dirty_map and vram_dirty_map, against a copy of them as they were at the
+//newest snapshot (rewind_shadow). everything else goes through the regular savestate chunks (without those two),
+//and the newest of those is kept whole (rewind_state).
+//
+//a snapshot stores, for what changed since the one before, the xor of the old and new contents. that goes
+//both ways: rewinding restores the written pages and the state from the copies, then xors the newest delta
+//back into the copies to make them the snapshot before. the deltas are mostly zeroes, so they are run length
+//coded in words, and they sit one after another in a ring of CommonSettings.rewindBufferKB, dropping the oldest
+
+#define REWIND_PAGE_SIZE (1<<MAINMEM_DIRTY_PAGE_SHIFT)
+#define REWIND_PAGES (MAINMEM_DIRTY_PAGES + VRAM_DIRTY_PAGES)
+
+//the most words the run length coding of so many words can take
+#define REWIND_RLE_BOUND(words) ((words) + (words)/0x8000 + 2)
+
+struct RewindEntry
+{
+	u32 offset;		//in rewind_ring
+	u32 size;
+};
 
-	/*if(currFrameCounter % rewindinterval)
-		return;
+static u8 *rewind_shadow = NULL;			//REWIND_PAGES pages: main memory, then vram
+static std::vector<u8> rewind_state;		//the savestate chunks of the newest snapshot
+static std::vector<u8> rewind_newState;
+static u8 *rewind_ring = NULL;
+static u32 rewind_ringSize = 0;
+static u32 rewind_ringHead = 0;
+static std::deque<RewindEntry> rewind_entries;
+static u32 rewind_frameCounter = 0;
 
-	//printf("rewindsave"); printf("%d%s", currFrameCounter, "\n");
+static u8* rewind_page(u32 page)
+{
+	if(page < MAINMEM_DIRTY_PAGES) return MMU.MAIN_MEM + page * REWIND_PAGE_SIZE;
+	return MMU.ARM9_LCD + (page - MAINMEM_DIRTY_PAGES) * REWIND_PAGE_SIZE;
+}
 
-	
-	EMUFILE_MEMORY *ms;
-	if(!rewindFreeList.empty()) {
-		ms = rewindFreeList.top();
-		rewindFreeList.pop();
-	} else {
-		ms = new EMUFILE_MEMORY(1024*1024*12);
+//true if the page was written since the shadow copy was last brought up to date, and forgets it
+static bool rewind_takeDirty(u32 page)
+{
+	if(page < MAINMEM_DIRTY_PAGES)
+	{
+		u8 &flags = mainmem_dirty_map[page];
+		if(!(flags & MAINMEM_DIRTY_REWIND)) return false;
+		flags &= ~MAINMEM_DIRTY_REWIND;
+		return true;
 	}
+	u8 &flags = vram_dirty_map[page - MAINMEM_DIRTY_PAGES];
+	if(!(flags & VRAM_DIRTY_REWIND)) return false;
+	flags &= ~VRAM_DIRTY_REWIND;
+	return true;
+}
 
-	if(!savestate_save(ms, Z_NO_COMPRESSION))
-		return;
+static void rewind_markDirty(u32 page)
+{
+	if(page < MAINMEM_DIRTY_PAGES) mainmem_dirty_map[page] |= MAINMEM_DIRTY_REWIND;
+	else vram_dirty_map[page - MAINMEM_DIRTY_PAGES] |= VRAM_DIRTY_REWIND;
+}
 
-	rewindbuffer.push_back(ms);
-	
-	if((int)rewindbuffer.size() > rewindstates) {
-		delete *rewindbuffer.begin();
-		rewindbuffer.erase(rewindbuffer.begin());
-	}*/
+//writes the xor of cur and old as runs of (zero words, literal words) and brings old up to cur.
+//returns the end of the output
+static u32* rewind_encode(u32 *out, const u32 *cur, u32 *old, u32 words)
+{
+	u32 i = 0;
+	while(i < words)
+	{
+		u32 zeroes = 0, literals = 0;
+		while(i < words && zeroes < 0xFFFF && cur[i] == old[i]) { i++; zeroes++; }
+		u32 *token = out++;
+		while(i < words && literals < 0xFFFF && cur[i] != old[i])
+		{
+			*out++ = cur[i] ^ old[i];
+			old[i] = cur[i];
+			i++; literals++;
+		}
+		*token = zeroes | (literals << 16);
+	}
+	return out;
 }
 
-void dorewind()
+//xors what rewind_encode wrote back into dst. returns the end of the input
+static const u32* rewind_decode(const u32 *in, u32 *dst, u32 words)
 {
-/*	if(currFrameCounter % rewindinterval)
+	u32 i = 0;
+	while(i < words)
+	{
+		const u32 token = *in++;
+		i += token & 0xFFFF;
+		for(u32 n = token >> 16; n; n--)
+			dst[i++] ^= *in++;
+	}
+	return in;
+}
+
+static void rewind_saveState(std::vector<u8> &out)
+{
+	out.clear();
+	EMUFILE_MEMORY ms(&out);
+	writechunks(&ms, SF_MEM_REWIND);
+	out.resize(ms.size());
+	//keep it in whole words, for the xor coding
+	out.resize((out.size() + 3) & ~3, 0);
+}
+
+void rewind_clear()
+{
+	free(rewind_shadow); rewind_shadow = NULL;
+	free(rewind_ring); rewind_ring = NULL;
+	rewind_ringSize = rewind_ringHead = 0;
+	rewind_entries.clear();
+	std::vector<u8>().swap(rewind_state);
+	std::vector<u8>().swap(rewind_newState);
+	rewind_frameCounter = 0;
+}
+
+u32 rewind_count()
+{
+	return rewind_entries.size();
+}
+
+//the start of a contiguous span of size bytes in the ring, after dropping as many of the oldest entries as it takes
+static u8* rewind_reserve(u32 size)
+{
+	if(size > rewind_ringSize) return NULL;
+
+	u32 pos = rewind_ringHead;
+	if(pos + size > rewind_ringSize) pos = 0;
+
+	for(;;)
+	{
+		bool overlaps = false;
+		for(u32 i = 0; i < rewind_entries.size() && !overlaps; i++)
+			overlaps = rewind_entries[i].offset < pos + size && rewind_entries[i].offset + rewind_entries[i].size > pos;
+		if(!overlaps) break;
+		rewind_entries.pop_front();
+	}
+
+	rewind_ringHead = pos;
+	return rewind_ring + pos;
+}
+
+//the oldest snapshot: everything is copied whole and there is nothing to diff against
+static void rewind_rebase()
+{
+	rewind_entries.clear();
+	rewind_ringHead = 0;
+
+	for(u32 page = 0; page < REWIND_PAGES; page++)
+	{
+		rewind_takeDirty(page);
+		memcpy(rewind_shadow + page * REWIND_PAGE_SIZE, rewind_page(page), REWIND_PAGE_SIZE);
+	}
+	rewind_saveState(rewind_state);
+
+	RewindEntry entry = { 0, 0 };
+	rewind_entries.push_back(entry);
+}
+
+static bool rewind_start()
+{
+	rewind_ringSize = CommonSettings.rewindBufferKB * 1024;
+	rewind_shadow = (u8*)malloc(REWIND_PAGES * REWIND_PAGE_SIZE);
+	rewind_ring = (u8*)malloc(rewind_ringSize);
+	if(!rewind_shadow || !rewind_ring)
+	{
+		printf("rewind: not enough memory for a %uKB buffer\n", CommonSettings.rewindBufferKB);
+		rewind_clear();
+		//dont try again every few frames
+		CommonSettings.rewindBufferKB = 0;
+		return false;
+	}
+
+	rewind_rebase();
+	return true;
+}
+
+//entry layout, in words: size of the state before, the state delta, then for each page the page number and its delta
+void rewindsave()
+{
+	if(CommonSettings.rewindBufferKB == 0)
+	{
+		if(rewind_shadow) rewind_clear();
+		return;
+	}
+
+	if(++rewind_frameCounter < CommonSettings.rewindInterval) return;
+	rewind_frameCounter = 0;
+
+#ifdef HAVE_JIT
+	arm_jit_sync();
+#endif
+
+	if(!rewind_shadow)
+	{
+		rewind_start();
 		return;
+	}
+
+	rewind_saveState(rewind_newState);
 
-	//printf("rewind\n");
+	u16 dirty[REWIND_PAGES];
+	u32 dirtyCount = 0;
+	for(u32 page = 0; page < REWIND_PAGES; page++)
+		if(rewind_takeDirty(page))
+			dirty[dirtyCount++] = page;
 
-	int size = rewindbuffer.size();
+	//the state deltas are taken over the longer of the two, as if the shorter one went on with zeroes
+	const u32 oldSize = rewind_state.size();
+	const u32 newSize = rewind_newState.size();
+	const u32 stateWords = std::max(oldSize, newSize) / 4;
+	const u32 bound = 4 * (1 + REWIND_RLE_BOUND(stateWords) + dirtyCount * (1 + REWIND_RLE_BOUND(REWIND_PAGE_SIZE/4)));
 
-	if(size < 1) {
-		printf("rewind buffer empty\n");
+	u32 *out = (u32*)rewind_reserve(bound);
+	if(!out)
+	{
+		//it might not fit even with the ring empty, so start over from here instead
+		rewind_rebase();
 		return;
 	}
+	u32 *const start = out;
+
+	*out++ = oldSize;
+	rewind_state.resize(stateWords * 4, 0);
+	rewind_newState.resize(stateWords * 4, 0);
+	out = rewind_encode(out, (const u32*)&rewind_newState[0], (u32*)&rewind_state[0], stateWords);
+	rewind_state.swap(rewind_newState);
+	rewind_state.resize(newSize);
+
+	for(u32 i = 0; i < dirtyCount; i++)
+	{
+		*out++ = dirty[i];
+		out = rewind_encode(out, (const u32*)rewind_page(dirty[i]), (u32*)(rewind_shadow + dirty[i] * REWIND_PAGE_SIZE), REWIND_PAGE_SIZE/4);
+	}
 
-	printf("%d", size);
+	RewindEntry entry;
+	entry.offset = rewind_ringHead;
+	entry.size = (u8*)out - (u8*)start;
+	rewind_entries.push_back(entry);
+	rewind_ringHead += entry.size;
+}
+
+//goes back to the newest snapshot, and drops it so that the next call goes back one further
+void dorewind()
+{
+	if(!rewind_shadow || rewind_entries.empty()) return;
 
-	EMUFILE_MEMORY* loadms = rewindbuffer[size-1];
-	loadms->fseek(32, SEEK_SET);
+	//back to the newest snapshot
+	for(u32 page = 0; page < REWIND_PAGES; page++)
+	{
+		if(!rewind_takeDirty(page)) continue;
+		memcpy(rewind_page(page), rewind_shadow + page * REWIND_PAGE_SIZE, REWIND_PAGE_SIZE);
+		if(page < MAINMEM_DIRTY_PAGES)
+			mainmem_dirty_map[page] |= MAINMEM_DIRTY_STATEHASH;
+		else
+			vram_dirty_map[page - MAINMEM_DIRTY_PAGES] |= VRAM_DIRTY_TEXCACHE | VRAM_DIRTY_STATEHASH;
+	}
 
-	ReadStateChunks(loadms,loadms->size()-32);
+	EMUFILE_MEMORY ms(&rewind_state);
+	ReadStateChunks(&ms, (s32)rewind_state.size());
 	loadstate();
 
-	if(rewindbuffer.size()>1)
+	//the oldest snapshot stays, there is nothing before it
+	if(rewind_entries.size() < 2) return;
+
+	//turn the copies into the snapshot before: the pages of the delta now differ from what is in memory
+	const RewindEntry entry = rewind_entries.back();
+	rewind_entries.pop_back();
+	rewind_ringHead = entry.offset;
+
+	const u32 *in = (const u32*)(rewind_ring + entry.offset);
+	const u32 *const end = (const u32*)(rewind_ring + entry.offset + entry.size);
+
+	const u32 oldSize = *in++;
+	const u32 stateWords = std::max(oldSize, (u32)rewind_state.size()) / 4;
+	rewind_state.resize(stateWords * 4, 0);
+	in = rewind_decode(in, (u32*)&rewind_state[0], stateWords);
+	rewind_state.resize(oldSize);
+
+	while(in < end)
 	{
-		rewindFreeList.push(loadms);
-		rewindbuffer.pop_back();
-	}*/
+		const u32 page = *in++;
+		in = rewind_decode(in, (u32*)(rewind_shadow + page * REWIND_PAGE_SIZE), REWIND_PAGE_SIZE/4);
+		rewind_markDirty(page);
+	}
 
+	rewind_frameCounter = 0;
 }
+
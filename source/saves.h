@@ -66,7 +66,29 @@ void loadstate_slot(int num);
 bool savestate_load(class EMUFILE* is);
 bool savestate_save(class EMUFILE* outstream, int compressionLevel);
 
+//saving without the hitch: the state is copied out right away and deflated and written by a worker thread,
+//to a temporary file which is then renamed over file_name. done is called from savestate_asyncPoll, on the
+//emulation thread, once the file is written or the save failed. only one save is in flight at a time; the
+//next one, and any load, waits for it first
+typedef void (*savestate_done_t)(const char *file_name, bool ok, int param);
+bool savestate_saveAsync(const char *file_name, savestate_done_t done = NULL, int param = 0);
+//reports a finished save. true while one is still in flight
+bool savestate_asyncPoll();
+void savestate_asyncWait();
+
+//only the 3d engine's chunks, without a header. for the 3d command traces
+void savestate_save3D(class EMUFILE* os);
+bool savestate_load3D(class EMUFILE* is);
+
+//feeds the savestate chunks to a hasher, less main memory and the lcdc vram. for STATEHASH_State
+void savestate_hash(class StateHasher &hasher);
+
+//rewinding, set up through CommonSettings.rewindBufferKB and rewindInterval.
+//rewindsave is called once per frame and takes a snapshot every so many; each dorewind goes back one
 void dorewind();
 void rewindsave();
+u32 rewind_count();
+//drops every snapshot and the memory for them
+void rewind_clear();
 
 #endif
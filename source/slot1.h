@@ -77,6 +77,14 @@ public:
 	//called when the cpu reads from the GC bus
 	virtual u32 read_GCDATAIN(u8 PROCNUM) { return 0xFFFFFFFF; }
 
+	//called when a card dma reads count words from the GC bus at once.
+	//this reads them one at a time, so only devices which can do better need to override it
+	virtual void read_GCDATAIN_block(u8 PROCNUM, u32 *dst, u32 count)
+	{
+		for(u32 i=0;i<count;i++)
+			dst[i] = read_GCDATAIN(PROCNUM);
+	}
+
 	//transfers a byte to the slot-1 device via auxspi, and returns the incoming byte
 	//cpu is provided for diagnostic purposes only.. the slot-1 device wouldn't know which CPU it is.
 	virtual u8 auxspi_transaction(int PROCNUM, u8 value) { return 0x00; }
@@ -0,0 +1,195 @@
+/*
+	Copyright (C) 2009-2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+#include "statehash.h"
+#include "GPU.h"
+#include "MMU.h"
+#include "saves.h"
+
+//the rounds and the primes are those of xxhash32, with a second set of output mixing for the high word
+#define PRIME1 2654435761U
+#define PRIME2 2246822519U
+#define PRIME3 3266489917U
+#define PRIME4 668265263U
+#define PRIME5 374761393U
+
+static FORCEINLINE u32 rotl32(u32 x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+static FORCEINLINE u32 round32(u32 acc, u32 word)
+{
+	acc += word * PRIME2;
+	return rotl32(acc, 13) * PRIME1;
+}
+
+static FORCEINLINE u32 avalanche32(u32 h)
+{
+	h ^= h >> 15;
+	h *= PRIME2;
+	h ^= h >> 13;
+	h *= PRIME3;
+	return h ^ (h >> 16);
+}
+
+StateHasher::StateHasher(u64 seed)
+	: tailLen(0)
+	, total(0)
+	, seedHigh((u32)(seed >> 32))
+{
+	const u32 s = (u32)seed;
+	lanes[0] = s + PRIME1 + PRIME2;
+	lanes[1] = s + PRIME2;
+	lanes[2] = s;
+	lanes[3] = s - PRIME1;
+}
+
+void StateHasher::update(const void *data, u32 len)
+{
+	const u8 *p = (const u8*)data;
+	total += len;
+
+	if(tailLen)
+	{
+		const u32 todo = std::min(len, 16 - tailLen);
+		memcpy(tail + tailLen, p, todo);
+		tailLen += todo;
+		p += todo;
+		len -= todo;
+		if(tailLen < 16) return;
+
+		u32 words[4];
+		memcpy(words, tail, 16);
+		for(int i = 0; i < 4; i++)
+			lanes[i] = round32(lanes[i], words[i]);
+		tailLen = 0;
+	}
+
+	u32 v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+	const u8 *const end = p + (len & ~15);
+	if(((uintptr_t)p & 3) == 0)
+	{
+		for(const u32 *w = (const u32*)p; (const u8*)w < end; w += 4)
+		{
+			v1 = round32(v1, w[0]);
+			v2 = round32(v2, w[1]);
+			v3 = round32(v3, w[2]);
+			v4 = round32(v4, w[3]);
+		}
+	}
+	else
+	{
+		for(const u8 *s = p; s < end; s += 16)
+		{
+			u32 w[4];
+			memcpy(w, s, 16);
+			v1 = round32(v1, w[0]);
+			v2 = round32(v2, w[1]);
+			v3 = round32(v3, w[2]);
+			v4 = round32(v4, w[3]);
+		}
+	}
+	lanes[0] = v1; lanes[1] = v2; lanes[2] = v3; lanes[3] = v4;
+
+	tailLen = len & 15;
+	memcpy(tail, end, tailLen);
+}
+
+u64 StateHasher::result() const
+{
+	const u32 v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+	u32 lo = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18) + total;
+	u32 hi = rotl32(v1, 3) ^ rotl32(v2, 11) ^ rotl32(v3, 19) ^ rotl32(v4, 27) ^ seedHigh;
+	hi += total * PRIME5;
+
+	u32 i = 0;
+	for(; i + 4 <= tailLen; i += 4)
+	{
+		u32 word;
+		memcpy(&word, tail + i, 4);
+		lo = rotl32(lo + word * PRIME3, 17) * PRIME4;
+		hi = rotl32(hi ^ (word * PRIME4), 15) * PRIME1;
+	}
+	for(; i < tailLen; i++)
+	{
+		lo = rotl32(lo + tail[i] * PRIME5, 11) * PRIME1;
+		hi = rotl32(hi ^ (tail[i] * PRIME1), 13) * PRIME5;
+	}
+
+	return ((u64)avalanche32(hi ^ lo) << 32) | avalanche32(lo);
+}
+
+u64 STATEHASH_Bytes(const void *data, u32 len, u64 seed)
+{
+	StateHasher hasher(seed);
+	hasher.update(data, len);
+	return hasher.result();
+}
+
+u64 STATEHASH_Frame()
+{
+	return STATEHASH_Bytes((const u8*)GPU_Screen, sizeof(GPU_Screen));
+}
+
+void STATEHASH_ToString(u64 hash, char *out)
+{
+	sprintf(out, "%08x%08x", (u32)(hash >> 32), (u32)hash);
+}
+
+//--------------state
+
+#define STATEHASH_PAGE_SIZE (1<<MAINMEM_DIRTY_PAGE_SHIFT)
+#define STATEHASH_PAGES (MAINMEM_DIRTY_PAGES + VRAM_DIRTY_PAGES)
+
+//the hash of each page of main memory, then of the lcdc vram, as of the last state hash
+static u64 statehash_pages[STATEHASH_PAGES];
+
+static const u8* statehash_page(u32 page)
+{
+	if(page < MAINMEM_DIRTY_PAGES) return MMU.MAIN_MEM + page * STATEHASH_PAGE_SIZE;
+	return MMU.ARM9_LCD + (page - MAINMEM_DIRTY_PAGES) * STATEHASH_PAGE_SIZE;
+}
+
+//true if the page was written since its hash was taken, and forgets it
+static bool statehash_takeDirty(u32 page)
+{
+	u8 &flags = (page < MAINMEM_DIRTY_PAGES) ? mainmem_dirty_map[page] : vram_dirty_map[page - MAINMEM_DIRTY_PAGES];
+	const u8 bit = (page < MAINMEM_DIRTY_PAGES) ? MAINMEM_DIRTY_STATEHASH : VRAM_DIRTY_STATEHASH;
+	if(!(flags & bit)) return false;
+	flags &= ~bit;
+	return true;
+}
+
+u64 STATEHASH_State()
+{
+	StateHasher hasher;
+	savestate_hash(hasher);
+
+	//a reset marks every page, so the first hash after one (a savestate load is one too) takes them all
+	for(u32 page = 0; page < STATEHASH_PAGES; page++)
+		if(statehash_takeDirty(page))
+			statehash_pages[page] = STATEHASH_Bytes(statehash_page(page), STATEHASH_PAGE_SIZE, page);
+
+	hasher.update(statehash_pages, sizeof(statehash_pages));
+	return hasher.result();
+}
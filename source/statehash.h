@@ -0,0 +1,55 @@
+/*
+	Copyright (C) 2009-2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _STATEHASH_H_
+#define _STATEHASH_H_
+
+#include "types.h"
+
+//64 bit hashes of what the emulator shows and of the whole emulated state, for telling two runs apart.
+//they only depend on the bytes hashed, so the same input played on two builds hashes the same until they desync.
+//
+//the state hash goes over the savestate chunks, except for main memory and the lcdc vram: those are hashed
+//by page, and only the pages written since the last state hash (see mainmem_dirty_map and vram_dirty_map)
+//get hashed again.
+
+//a streaming hash. four 32 bit lanes take a word each in turn, so that the multiplies of one word
+//dont have to wait for the word before (there is no integer simd on the psp to do them side by side)
+class StateHasher
+{
+	u32 lanes[4];
+	u8 tail[16];		//bytes of a stripe not complete yet
+	u32 tailLen;
+	u32 total;
+	u32 seedHigh;
+
+public:
+	StateHasher(u64 seed = 0);
+	void update(const void *data, u32 len);
+	u64 result() const;
+};
+
+u64 STATEHASH_Bytes(const void *data, u32 len, u64 seed = 0);
+
+//both screens, as GPU_Screen was left by the last frame
+u64 STATEHASH_Frame();
+u64 STATEHASH_State();
+
+//16 hex digits and the terminator
+void STATEHASH_ToString(u64 hash, char *out);
+
+#endif
@@ -20,7 +20,6 @@
 #include <string.h>
 #include <algorithm>
 #include <assert.h>
-#include <map>
 #include <malloc.h>
 
 #include "texcache.h"
@@ -82,6 +81,52 @@ public:
 		return 0;
 	}
 
+	//folds the contents of the memspan into a running 64bit hash.
+	//two independent 32bit lanes, since 64bit multiplies are expensive on allegrex.
+	//all texture, index and palette spans are multiples of 4 bytes, so we can go a word at a time
+	u64 hash(u64 seed)
+	{
+		u32 h1 = (u32)seed ^ 0x811C9DC5;
+		u32 h2 = (u32)(seed>>32) ^ (u32)size;
+		for(int i=0;i<numItems;i++)
+		{
+			const Item &item = items[i];
+			const u32* src = (const u32*)item.ptr;
+			for(u32 j = item.len>>2; j; j--)
+			{
+				u32 w = *src++;
+				h1 = (h1 ^ w) * 0x01000193;
+				h2 = ((h2 << 5) | (h2 >> 27)) ^ (w * 0x9E3779B1);
+			}
+		}
+		h2 ^= h1 >> 15;
+		h1 ^= h2 * 0x85EBCA6B;
+		return ((u64)h2<<32) | h1;
+	}
+
+	//folds the host pointers this memspan resolved to into a signature, to detect slot remapping
+	u32 mapSig(u32 seed)
+	{
+		for(int i=0;i<numItems;i++)
+			seed = (seed ^ (u32)items[i].ptr ^ items[i].len) * 0x01000193;
+		return seed;
+	}
+
+	//sets the bits for the vram_dirty_map pages this memspan reads from.
+	//unmapped (blank) memory is never written, so it doesnt need tracking
+	void markPages(u32* pages)
+	{
+		for(int i=0;i<numItems;i++)
+		{
+			const Item &item = items[i];
+			if(item.ptr < MMU.ARM9_LCD || item.ptr >= MMU.ARM9_LCD + sizeof(MMU.ARM9_LCD)) continue;
+			u32 ofs = item.ptr - MMU.ARM9_LCD;
+			u32 last = (ofs + item.len - 1)>>VRAM_DIRTY_PAGE_SHIFT;
+			for(u32 page = ofs>>VRAM_DIRTY_PAGE_SHIFT; page <= last; page++)
+				pages[page>>5] |= 1<<(page&31);
+		}
+	}
+
 	//TODO - get rid of duplication between these two methods.
 
 	//dumps the memspan to the specified buffer
@@ -210,11 +255,26 @@ class TexCache
 public:
 	TexCache()
 		: cache_size(0)
+		, lruHead(NULL)
+		, lruTail(NULL)
+		, epoch(0)
 	{
-		memset(paletteDump,0,sizeof(paletteDump));
+		memset(buckets,0,sizeof(buckets));
+		memset(pageEpoch,0,sizeof(pageEpoch));
 	}
 
-	TTexCacheItemMultimap index;
+	//items are chained by (texformat,texpal); several items may share a key when a game
+	//streams different contents through the same vram address, and are told apart by contentHash
+	static const int BUCKET_BITS = 10;
+	TexCacheItem* buckets[1<<BUCKET_BITS];
+
+	//most recently used at the head, eviction from the tail
+	TexCacheItem *lruHead, *lruTail;
+
+	static FORCEINLINE u32 bucketFor(u32 format, u32 texpal)
+	{
+		return ((format ^ (texpal * 0x85EBCA6B)) * 0x9E3779B1) >> (32-BUCKET_BITS);
+	}
 
 	//this ought to be enough for anyone
 	//static const u32 kMaxCacheSize = 64*1024*1024; 
@@ -231,16 +291,65 @@ public:
 	//this is not really precise, it is off by a constant factor
 	u32 cache_size;
 
+	void lru_unlink(TexCacheItem* item)
+	{
+		if(item->lruPrev) item->lruPrev->lruNext = item->lruNext;
+		else lruHead = item->lruNext;
+		if(item->lruNext) item->lruNext->lruPrev = item->lruPrev;
+		else lruTail = item->lruPrev;
+		item->lruPrev = item->lruNext = NULL;
+	}
+
+	void lru_push_front(TexCacheItem* item)
+	{
+		item->lruPrev = NULL;
+		item->lruNext = lruHead;
+		if(lruHead) lruHead->lruPrev = item;
+		else lruTail = item;
+		lruHead = item;
+	}
+
+	//mark an item as used by the current frame
+	void touch(TexCacheItem* item)
+	{
+		if(item == lruHead) return;
+		lru_unlink(item);
+		lru_push_front(item);
+	}
+
 	void list_remove(TexCacheItem* item)
 	{
-		index.erase(item->iterator);
-		cache_size -= item->decode_len;
+		TexCacheItem** link = &buckets[bucketFor(item->texformat,item->texpal)];
+		while(*link != item) link = &(*link)->hashNext;
+		*link = item->hashNext;
+		lru_unlink(item);
+		cache_size -= item->decode_len + item->sourceLen;
 	}
 
 	void list_push_front(TexCacheItem* item)
 	{
-		item->iterator = index.insert(std::make_pair(item->texformat,item));
-		cache_size += item->decode_len;
+		TexCacheItem** bucket = &buckets[bucketFor(item->texformat,item->texpal)];
+		item->hashNext = *bucket;
+		*bucket = item;
+		lru_push_front(item);
+		cache_size += item->decode_len + item->sourceLen;
+	}
+
+	//decodes the one byte per texel formats (A3I5, I8, A5I3) through a table of finished texels
+	static FORCEINLINE void decodeBytes(MemSpan& ms, const u32* lut, u32*& dwdst)
+	{
+		for(int j=0;j<ms.numItems;j++) {
+			const u32* src = (const u32*)ms.items[j].ptr;
+			for(u32 x = ms.items[j].len>>2; x; x--)
+			{
+				u32 bits = LE_TO_LOCAL_32(*src++);
+				dwdst[0] = lut[bits&0xFF];
+				dwdst[1] = lut[(bits>>8)&0xFF];
+				dwdst[2] = lut[(bits>>16)&0xFF];
+				dwdst[3] = lut[bits>>24];
+				dwdst += 4;
+			}
+		}
 	}
 
 	template<TexCache_TexFormat TEXFORMAT>
@@ -260,8 +369,6 @@ public:
 		u32 sizeY=(8 << ((format>>23)&0x07));
 		u32 imageSize = sizeX*sizeY;
 
-		u8 *adr;
-
 		u32 paletteAddress;
 
 		switch (textureMode)
@@ -302,79 +409,115 @@ public:
 		}
 
 
-		//dump the palette to a temp buffer, so that we don't have to worry about memory mapping.
-		//this isnt such a problem with texture memory, because we read sequentially from it.
-		//however, we read randomly from palette memory, so the mapping is more costly.
-		#ifdef WORDS_BIGENDIAN
-			mspal.dump16(pal);
-		#else
-			mspal.dump(pal);
-		#endif
-
-			//TODO - as a special optimization, keep the last item returned and check it first
-
-		for(std::pair<TTexCacheItemMultimap::iterator,TTexCacheItemMultimap::iterator>
-			iters = index.equal_range(format);
-			iters.first != iters.second;
-			++iters.first)
+		//find an item for this key which is still known good. between invalidations there can only be one
+		const u32 bucket = bucketFor(format,texpal);
+		for(TexCacheItem* curr = buckets[bucket]; curr; curr = curr->hashNext)
 		{
-			TexCacheItem* curr = iters.first->second;
-			
 			//conditions where we reject matches:
 			//when the teximage or texpal params dont match 
 			//(this is our key for identifying textures in the cache)
-			//NEW: due to using format as a key we dont need to check this anymore
-			//if(curr->texformat != format) continue;
-			if(curr->texpal != texpal) continue;
+			if(curr->texformat != format || curr->texpal != texpal) continue;
 
 			//we're being asked for a different format than what we had cached.
-			//TODO - this could be done at the entire cache level instead of checking repeatedly
-			if(curr->cacheFormat != TEXFORMAT) goto REJECT;
-
-			//if the texture is assumed invalid, reject it
-			if(curr->assumedInvalid) goto REJECT; 
+			if(curr->cacheFormat != TEXFORMAT) continue;
 
 			//the texture matches params, but isnt suspected invalid. accept it.
-			if(!curr->suspectedInvalid) return curr;
+			if(!curr->assumedInvalid && !curr->suspectedInvalid)
+			{
+				touch(curr);
+				return curr;
+			}
+		}
 
-			//we suspect the texture may be invalid. we need to do a byte-for-byte comparison to re-establish that it is valid:
+		//the vram may have changed since these items were decoded.
+		//first, accept an item if its pages are still mapped the same way and havent been written since it was last known good.
+		//note that we are considering 4x4 textures to have a palette size of 0.
+		//they really have a potentially HUGE palette, too big for us to handle like a normal palette,
+		//so instead the whole range it can reach is tracked here (but not hashed, below)
+		MemSpan msPal4x4;
+		if(textureMode == TEXMODE_4X4 && paletteAddress < 0x18000)
+			msPal4x4 = MemSpan_TexPalette(paletteAddress,min(0x10008u,0x18000-paletteAddress),true);
 
-			//when the palettes dont match:
-			//note that we are considering 4x4 textures to have a palette size of 0.
-			//they really have a potentially HUGE palette, too big for us to handle like a normal palette,
-			//so they go through a different system
-			if(mspal.size != 0 && memcmp(curr->dump.palette,pal,mspal.size)) goto REJECT;
+		syncDirtyPages();
+		const u32 mapSig = msPal4x4.mapSig(mspal.mapSig(msIndex.mapSig(ms.mapSig(0x811C9DC5))));
 
-			//when the texture data doesn't match
-			if(ms.memcmp(&curr->dump.texture[0],curr->dump.textureSize)) goto REJECT;
+		for(TexCacheItem* curr = buckets[bucket]; curr; curr = curr->hashNext)
+		{
+			if(curr->texformat != format || curr->texpal != texpal) continue;
+			if(curr->cacheFormat != TEXFORMAT) continue;
+			if(curr->assumedInvalid) continue;
+
+			if(curr->mapSig == mapSig && !pagesDirtySince(curr->vramPages,curr->validEpoch))
+			{
+				curr->suspectedInvalid = false;
+				curr->validEpoch = epoch;
+				touch(curr);
+				return curr;
+			}
+		}
+
+		//something under the candidates did change. rather than compare byte-for-byte
+		//against a dump of each candidate, hash the current contents once and look for an item decoded from them.
+		u64 contentHash = ms.hash(((u64)texpal<<32) | format);
+		if(textureMode == TEXMODE_4X4)
+			contentHash = msIndex.hash(contentHash);
+		if(palSize)
+			contentHash = mspal.hash(contentHash);
+
+		u32 vramPages[6] = {0};
+		ms.markPages(vramPages);
+		msIndex.markPages(vramPages);
+		mspal.markPages(vramPages);
+		msPal4x4.markPages(vramPages);
+
+		for(TexCacheItem* curr = buckets[bucket], *next; curr; curr = next)
+		{
+			next = curr->hashNext;
+			if(curr->texformat != format || curr->texpal != texpal) continue;
+			if(curr->cacheFormat != TEXFORMAT) continue;
 
-			//if the texture is 4x4 then the index data must match
-			if(textureMode == TEXMODE_4X4)
+			//an item which is assumed invalid cant ever be validated again, so throw it out right now.
+			//the same goes for 4x4 items which got here, since their palette isnt part of the hash
+			if(curr->assumedInvalid || textureMode == TEXMODE_4X4)
 			{
-				if(msIndex.memcmp(curr->dump.texture + curr->dump.textureSize,curr->dump.indexSize)) goto REJECT; 
+				list_remove(curr);
+				delete curr;
+				continue;
 			}
 
-			//we found a match. just return it
-			//REMINDER to make it primary/newest when we have smarter code
-			//list_remove(curr);
-			//list_push_front(curr);
+			if(curr->contentHash != contentHash) continue;
+
+			//a 64bit hash can still collide, and that would show the wrong texture
+			if(curr->sourceLen != (u32)(ms.size + mspal.size)) continue;
+			if(ms.memcmp(curr->sourceData) || mspal.memcmp(curr->sourceData + ms.size)) continue;
+
+			//we found a match. make it primary/newest and return it
 			curr->suspectedInvalid = false;
+			memcpy(curr->vramPages,vramPages,sizeof(vramPages));
+			curr->mapSig = mapSig;
+			curr->validEpoch = epoch;
+			touch(curr);
 			return curr;
-
-		REJECT:
-			//we found a cached item for the current address, but the data is stale.
-			//for a variety of complicated reasons, we need to throw it out right this instant.
-			list_remove(curr);
-			delete curr;
-			break;
 		}
 
-		//item was not found. recruit an existing one (the oldest), or create a new one
-		//evict(); //reduce the size of the cache if necessary
-		//TODO - as a peculiarity of the texcache, eviction must happen after the entire 3d frame runs
-		//to support separate cache and read passes
+		//item was not found, so we will have to decode it. dump the palette to a temp buffer so that we don't have to worry about memory mapping.
+		//this isnt such a problem with texture memory, because we read sequentially from it.
+		//however, we read randomly from palette memory, so the mapping is more costly.
+		#ifdef WORDS_BIGENDIAN
+			mspal.dump16(pal);
+		#else
+			mspal.dump(pal);
+		#endif
+
+		//create the new item.
+		//as a peculiarity of the texcache, eviction must happen after the entire 3d frame runs
+		//(the GU is still reading from the decoded buffers until then), see TexCache_EvictFrame()
 		TexCacheItem* newitem = new TexCacheItem();
 		newitem->suspectedInvalid = false;
+		newitem->contentHash = contentHash;
+		memcpy(newitem->vramPages,vramPages,sizeof(vramPages));
+		newitem->mapSig = mapSig;
+		newitem->validEpoch = epoch;
 		newitem->texformat = format;
 		newitem->cacheFormat = TEXFORMAT;
 		newitem->texpal = texpal;
@@ -392,24 +535,17 @@ public:
 		newitem->decode_len = sizeX*sizeY*4;
 		newitem->mode = textureMode;
 		newitem->decoded = (u8*)memalign(16, newitem->decode_len);//new u8[newitem->decode_len];
-		list_push_front(newitem);
-		//printf("allocating: up to %d with %d items\n",cache_size,index.size());
-
-		u32 *dwdst = (u32*)newitem->decoded;
-		
-		//dump palette data for cache keying
-		if(palSize)
+		if(textureMode != TEXMODE_4X4)
 		{
-			fast_memcpy(newitem->dump.palette, pal, palSize*2);
+			newitem->sourceLen = ms.size + mspal.size;
+			newitem->sourceData = new u8[newitem->sourceLen + 1];
+			ms.dump(newitem->sourceData);
+			mspal.dump(newitem->sourceData + ms.size);
 		}
+		list_push_front(newitem);
+		//printf("allocating: up to %d\n",cache_size);
 
-		//dump texture and 4x4 index data for cache keying
-		const int texsize = newitem->dump.textureSize = ms.size;
-		const int indexsize = newitem->dump.indexSize = msIndex.size;
-		newitem->dump.texture = (u8*)memalign(16,texsize+indexsize);
-		ms.dump(&newitem->dump.texture[0],newitem->dump.maxTextureSize); //dump texture
-		if(textureMode == TEXMODE_4X4)
-			msIndex.dump(newitem->dump.texture+newitem->dump.textureSize,newitem->dump.indexSize); //dump 4x4
+		u32 *dwdst = (u32*)newitem->decoded;
 
 
 		//============================================================================ 
@@ -421,88 +557,68 @@ public:
 
 		//printf("TEXTURE: %d\n", newitem->mode);
 
+		//the paletted formats are decoded through a table of finished texels built once per texture,
+		//indexed by a whole byte of texture data (index and alpha bits together where the format has them).
+		//that leaves a load and a store per texel, and the texture data is read a word at a time.
+		u32 lut[256];
+
 		switch (newitem->mode)
 		{
 		case TEXMODE_A3I5:
 			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
-					{
-						u16 c = pal[*adr&31];
-						u8 alpha = *adr>>5;
-						if(TEXFORMAT == TexFormat_15bpp)
-							*dwdst++ = RGB15TO6665(c,material_3bit_to_5bit[alpha]);
-						else
-							*dwdst++ = RGB15TO32(c,material_3bit_to_8bit[alpha]);
-						adr++;
-					}
+				for(int i=0;i<256;i++)
+				{
+					if(TEXFORMAT == TexFormat_15bpp)
+						lut[i] = RGB15TO6665(pal[i&31],material_3bit_to_5bit[i>>5]);
+					else
+						lut[i] = RGB15TO32(pal[i&31],material_3bit_to_8bit[i>>5]);
 				}
+				decodeBytes(ms,lut,dwdst);
 				break;
 			}
 
 		case TEXMODE_I2:
 			{
+				for(int i=0;i<4;i++)
+					lut[i] = CONVERT(pal[i],(i == 0) ? palZeroTransparent : opaqueColor);
 				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
+					const u32* src = (const u32*)ms.items[j].ptr;
+					for(u32 x = ms.items[j].len>>2; x; x--)
 					{
-						u8 bits;
-						u16 c;
-
-						bits = (*adr)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>2)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>4)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>6)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						adr++;
+						u32 bits = LE_TO_LOCAL_32(*src++);
+						for(int i=0;i<16;i++,bits>>=2)
+							*dwdst++ = lut[bits&3];
 					}
 				}
 				break;
 			}
 		case TEXMODE_I4:
 			{
+				for(int i=0;i<16;i++)
+					lut[i] = CONVERT(pal[i],(i == 0) ? palZeroTransparent : opaqueColor);
 				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
+					const u32* src = (const u32*)ms.items[j].ptr;
+					for(u32 x = ms.items[j].len>>2; x; x--)
 					{
-						u8 bits;
-						u16 c;
-
-						bits = (*adr)&0xF;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>4);
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-						adr++;
+						u32 bits = LE_TO_LOCAL_32(*src++);
+						dwdst[0] = lut[bits&0xF];
+						dwdst[1] = lut[(bits>>4)&0xF];
+						dwdst[2] = lut[(bits>>8)&0xF];
+						dwdst[3] = lut[(bits>>12)&0xF];
+						dwdst[4] = lut[(bits>>16)&0xF];
+						dwdst[5] = lut[(bits>>20)&0xF];
+						dwdst[6] = lut[(bits>>24)&0xF];
+						dwdst[7] = lut[bits>>28];
+						dwdst += 8;
 					}
 				}
 				break;
 			}
 		case TEXMODE_I8:
 			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; ++x)
-					{
-						u16 c = pal[*adr];
-						*dwdst++ = CONVERT(c,(*adr == 0) ? palZeroTransparent : opaqueColor);
-						adr++;
-					}
-				}
+				for(int i=0;i<256;i++)
+					lut[i] = CONVERT(pal[i],(i == 0) ? palZeroTransparent : opaqueColor);
+				decodeBytes(ms,lut,dwdst);
 			}
 			break;
 		case TEXMODE_4X4:
@@ -532,6 +648,9 @@ public:
 				//i am guessing we just generate black in that case
 				bool dead = false;
 
+				u32 tmp_col[4];
+				u32 lastPal1 = 0xFFFFFFFF;
+
 				for (int y = 0; y < yTmpSize; y ++)
 				{
 					u32 tmpPos[4]={(y<<2)*sizeX,((y<<2)+1)*sizeX,
@@ -552,88 +671,93 @@ public:
 
 						u32 currBlock	= LE_TO_LOCAL_32(map[d]);
 						u16 pal1		= LE_TO_LOCAL_16(slot1[d]);
-						u16 pal1offset	= (pal1 & 0x3FFF)<<1;
-						u8  mode		= pal1>>14;
-						u32 tmp_col[4];
-						
-						tmp_col[0] = RGB15TO32( PAL4X4(pal1offset), 0xFF );
-						tmp_col[1] = RGB15TO32( PAL4X4(pal1offset+1), 0xFF );
 
-						switch (mode) 
+						//neighbouring blocks very often share their palette and mode; the colors only depend on those
+						if(pal1 != lastPal1)
 						{
-							case 0:
-								tmp_col[2] = RGB15TO32( PAL4X4(pal1offset+2), 0xFF );
-								tmp_col[3] = RGB15TO32(0x7FFF, 0x00);
-								break;
+							lastPal1 = pal1;
+							u16 pal1offset	= (pal1 & 0x3FFF)<<1;
+							u8  mode		= pal1>>14;
+						
+							tmp_col[0] = RGB15TO32( PAL4X4(pal1offset), 0xFF );
+							tmp_col[1] = RGB15TO32( PAL4X4(pal1offset+1), 0xFF );
+
+							switch (mode) 
+							{
+								case 0:
+									tmp_col[2] = RGB15TO32( PAL4X4(pal1offset+2), 0xFF );
+									tmp_col[3] = RGB15TO32(0x7FFF, 0x00);
+									break;
 								
-							case 1:
+								case 1:
 #ifdef LOCAL_BE
-								tmp_col[2]	= ( (((tmp_col[0] & 0xFF000000) >> 1)+((tmp_col[1] & 0xFF000000)  >> 1)) & 0xFF000000 ) |
-											  ( (((tmp_col[0] & 0x00FF0000)      + (tmp_col[1] & 0x00FF0000)) >> 1)  & 0x00FF0000 ) |
-											  ( (((tmp_col[0] & 0x0000FF00)      + (tmp_col[1] & 0x0000FF00)) >> 1)  & 0x0000FF00 ) |
-											  0x000000FF;
-								tmp_col[3]	= 0xFFFFFF00;
+									tmp_col[2]	= ( (((tmp_col[0] & 0xFF000000) >> 1)+((tmp_col[1] & 0xFF000000)  >> 1)) & 0xFF000000 ) |
+												  ( (((tmp_col[0] & 0x00FF0000)      + (tmp_col[1] & 0x00FF0000)) >> 1)  & 0x00FF0000 ) |
+												  ( (((tmp_col[0] & 0x0000FF00)      + (tmp_col[1] & 0x0000FF00)) >> 1)  & 0x0000FF00 ) |
+												  0x000000FF;
+									tmp_col[3]	= 0xFFFFFF00;
 #else
-								tmp_col[2]	= ( (((tmp_col[0] & 0x00FF00FF) + (tmp_col[1] & 0x00FF00FF)) >> 1) & 0x00FF00FF ) |
-											  ( (((tmp_col[0] & 0x0000FF00) + (tmp_col[1] & 0x0000FF00)) >> 1) & 0x0000FF00 ) |
-											  0xFF000000;
-								tmp_col[3]	= 0x00FFFFFF;
+									tmp_col[2]	= ( (((tmp_col[0] & 0x00FF00FF) + (tmp_col[1] & 0x00FF00FF)) >> 1) & 0x00FF00FF ) |
+												  ( (((tmp_col[0] & 0x0000FF00) + (tmp_col[1] & 0x0000FF00)) >> 1) & 0x0000FF00 ) |
+												  0xFF000000;
+									tmp_col[3]	= 0x00FFFFFF;
 #endif
-								break;
+									break;
 								
-							case 2:
-								tmp_col[2] = RGB15TO32( PAL4X4(pal1offset+2), 0xFF );
-								tmp_col[3] = RGB15TO32( PAL4X4(pal1offset+3), 0xFF );
-								break;
+								case 2:
+									tmp_col[2] = RGB15TO32( PAL4X4(pal1offset+2), 0xFF );
+									tmp_col[3] = RGB15TO32( PAL4X4(pal1offset+3), 0xFF );
+									break;
 								
-							case 3:
-							{
+								case 3:
+								{
 #ifdef LOCAL_BE
-								const u32 r0	= (tmp_col[0]>>24) & 0x000000FF;
-								const u32 r1	= (tmp_col[1]>>24) & 0x000000FF;
-								const u32 g0	= (tmp_col[0]>>16) & 0x000000FF;
-								const u32 g1	= (tmp_col[1]>>16) & 0x000000FF;
-								const u32 b0	= (tmp_col[0]>> 8) & 0x000000FF;
-								const u32 b1	= (tmp_col[1]>> 8) & 0x000000FF;
+									const u32 r0	= (tmp_col[0]>>24) & 0x000000FF;
+									const u32 r1	= (tmp_col[1]>>24) & 0x000000FF;
+									const u32 g0	= (tmp_col[0]>>16) & 0x000000FF;
+									const u32 g1	= (tmp_col[1]>>16) & 0x000000FF;
+									const u32 b0	= (tmp_col[0]>> 8) & 0x000000FF;
+									const u32 b1	= (tmp_col[1]>> 8) & 0x000000FF;
 #else
-								const u32 r0	=  tmp_col[0]      & 0x000000FF;
-								const u32 r1	=  tmp_col[1]      & 0x000000FF;
-								const u32 g0	= (tmp_col[0]>> 8) & 0x000000FF;
-								const u32 g1	= (tmp_col[1]>> 8) & 0x000000FF;
-								const u32 b0	= (tmp_col[0]>>16) & 0x000000FF;
-								const u32 b1	= (tmp_col[1]>>16) & 0x000000FF;
+									const u32 r0	=  tmp_col[0]      & 0x000000FF;
+									const u32 r1	=  tmp_col[1]      & 0x000000FF;
+									const u32 g0	= (tmp_col[0]>> 8) & 0x000000FF;
+									const u32 g1	= (tmp_col[1]>> 8) & 0x000000FF;
+									const u32 b0	= (tmp_col[0]>>16) & 0x000000FF;
+									const u32 b1	= (tmp_col[1]>>16) & 0x000000FF;
 #endif
 
-								const u16 tmp1	= (  (r0*5 + r1*3)>>6) |
-												  ( ((g0*5 + g1*3)>>6) <<  5 ) |
-												  ( ((b0*5 + b1*3)>>6) << 10 );
-								const u16 tmp2	= (  (r0*3 + r1*5)>>6) |
-												  ( ((g0*3 + g1*5)>>6) <<  5 ) |
-												  ( ((b0*3 + b1*5)>>6) << 10 );
-
-								tmp_col[2] = RGB15TO32(tmp1, 0xFF);
-								tmp_col[3] = RGB15TO32(tmp2, 0xFF);
-								break;
+									const u16 tmp1	= (  (r0*5 + r1*3)>>6) |
+													  ( ((g0*5 + g1*3)>>6) <<  5 ) |
+													  ( ((b0*5 + b1*3)>>6) << 10 );
+									const u16 tmp2	= (  (r0*3 + r1*5)>>6) |
+													  ( ((g0*3 + g1*5)>>6) <<  5 ) |
+													  ( ((b0*3 + b1*5)>>6) << 10 );
+
+									tmp_col[2] = RGB15TO32(tmp1, 0xFF);
+									tmp_col[3] = RGB15TO32(tmp2, 0xFF);
+									break;
+								}
 							}
-						}
 
-						if(TEXFORMAT==TexFormat_15bpp)
-						{
-							for (size_t i = 0; i < 4; i++)
+							if(TEXFORMAT==TexFormat_15bpp)
 							{
+								for (size_t i = 0; i < 4; i++)
+								{
 #ifdef LOCAL_BE
-								const u32 a = (tmp_col[i] >> 3) & 0x0000001F;
-								tmp_col[i] >>= 2;
-								tmp_col[i] &= 0x3F3F3F00;
-								tmp_col[i] |= a;
+									const u32 a = (tmp_col[i] >> 3) & 0x0000001F;
+									tmp_col[i] >>= 2;
+									tmp_col[i] &= 0x3F3F3F00;
+									tmp_col[i] |= a;
 #else
-								const u32 a = (tmp_col[i] >> 3) & 0x1F000000;
-								tmp_col[i] >>= 2;
-								tmp_col[i] &= 0x003F3F3F;
-								tmp_col[i] |= a;
+									const u32 a = (tmp_col[i] >> 3) & 0x1F000000;
+									tmp_col[i] >>= 2;
+									tmp_col[i] &= 0x003F3F3F;
+									tmp_col[i] |= a;
 #endif
+								}
 							}
-						}
+						} //pal1 != lastPal1
 
 						//TODO - this could be more precise for 32bpp mode (run it through the color separation table)
 
@@ -655,31 +779,28 @@ public:
 			}
 		case TEXMODE_A5I3:
 			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; ++x)
-					{
-						u16 c = pal[*adr&0x07];
-						u8 alpha = (*adr>>3);
-						if(TEXFORMAT == TexFormat_15bpp)
-							*dwdst++ = RGB15TO6665(c,alpha);
-						else
-							*dwdst++ = RGB15TO32(c,material_5bit_to_8bit[alpha]);
-						adr++;
-					}
+				for(int i=0;i<256;i++)
+				{
+					if(TEXFORMAT == TexFormat_15bpp)
+						lut[i] = RGB15TO6665(pal[i&0x07],i>>3);
+					else
+						lut[i] = RGB15TO32(pal[i&0x07],material_5bit_to_8bit[i>>3]);
 				}
+				decodeBytes(ms,lut,dwdst);
 				break;
 			}
 		case TEXMODE_16BPP:
 			{
 				for(int j=0;j<ms.numItems;j++) {
-					u16* map = (u16*)ms.items[j].ptr;
-					int len = ms.items[j].len>>1;
-					for(int x = 0; x < len; ++x)
+					const u32* map = (const u32*)ms.items[j].ptr;
+					for(u32 x = ms.items[j].len>>2; x; x--)
 					{
-						u16 c = map[x];
-						int alpha = ((c&0x8000)?opaqueColor:0);
-						*dwdst++ = CONVERT(c&0x7FFF,alpha);
+						//two texels at a time; the alpha bit becomes all or nothing without branching
+						u32 c2 = LE_TO_LOCAL_32(*map++);
+						u32 c = c2 & 0xFFFF;
+						*dwdst++ = CONVERT(c&0x7FFF,opaqueColor & -(s32)(c>>15));
+						c = c2 >> 16;
+						*dwdst++ = CONVERT(c&0x7FFF,opaqueColor & -(s32)(c>>15));
 					}
 				}
 				break;
@@ -693,53 +814,61 @@ public:
 		return newitem;
 	} //scan()
 
-	static const int PALETTE_DUMP_SIZE = 96*1024;//64 + 32
-	u8 paletteDump[PALETTE_DUMP_SIZE];
+	//bumped whenever vram_dirty_map is consumed with anything set in it
+	u32 epoch;
+	//the epoch at which each page of vram_dirty_map was last written
+	u32 pageEpoch[VRAM_DIRTY_PAGES];
 
-	void invalidate()
+	//move the pages written since the last call into pageEpoch
+	void syncDirtyPages()
 	{
-		//check whether the palette memory changed
-		//TODO - we should handle this instead by setting dirty flags in the vram memory mapping and noting whether palette memory was dirty.
-		//but this will work for now
-		MemSpan mspal = MemSpan_TexPalette(0,PALETTE_DUMP_SIZE,true);
-		bool paletteDirty = mspal.memcmp(paletteDump);
-		if(paletteDirty)
+		bool any = false;
+		for(int i=0;i<VRAM_DIRTY_PAGES;i++)
 		{
-			mspal.dump(paletteDump);
+			if(!(vram_dirty_map[i] & VRAM_DIRTY_TEXCACHE)) continue;
+			if(!any) { epoch++; any = true; }
+			pageEpoch[i] = epoch;
+			vram_dirty_map[i] &= ~VRAM_DIRTY_TEXCACHE;
 		}
+	}
 
-		for(TTexCacheItemMultimap::iterator it(index.begin()); it != index.end(); ++it)
+	bool pagesDirtySince(const u32* pages, u32 since)
+	{
+		for(int w=0;w<6;w++)
 		{
-			it->second->suspectedInvalid = true;
-			
-			//when the palette changes, we assume all 4x4 textures are dirty.
-			//this is because each 4x4 item doesnt carry along with it a copy of the entire palette, for verification
-			//instead, we just use the one paletteDump for verifying of all 4x4 textures; and if paletteDirty is set, verification has failed
-			if(it->second->getTextureMode() == TEXMODE_4X4 && paletteDirty)
-			{
-				it->second->assumedInvalid = true;
-			}
+			if(!pages[w]) continue;
+			for(int i=0;i<32;i++)
+				if(((pages[w]>>i)&1) && pageEpoch[(w<<5)+i] > since)
+					return true;
 		}
+		return false;
+	}
+
+	void invalidate()
+	{
+		//something about the texture or palette vram mapping changed (or vram was written while mapped elsewhere).
+		//everything becomes suspect, but scan() will only have to look at the contents of items whose pages actually changed
+		syncDirtyPages();
+
+		for(TexCacheItem* item = lruHead; item; item = item->lruNext)
+			item->suspectedInvalid = true;
 	}
 
 	void evict(u32 target = kMaxCacheSize)
 	{
 		//debug print
-		//printf("%d %d/%d\n",index.size(),cache_size/1024,target/1024);
+		//printf("%d/%d\n",cache_size/1024,target/1024);
 
 		//dont do anything unless we're over the target
-		if(cache_size<target) return;
-
-		//aim at cutting the cache to half of the max size
-		target/=2;
+		if(cache_size<=target) return;
 
-		//evicts items in an arbitrary order until it is less than the max cache size
-		//TODO - do this based on age and not arbitrarily
+		//evicts the least recently used items until we're back within the budget.
+		//this only runs once the frame is finished, so anything used by it is safe to free
 		while(cache_size > target)
 		{
-			if(index.size()==0) break; //just in case.. doesnt seem possible, cache_size wouldve been 0
+			if(!lruTail) break; //just in case.. doesnt seem possible, cache_size wouldve been 0
 
-			TexCacheItem* item = index.begin()->second;
+			TexCacheItem* item = lruTail;
 			list_remove(item);
 			//printf("evicting! totalsize:%d\n",cache_size);
 			delete item;
@@ -20,7 +20,7 @@
 #ifndef _TEXCACHE_H_
 #define _TEXCACHE_H_
 
-#include <map>
+#include <stdlib.h>
 
 #include "types.h"
 
@@ -31,10 +31,6 @@ enum TexCache_TexFormat
 	TexFormat_15bpp //used by rasterizer
 };
 
-class TexCacheItem;
-
-typedef std::multimap<u32,TexCacheItem*> TTexCacheItemMultimap;
-
 class TexCacheItem
 {
 public:
@@ -44,10 +40,19 @@ public:
 		, suspectedInvalid(false)
 		, assumedInvalid(false)
 		, deleteCallback(NULL)
+		, contentHash(0)
+		, sourceData(NULL)
+		, sourceLen(0)
+		, mapSig(0)
+		, validEpoch(0)
+		, hashNext(NULL)
+		, lruPrev(NULL)
+		, lruNext(NULL)
 		, cacheFormat(TexFormat_None)
 	{}
 	~TexCacheItem() {
-		delete[] decoded;
+		free(decoded); //allocated with memalign
+		delete[] sourceData;
 		if(deleteCallback) deleteCallback(this);
 	}
 	
@@ -69,21 +74,29 @@ public:
 
 	u64 texid; //used by ogl renderer for the texid
 
-	TTexCacheItemMultimap::iterator iterator;
+	//hash of the texture, 4x4 index and palette data this item was decoded from.
+	//only recomputed from vram when the item is suspected invalid
+	u64 contentHash;
+
+	//the texture and palette bytes themselves, so that a hash match is confirmed before the item is reused.
+	//not kept for 4x4 items, which are never matched by hash
+	u8* sourceData;
+	u32 sourceLen;
+
+	//the 4KB pages of the LCDC buffer the item was decoded from (one bit per vram_dirty_map entry),
+	//a signature of the slot mapping they were reached through, and the texcache epoch they were last known good at.
+	//as long as none of these changed, a suspected invalid item can be accepted without looking at its contents
+	u32 vramPages[6];
+	u32 mapSig;
+	u32 validEpoch;
+
+	//chain within the (texformat,texpal) hash bucket, and position in the LRU list
+	TexCacheItem *hashNext;
+	TexCacheItem *lruPrev, *lruNext;
 
 	int getTextureMode() const { return (int)((texformat>>26)&0x07); }
 
 	TexCache_TexFormat cacheFormat;
-
-	struct Dump {
-		~Dump() {
-			delete[] texture;
-		}
-		int textureSize, indexSize;
-		static const int maxTextureSize=128*1024;
-		u8* texture;
-		u8 palette[256*2];
-	} dump;
 };
 
 void TexCache_Invalidate();
@@ -0,0 +1,101 @@
+/*
+	Copyright (C) 2008 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RINGBUFFER_H_
+#define _RINGBUFFER_H_
+
+#include "../types.h"
+
+//a fixed capacity queue for one producer thread and one consumer thread.
+//neither side locks, and nothing is allocated after construction.
+//CAPACITY must be a power of two
+template<typename T, u32 CAPACITY>
+class SPSCRing
+{
+public:
+	SPSCRing() : head(0), tail(0) {}
+
+	enum { CACHE_LINE = 64 };
+
+	//producer side
+	bool push(const T& item)
+	{
+		const u32 h = head;
+		if(h - tail == CAPACITY) return false;
+		items[h & (CAPACITY-1)] = item;
+		barrier(); //the item has to be visible before the new head
+		head = h + 1;
+		return true;
+	}
+
+	//consumer side
+	bool pop(T& item)
+	{
+		const u32 t = tail;
+		if(head == t) return false;
+		barrier(); //dont read the item before seeing the head that published it
+		item = items[t & (CAPACITY-1)];
+		barrier();
+		tail = t + 1;
+		return true;
+	}
+
+	//producer side. pushes as many as fit and returns how many that was
+	u32 push(const T* src, u32 count)
+	{
+		const u32 h = head;
+		const u32 space = CAPACITY - (h - tail);
+		if(count > space) count = space;
+		for(u32 i=0;i<count;i++)
+			items[(h+i) & (CAPACITY-1)] = src[i];
+		barrier();
+		head = h + count;
+		return count;
+	}
+
+	//consumer side. pops as many as are there, up to count, and returns how many that was
+	u32 pop(T* dst, u32 count)
+	{
+		const u32 t = tail;
+		const u32 avail = head - t;
+		if(count > avail) count = avail;
+		barrier();
+		for(u32 i=0;i<count;i++)
+			dst[i] = items[(t+i) & (CAPACITY-1)];
+		barrier();
+		tail = t + count;
+		return count;
+	}
+
+	u32 size() const { return head - tail; }
+	bool empty() const { return head == tail; }
+
+	//only safe while the consumer is not running
+	void clear() { tail = head; }
+
+private:
+	static FORCEINLINE void barrier() { __sync_synchronize(); }
+
+	//head and tail are each written by one side only, so keep them off each other's cache line
+	volatile u32 head;
+	u8 pad0[CACHE_LINE - sizeof(u32)];
+	volatile u32 tail;
+	u8 pad1[CACHE_LINE - sizeof(u32)];
+	T items[CAPACITY];
+};
+
+#endif